@@ -7,7 +7,28 @@
 // Limits come from GMP.
 // 
 // e.g. "2*(12*12+1)-1" --> 289
+//
+// Postfix operators n! (factorial), n!! n!!! ... (multi-factorials) and n#
+// (primorial, product of the primes up to n) bind tighter than ^, e.g.
+// "1000#+1" or "2^3!" --> 64
+//
+// mpz_expression_parse_form() also returns true when the expression is
+// literally k * b^n + c, e.g. "3*2^1000-1", with small k and c, and fills
+// the form descriptor.
+//
+// mpz_expression_parse_checked() is for untrusted input, the parse stops
+// at the first error (syntax, invalid character, division by 0, negative
+// result, too many nested operands, too large power) : -1 when invalid,
+// 1 with a form, 0 without.
+//
+// The parser is reentrant, each thread keeps its own parser state and a
+// small cache of recently computed large powers like 2^86243.
 // -----------------------------------------------------------------------
 
 #include "gmp.h"
+#include "quadratic_primality_precompute.h"
+
 void mpz_expression_parse(mpz_t n, char *str);
+bool mpz_expression_parse_form(mpz_t n, char *str, struct number_form_t *form);
+int mpz_expression_parse_checked(mpz_t n, char *str, struct number_form_t *form);
+void mpz_expression_self_test(void);
@@ -0,0 +1,233 @@
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "checkpoint.h"
+
+#define CHECKPOINT_MAGIC 0x4b43504c // "LPCK"
+#define CHECKPOINT_COMPACT 65536    // records before the journal is rewritten, at least
+
+typedef struct checkpoint_record_s
+{
+    uint32_t magic;
+    uint32_t done;
+    uint64_t index;
+    uint64_t count;
+    uint64_t checksum;
+    uint128_t seed;
+    checkpoint_state_t state;
+} checkpoint_record_t;
+
+static std::string journal_name;
+static int fd = -1;
+static std::vector<checkpoint_record_t> pending;
+static std::unordered_map<uint64_t, checkpoint_block_t> live; // blocks not done
+static checkpoint_state_t last_state;
+static uint64_t written = 0; // records in the journal
+
+static uint64_t checkpoint_checksum(const checkpoint_record_t *r)
+{
+    checkpoint_record_t t = *r;
+    t.checksum = 0;
+    const uint8_t *p = (const uint8_t *)&t;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < sizeof(t); i++)
+    {
+        h ^= p[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+static void checkpoint_record(checkpoint_record_t *r, uint64_t index, uint128_t seed, uint64_t count,
+                              const checkpoint_state_t *state)
+{
+    memset(r, 0, sizeof(*r)); // padding too, for the checksum
+    r->magic = CHECKPOINT_MAGIC;
+    r->done = count == 0;
+    r->index = index;
+    r->count = count;
+    r->seed = seed;
+    r->state = *state;
+    r->checksum = checkpoint_checksum(r);
+}
+
+static bool checkpoint_write(int f, const void *data, size_t len)
+{
+    const char *pt = (const char *)data;
+    while (len)
+    {
+        ssize_t r = write(f, pt, len);
+        if (r < 0)
+        {
+            perror(journal_name.c_str());
+            return false;
+        }
+        pt += r;
+        len -= r;
+    }
+    return true;
+}
+
+// the journal is replaced by the blocks not done, atomically
+static bool checkpoint_compact(void)
+{
+    std::string tmp = journal_name + ".tmp";
+    int f = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (f < 0)
+    {
+        perror(tmp.c_str());
+        return false;
+    }
+    std::vector<checkpoint_record_t> records;
+    checkpoint_record_t r;
+    records.reserve(live.size() + 1);
+    // the state alone first, when no block is left
+    checkpoint_record(&r, 0, 0, 0, &last_state);
+    records.push_back(r);
+    for (auto &it : live)
+    {
+        checkpoint_record(&r, it.first, it.second.seed, it.second.count, &last_state);
+        records.push_back(r);
+    }
+    size_t n = records.size();
+    if (!checkpoint_write(f, records.data(), n * sizeof(checkpoint_record_t)) || fsync(f) < 0)
+    {
+        close(f);
+        return false;
+    }
+    close(f);
+    if (rename(tmp.c_str(), journal_name.c_str()) < 0)
+    {
+        perror(journal_name.c_str());
+        return false;
+    }
+    // the rename is durable when the directory is
+    size_t slash = journal_name.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : journal_name.substr(0, slash + 1);
+    int d = open(dir.c_str(), O_RDONLY);
+    if (d >= 0)
+    {
+        fsync(d);
+        close(d);
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    fd = open(journal_name.c_str(), O_WRONLY | O_APPEND);
+    if (fd < 0)
+    {
+        perror(journal_name.c_str());
+        return false;
+    }
+    written = n;
+    return true;
+}
+
+bool checkpoint_open(const char *name, bool resume, uint64_t first_index, checkpoint_state_t *state,
+                     std::vector<checkpoint_block_t> *blocks)
+{
+    bool found = false;
+    journal_name = name;
+    last_state = *state;
+    blocks->clear();
+
+    int f = resume ? open(name, O_RDONLY) : -1;
+    if (f >= 0)
+    {
+        // replay, a torn or corrupted tail is ignored
+        std::unordered_map<uint64_t, checkpoint_block_t> map;
+        checkpoint_record_t r;
+        while (read(f, &r, sizeof(r)) == sizeof(r) && r.magic == CHECKPOINT_MAGIC &&
+               r.checksum == checkpoint_checksum(&r))
+        {
+            if (r.done)
+            {
+                map.erase(r.index);
+            }
+            else
+            {
+                map[r.index] = {r.seed, r.count};
+            }
+            last_state = r.state;
+            found = true;
+        }
+        close(f);
+        for (auto &it : map)
+        {
+            blocks->push_back(it.second);
+        }
+        std::sort(blocks->begin(), blocks->end(),
+                  [](const checkpoint_block_t &a, const checkpoint_block_t &b) { return a.seed < b.seed; });
+    }
+    *state = last_state;
+
+    // the blocks not done are dispatched again first, from first_index
+    live.clear();
+    for (size_t i = 0; i < blocks->size(); i++)
+    {
+        live[first_index + i] = (*blocks)[i];
+    }
+    if (!checkpoint_compact())
+    {
+        exit(1);
+    }
+    return found;
+}
+
+bool checkpoint_enabled(void)
+{
+    return fd >= 0;
+}
+
+void checkpoint_block(uint64_t index, uint128_t seed, uint64_t count, const checkpoint_state_t *state)
+{
+    if (fd < 0)
+    {
+        return;
+    }
+    checkpoint_record_t r;
+    checkpoint_record(&r, index, seed, count, state);
+    pending.push_back(r);
+    if (count)
+    {
+        live[index] = {seed, count};
+    }
+    else
+    {
+        live.erase(index);
+    }
+    last_state = *state;
+}
+
+bool checkpoint_sync(void)
+{
+    if (fd < 0 || pending.empty())
+    {
+        return false;
+    }
+    // one write and one fsync for all the records of the batch
+    if (!checkpoint_write(fd, &pending[0], pending.size() * sizeof(checkpoint_record_t)) || fdatasync(fd) < 0)
+    {
+        printf("Checkpoint journal %s cannot be written\n", journal_name.c_str());
+        exit(1);
+    }
+    written += pending.size();
+    pending.clear();
+    if (written > CHECKPOINT_COMPACT && written > 4 * live.size())
+    {
+        checkpoint_compact();
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef CHECKPOINT_H_H
+#define CHECKPOINT_H_H
+
+// journal of the server state, to resume an exhaustive search after a crash
+//
+// Each record updates one block of the ring (dispatched, reduced, or done), and
+// carries the next seed of the lcg and the counters. The blocks not done when
+// the journal is reloaded are dispatched again first, nothing else is redone.
+//
+// Records are written and fsync-ed once per batch of events (group commit), the
+// replies of the batch are sent after the fsync. The journal is rewritten with
+// the blocks not done only, when it grows too large.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "tlv.h"
+
+typedef struct checkpoint_state_s
+{
+    uint128_t next_seed;
+    uint128_t done_count;
+    uint64_t pseudoprimes;
+    uint64_t pseudocomposites;
+    uint64_t b1;
+} checkpoint_state_t;
+
+typedef struct checkpoint_block_s
+{
+    uint128_t seed;
+    uint64_t count;
+} checkpoint_block_t;
+
+// resume : load the state and the blocks not done of a previous run, true when found,
+// otherwise the journal starts from state. The blocks take the indexes first_index,
+// first_index + 1 ... in the journal
+bool checkpoint_open(const char *name, bool resume, uint64_t first_index, checkpoint_state_t *state,
+                     std::vector<checkpoint_block_t> *blocks);
+bool checkpoint_enabled(void);
+// block index is (seed, count) and not done, or done when count is 0
+void checkpoint_block(uint64_t index, uint128_t seed, uint64_t count, const checkpoint_state_t *state);
+// write and fsync the records of the batch, true when records were written
+bool checkpoint_sync(void);
+
+#endif
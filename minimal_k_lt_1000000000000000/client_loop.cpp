@@ -24,53 +24,119 @@
 #include "setup.h"
 #include "tlv.h"
 
-static int client_outer_loop(int s)
+typedef struct client_work_s
 {
-    int r;
-    uint8_t t;
-    uint16_t cid = 0;
+    uint128_t seed;
     uint64_t count;
-    uint128_t v, seed;
+    bool batch;          // the server understands TLV_BATCH
+    bool progress;       // and TLV_PROGRESS
+    tlv_frame_t results; // results of the block, sent with TLV_READY
+} client_work_t;
 
-    r = tlv_write(s, cid, TLV_NEW, 0);
-    if (r < 0)
+// 1 : continue, 0 : stop, -1 : error
+static int client_message(tlv_conn_t *c, const tlv_frame_t *f, client_work_t *w)
+{
+    switch (f->type)
+    {
+    case TLV_STOP:
+        // a cancel for a block already abandoned, or done meanwhile
+        return tlv_frame_value(f) == TLV_STOP_CANCEL ? 1 : 0;
+    case TLV_SEED:
+        w->seed = tlv_frame_value(f);
+        break;
+    case TLV_COUNT:
+        w->count = tlv_frame_value(f);
+        break;
+    case TLV_GO:
+        if (!w->batch)
+        {
+            inner_loop(c, f->cid, w->seed, w->count, 0, false);
+            if (tlv_conn_write(c, f->cid, TLV_READY, 0) < 0)
+                return -1;
+            break;
+        }
+        tlv_batch_init(&w->results, f->cid);
+        if (inner_loop(c, f->cid, w->seed, w->count, &w->results, w->progress) < 0)
+        {
+            // done by another worker, its results too
+            tlv_batch_init(&w->results, f->cid);
+        }
+        if (tlv_batch_add(&w->results, f->cid, TLV_READY, 0) < 0 || tlv_conn_write_frame(c, &w->results) < 0)
+            return -1;
+        break;
+    default:
+        printf("Worker Error : Unknown tlv\n");
         return -1;
-    r = tlv_read(s, &cid, &t, &v);
-    if (r < 0)
+    }
+    return 1;
+}
+
+static int client_outer_loop(int s)
+{
+    int r = -1;
+    uint16_t cid = 0;
+    client_work_t work;
+    tlv_frame_t f, t;
+    uint32_t pos;
+
+    // buffered reads, a work unit comes in one TLV_BATCH
+    tlv_conn_t *c = tlv_conn_create(s, false);
+    if (!c)
         return -1;
-    if (t == TLV_STOP)
-        return 0;
+    tlv_frame_init(&f);
+    tlv_frame_init(&t);
+    tlv_frame_init(&work.results);
+    work.seed = 0;
+    work.count = 0;
+
+    if (tlv_conn_write(c, cid, TLV_NEW, TLV_VERSION_PROGRESS) < 0 || tlv_conn_read(c, &f) < 0)
+        goto done;
+    if (f.type == TLV_STOP)
+    {
+        r = 0;
+        goto done;
+    }
+    cid = f.cid;
+    work.batch = tlv_frame_value(&f) >= TLV_VERSION_BATCH;
+    work.progress = tlv_frame_value(&f) >= TLV_VERSION_PROGRESS;
     printf("Client new cid %d\n", (int)cid);
     fflush(stdout);
-    r = tlv_write(s, cid, TLV_READY, 0);
-    if (r < 0)
-        return -1;
-    while (1)
+    if (tlv_conn_write(c, cid, TLV_READY, 0) < 0)
+        goto done;
+    do
     {
-        r = tlv_read(s, &cid, &t, &v);
-        if (r < 0)
-            return -1;
-        switch (t)
+        if (tlv_conn_read(c, &f) < 0)
         {
-        case TLV_STOP:
-            return 0;
-        case TLV_SEED:
-            seed = v;
-            break;
-        case TLV_COUNT:
-            count = v;
+            r = -1;
             break;
-        case TLV_GO:
-            inner_loop(s, cid, seed, count);
-            r = tlv_write(s, cid, TLV_READY, 0);
-            if (r < 0)
-                return -1;
-            break;
-        default:
-            printf("Worker Error : Unknown tlv\n");
-            return -1;
         }
-    }
+        if (f.type != TLV_BATCH)
+        {
+            r = client_message(c, &f, &work);
+            continue;
+        }
+        r = 1;
+        pos = 0;
+        while (r > 0)
+        {
+            int n = tlv_batch_next(&f, &pos, &t);
+            if (n == 0)
+                break; // end of the batch
+            if (n < 0 || t.type == TLV_BATCH)
+            {
+                r = -1;
+                break;
+            }
+            r = client_message(c, &t, &work);
+        }
+    } while (r > 0);
+
+done:
+    tlv_frame_free(&f);
+    tlv_frame_free(&t);
+    tlv_frame_free(&work.results);
+    tlv_conn_destroy(c);
+    return r;
 }
 
 static char partner_addr[128] = "127.0.0.1";
@@ -10,9 +10,13 @@
 #include <unistd.h>
 #include <x86intrin.h>
 
+#include <vector>
+
 #include "inner_loop.h"
 #include "lcg.h"
+#include "psp_list.h"
 #include "tlv.h"
+#include "uint256.h"
 
 template <class T, class TT> static T square_mod(const T &u, const T &q)
 {
@@ -122,6 +126,107 @@ template <> uint64_t square_mod<uint64_t, uint128_t>(const uint64_t &u, const ui
 #endif
 }
 
+// T is uint128_t : Montgomery reduction, R = 2^128, n odd and n < 2^125 (3 guard bits)
+typedef struct mont128_s
+{
+    uint128_t n;
+    uint128_t ninv; // -n^-1 mod R
+    uint128_t r2;   // R^2 mod n
+    uint128_t p2[64]; // 2^e * R mod n, p2[0] is 1 in Montgomery form
+} mont128_t;
+
+// the constants of the last modulus, a test runs a lot of operations with the same n
+static const mont128_t *mont128(const uint128_t &n)
+{
+    static thread_local mont128_t m;
+    if (m.n != n)
+    {
+        assert(n & 1);
+        uint128_t x = n; // n * n == 1 mod 8, Newton doubles the correct bits
+        for (int i = 0; i < 6; i++)
+        {
+            x *= 2 - n * x;
+        }
+        uint128_t r = (0 - n) % n; // R mod n
+        for (int i = 0; i < 128; i++)
+        {
+            if (i < 64)
+                m.p2[i] = r;
+            r <<= 1;
+            r -= r >= n ? n : 0;
+        }
+        m.n = n;
+        m.ninv = 0 - x;
+        m.r2 = r;
+    }
+    return &m;
+}
+
+// u / R mod n, u < n * R
+static inline uint128_t redc128(const uint256_t &u, const mont128_t *m)
+{
+    uint256_t t = mul256(u.lo * m->ninv, m->n);
+    t += u; // the low half is 0
+    return t.hi >= m->n ? t.hi - m->n : t.hi;
+}
+
+// the exponentiations keep their operands in Montgomery form, u * R mod n : one conversion
+// in, one out, and a product in between is one mul256 and one redc128
+
+// u * R mod n, any u
+static inline uint128_t mont128_in(const uint128_t &u, const mont128_t *m)
+{
+    return redc128(mul256(u, m->r2), m);
+}
+
+// u mod n, u in Montgomery form
+static inline uint128_t mont128_out(const uint128_t &u, const mont128_t *m)
+{
+    return redc128(uint256_t(u), m);
+}
+
+// u * v / R mod n, u * v < n * R (u, v < 2n)
+static inline uint128_t mont128_mul(const uint128_t &u, const uint128_t &v, const mont128_t *m)
+{
+    return redc128(mul256(u, v), m);
+}
+
+static inline uint128_t mont128_add(const uint128_t &u, const uint128_t &v, const mont128_t *m)
+{
+    uint128_t r = u + v; // n < 2^125, no carry
+    return r >= m->n ? r - m->n : r;
+}
+
+static inline uint128_t mont128_neg(const uint128_t &u, const mont128_t *m)
+{
+    return u ? m->n - u : 0;
+}
+
+// (u) mod n, u < n * R
+template <> uint128_t longlong_mod(const uint256_t &u, const uint128_t &n)
+{
+    const mont128_t *m = mont128(n);
+    return redc128(mul256(redc128(u, m), m->r2), m);
+}
+
+// (u * v) mod n
+template <> uint128_t mul_mod<uint128_t, uint256_t>(const uint128_t &u, const uint128_t &v, const uint128_t &n)
+{
+    return longlong_mod<uint128_t, uint256_t>(mul256(u, v), n);
+}
+
+// (u * u) mod n
+template <> uint128_t square_mod<uint128_t, uint256_t>(const uint128_t &u, const uint128_t &n)
+{
+    return longlong_mod<uint128_t, uint256_t>(mul256(u, u), n);
+}
+
+// (u << v) mod n, v < 64
+template <> uint128_t shift_mod<uint128_t, uint256_t>(const uint128_t &u, const uint128_t &v, const uint128_t &n)
+{
+    return longlong_mod<uint128_t, uint256_t>(uint256_t(u) << (unsigned)v, n);
+}
+
 // count trailing zeroed bits
 static inline uint64_t tzcnt(uint64_t a)
 {
@@ -134,6 +239,17 @@ static inline uint64_t tzcnt(uint64_t a)
 #endif
 }
 
+static inline uint64_t tzcnt(uint128_t a)
+{
+    uint64_t lo = (uint64_t)a;
+    return lo ? tzcnt(lo) : 64 + tzcnt((uint64_t)(a >> 64));
+}
+
+template <class T> static inline uint64_t tzcnt(const T &a)
+{
+    return tzcnt((uint64_t)a);
+}
+
 // count leading zeroed bits
 static inline uint64_t lzcnt(uint64_t a)
 {
@@ -220,6 +336,11 @@ template <class T, class TT> static T mod(const TT &u, const T &q)
     return (T)r;
 }
 
+template <> uint128_t add_mod<uint128_t, uint256_t>(const uint128_t &u, const uint128_t &v, const uint128_t &q)
+{
+    return longlong_mod<uint128_t, uint256_t>(uint256_t(u) + uint256_t(v), q);
+}
+
 template <class T> static T mod(const T &u, const T &q)
 {
     return u % q;
@@ -773,6 +894,75 @@ template <class T, class TT> static bool witness(const T &n, int s, const T &d,
     return true;
 }
 
+// T is uint128_t : a^d in Montgomery form, 2^d by the shifts of p2[]
+static uint128_t mont128_pow(const uint128_t &a, const uint128_t &d, const mont128_t *m)
+{
+    uint128_t result;
+    if (a == 2)
+    {
+        unsigned n = log_2(d);
+        n = (n > 5) ? n - 5 : 0;
+        result = m->p2[(unsigned)(d >> n)];
+        while (n >= 6)
+        {
+            n -= 6;
+            for (int i = 0; i < 6; i++)
+            {
+                result = mont128_mul(result, result, m);
+            }
+            unsigned e = (unsigned)(d >> n) & 0x3f;
+            if (e)
+            {
+                result = mont128_mul(result, m->p2[e], m);
+            }
+        }
+        while (n--)
+        {
+            result = mont128_mul(result, result, m);
+            if ((d >> n) & 1)
+            {
+                result = mont128_add(result, result, m);
+            }
+        }
+        return result;
+    }
+
+    uint128_t n = d;
+    uint128_t s = mont128_in(a, m);
+    result = m->p2[0];
+    while (n)
+    {
+        if (n & 1)
+            result = mont128_mul(result, s, m);
+        s = mont128_mul(s, s, m);
+        n >>= 1;
+    }
+    return result;
+}
+
+// T is uint128_t : MR strong test, x compared with 1 and -1 in Montgomery form
+template <> bool witness<uint128_t, uint256_t>(const uint128_t &n, int s, const uint128_t &d, const uint128_t &a)
+{
+    uint128_t x, y;
+    if (n == a)
+        return true;
+    const mont128_t *m = mont128(n);
+    const uint128_t one = m->p2[0];
+    const uint128_t minus_one = n - one;
+    x = mont128_pow(a, d, m);
+    while (s)
+    {
+        y = mont128_mul(x, x, m);
+        if (y == one && x != one && x != minus_one)
+            return false;
+        x = y;
+        --s;
+    }
+    if (y != one)
+        return false;
+    return true;
+}
+
 // sieve small factors <= 151
 template <class T> static bool sieve(const T &n)
 {
@@ -873,6 +1063,34 @@ template <class T> static bool sieve(const T &n)
     return true;      // might be prime
 }
 
+// n >= 2^64 : the same small factors, from the residues modulo products of the primes
+template <> bool sieve<uint128_t>(const uint128_t &n)
+{
+    static const uint64_t products[] = {0xe221f97c30e94e1dull, 0x6329899ea9f2714bull, 0x58edcb4c9ed39c8bull, 151};
+    static const uint8_t primes[] = {3,   5,   7,   11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,
+                                     53,  0,   59,  61,  67,  71,  73,  79,  83,  89,  97,  101, 0,   103,
+                                     107, 109, 113, 127, 131, 137, 139, 149, 0,   151, 0};
+    if (!(n >> 64))
+        return sieve<uint64_t>((uint64_t)n);
+    if (!(n & 1))
+        return false; // even
+    unsigned j = 0;
+    for (unsigned i = 0; i < sizeof(products) / sizeof(products[0]); i++, j++)
+    {
+        uint64_t r = (uint64_t)(n % products[i]);
+        for (; primes[j]; j++)
+        {
+            if (r % primes[j] == 0)
+                return false; // divisible by primes[j]
+        }
+    }
+    return true; // might be prime
+}
+
+// bases 2 ... 37 are enough below PSI_12, 2 ... 41 below PSI_13
+#define PSI_12 (((uint128_t)0x437aull << 64) | 0xe92817f9fc85b7e5ull) // 318665857834031151167461
+#define PSI_13 (((uint128_t)0x2be69ull << 64) | 0x51adc5b22410a5fdull) // 3317044064679887385961981
+
 template <class T, class TT> static bool isprime(const T &n)
 {
     if (!sieve<T>(n))
@@ -910,11 +1128,17 @@ template <class T, class TT> static bool isprime(const T &n)
         return witness<T, TT>(n, s, d, 2) && witness<T, TT>(n, s, d, 3) && witness<T, TT>(n, s, d, 5) &&
                witness<T, TT>(n, s, d, 7) && witness<T, TT>(n, s, d, 11) && witness<T, TT>(n, s, d, 13) &&
                witness<T, TT>(n, s, d, 17) && witness<T, TT>(n, s, d, 19) && witness<T, TT>(n, s, d, 23);
-    // n < 318665857834031151167461
-    return witness<T, TT>(n, s, d, 2) && witness<T, TT>(n, s, d, 3) && witness<T, TT>(n, s, d, 5) &&
-           witness<T, TT>(n, s, d, 7) && witness<T, TT>(n, s, d, 11) && witness<T, TT>(n, s, d, 13) &&
-           witness<T, TT>(n, s, d, 17) && witness<T, TT>(n, s, d, 19) && witness<T, TT>(n, s, d, 23) &&
-           witness<T, TT>(n, s, d, 29) && witness<T, TT>(n, s, d, 31) && witness<T, TT>(n, s, d, 37);
+
+    // larger n (T is uint128_t) : probable prime with the bases up to 71, an error would
+    // show up as a pseudoprime or a pseudocomposite, checked again before it is trusted
+    static const unsigned bases[] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53, 59, 61, 67, 71};
+    unsigned count = (uint128_t)n < PSI_12 ? 12 : (uint128_t)n < PSI_13 ? 13 : sizeof(bases) / sizeof(bases[0]);
+    for (unsigned i = 0; i < count; i++)
+    {
+        if (!witness<T, TT>(n, s, d, bases[i]))
+            return false;
+    }
+    return true;
 }
 
 //  Mod(Mod(x+t,n),x^2-(sgn*a))^e
@@ -1080,6 +1304,64 @@ template <class T, class TT> static inline __attribute__((always_inline)) void e
     }
 }
 
+// T is uint128_t : the same in Montgomery form, x^2 == c, s, t, t0 and c are converted once
+template <>
+inline __attribute__((always_inline)) void exponentiate2<uint128_t, uint256_t>(uint128_t &s, uint128_t &t, uint128_t e,
+                                                                              uint128_t n, int sgn, uint128_t a)
+{
+    const mont128_t *m = mont128(n);
+    uint128_t t0 = mont128_in(t, m);
+    uint128_t c = mont128_in(a, m);
+    c = sgn > 0 ? c : mont128_neg(c, m);
+    bool c_one = sgn < 0 && a == 1;
+    bool c_two = sgn < 0 && a == 2;
+    uint128_t t2, s2, ss, tt;
+    s = mont128_in(s, m);
+    t = t0;
+    unsigned bit = log_2<uint128_t>(e);
+    while (bit--)
+    {
+        // (s*x + t)^2 == 2*s*t*x + t^2 + c*s^2
+        if (c_one)
+        {
+            // t^2 - s^2 = (t+s) * (t+n-s), the operands are < 2n
+            tt = mont128_mul(t + s, t + n - s, m);
+        }
+        else
+        {
+            t2 = mont128_mul(t, t, m);
+            s2 = mont128_mul(s, s, m);
+            if (c_two)
+                tt = mont128_neg(mont128_add(s2, s2, m), m);
+            else
+                tt = mont128_mul(s2, c, m);
+            tt = mont128_add(tt, t2, m);
+        }
+        ss = mont128_mul(s, t, m);
+        ss = mont128_add(ss, ss, m);
+
+        if (e & ((uint128_t)1 << bit))
+        {
+            // (s*x + t)*(x+t0) == (t0*s+t)*x + t*t0+c*s
+            if (c_one)
+                t = mont128_neg(ss, m);
+            else if (c_two)
+                t = mont128_neg(mont128_add(ss, ss, m), m);
+            else
+                t = mont128_mul(ss, c, m);
+            s = mont128_add(mont128_mul(ss, t0, m), tt, m);
+            t = mont128_add(mont128_mul(tt, t0, m), t, m);
+        }
+        else
+        {
+            s = ss;
+            t = tt;
+        }
+    }
+    s = mont128_out(s, m);
+    t = mont128_out(t, m);
+}
+
 //  Mod(Mod(x,n),x^2-2*x-1)^e
 //
 //  if T is uint64_t, assume t,a,n,e are 63 bit numbers   (require 1 guard bit)
@@ -1111,6 +1393,36 @@ If n==5 mod 8 test Mod(Mod(x+2,n),x^2+2)^(n+1)==6.
 If n==1 mod 8 test Mod(Mod(x+2,n),x^2-a)^(n+1)==4-a and Mod(Mod(x+2,n),x^2+a)^(n+1)==4+a for kronecker(a,n)==-1
 */
 
+// n == 1 mod 8 : minimal a where Kronecker(a, n) == -1, false when n is composite for sure
+template <class T, class TT> static bool lnrc2_minimal_a(const T &n, T *pa)
+{
+    if (is_perfect_square<T, TT>(n))
+        return false; // n composite perfect square, for any x, kronecker(x, n)==1 always
+
+    // search minimal a where Kronecker(a, n) == -1
+    T a = 3;
+    int j = jacobi<T>(a, n);
+    if (j == 0)
+        return false; // composite for sure
+    if (j == 1)
+    {
+        T da = 2;
+        for (a = 5;; a += da, da = 6 - da)
+        {
+            if (!isprime<T, TT>(a))
+                continue;
+
+            j = jacobi<T>(a, n);
+            if (j == 0)
+                return false; // composite for sure
+            if (j == -1)
+                break;
+        }
+    }
+    *pa = a;
+    return true;
+}
+
 template <class T, class TT> static bool islnrc2prime(const T &n, int s = 0, int cid = 0)
 {
     if (n < 23)
@@ -1137,30 +1449,10 @@ template <class T, class TT> static bool islnrc2prime(const T &n, int s = 0, int
         return (bs == 0 && bt == 6); // ?? n prime ? n composite for sure ?
     }
 
-    if (is_perfect_square<T, TT>(n))
-        return false; // n composite perfect square, for any x, kronecker(x, n)==1 always
-
-    // search minimal a where Kronecker(a, n) == -1
-    T a = 3;
-    T da = 2;
-    int j = jacobi<T>(a, n);
-    if (j == 0)
+    T a;
+    if (!lnrc2_minimal_a<T, TT>(n, &a))
         return false; // composite for sure
-    if (j == 1)
-    {
-        T da = 2;
-        for (a = 5;; a += da, da = 6 - da)
-        {
-            if (!isprime<T, TT>(a))
-                continue;
 
-            j = jacobi<T>(a, n);
-            if (j == 0)
-                return false; // composite for sure
-            if (j == -1)
-                break;
-        }
-    }
     // (x+2)^(n+1) mod (n, x^2+a) == 4+a
     T bs = 1;
     T bt = 2;
@@ -1177,9 +1469,405 @@ template <class T, class TT> static bool islnrc2prime(const T &n, int s = 0, int
     return true;      // ?? n prime ?
 }
 
-int inner_loop(int s, uint16_t cid, uint128_t seed, uint64_t count)
+// -----------------------------------------------------------------------
+// islnrc2prime for LNRC2_LANES numbers of the same class at once
+//
+// The numbers of a block are consecutive, they are grouped by the modulus of
+// the test (x^2+1 for 3 mod 4, x^2+2 for 5 mod 8, x^2+a and x^2-a for 1 mod 8
+// with the same a). The lanes run in lockstep with Montgomery arithmetic, no
+// divq in the loop, and the independent multiplications of the lanes overlap.
+// -----------------------------------------------------------------------
+
+#define LNRC2_LANES 8
+
+typedef struct lnrc2_lanes_s
+{
+    unsigned count;
+    uint64_t n[LNRC2_LANES];
+    bool r[LNRC2_LANES]; // ground truth, carried along for the results
+} lnrc2_lanes_t;
+
+// -n^-1 mod 2^64
+static inline uint64_t mont_ninv(uint64_t n)
+{
+    uint64_t inv = n; // 3 bits
+    for (int i = 0; i < 5; i++)
+    {
+        inv *= 2 - n * inv;
+    }
+    return -inv;
+}
+
+// a * b / 2^64 mod n, n < 2^63
+static inline uint64_t mont_mul(uint64_t a, uint64_t b, uint64_t n, uint64_t ninv)
+{
+    uint128_t t = (uint128_t)a * b;
+    uint64_t m = (uint64_t)t * ninv;
+    uint64_t r = (uint64_t)((t + (uint128_t)m * n) >> 64);
+    return r >= n ? r - n : r;
+}
+
+static inline uint64_t mont_add(uint64_t a, uint64_t b, uint64_t n)
+{
+    uint64_t r = a + b;
+    return r >= n ? r - n : r;
+}
+
+static inline uint64_t mont_neg(uint64_t a, uint64_t n)
+{
+    return a ? n - a : 0;
+}
+
+// c * v, c is the constant term of x^2 == c, in Montgomery form cm when C is 0
+template <int C> static inline uint64_t mont_c(uint64_t v, uint64_t cm, uint64_t n, uint64_t ninv)
+{
+    if (C == -1)
+        return mont_neg(v, n);
+    if (C == -2)
+        return mont_neg(mont_add(v, v, n), n);
+    return mont_mul(v, cm, n, ninv);
+}
+
+// (x+2)^(n+1) mod (n, x^2 - c) == 0*x + expect for each lane, c is C, or c_sgn * a
+template <int C> static void lnrc2_lanes(const lnrc2_lanes_t *l, int c_sgn, uint64_t a, int64_t expect, bool *ok)
+{
+    uint64_t n[LNRC2_LANES], ninv[LNRC2_LANES], e[LNRC2_LANES], cm[LNRC2_LANES], one[LNRC2_LANES];
+    uint64_t s[LNRC2_LANES], t[LNRC2_LANES];
+    unsigned top = 0;
+    for (unsigned i = 0; i < LNRC2_LANES; i++)
+    {
+        // the missing lanes repeat the first one
+        n[i] = l->n[i < l->count ? i : 0];
+        e[i] = n[i] + 1;
+        ninv[i] = mont_ninv(n[i]);
+        one[i] = (0 - n[i]) % n[i]; // 2^64 mod n
+        cm[i] = C ? 0 : mul_mod<uint64_t, uint128_t>(c_sgn > 0 ? a : n[i] - a, one[i], n[i]);
+        s[i] = 0;
+        t[i] = one[i];
+        unsigned b = log_2<uint64_t>(e[i]);
+        top = b > top ? b : top;
+    }
+    // from 1, the lanes with a shorter exponent square 1 until their top bit
+    unsigned bit = top + 1;
+    while (bit--)
+    {
+        for (unsigned i = 0; i < LNRC2_LANES; i++)
+        {
+            // (s*x + t)^2 == 2*s*t*x + t^2 + c*s^2
+            uint64_t q = n[i], qi = ninv[i];
+            uint64_t st = mont_mul(s[i], t[i], q, qi);
+            uint64_t t2 = mont_mul(t[i], t[i], q, qi);
+            uint64_t s2 = mont_mul(s[i], s[i], q, qi);
+            uint64_t ns = mont_add(st, st, q);
+            uint64_t nt = mont_add(t2, mont_c<C>(s2, cm[i], q, qi), q);
+            // (s*x + t)*(x + 2) == (2*s + t)*x + 2*t + c*s
+            uint64_t ms = mont_add(mont_add(ns, ns, q), nt, q);
+            uint64_t mt = mont_add(mont_add(nt, nt, q), mont_c<C>(ns, cm[i], q, qi), q);
+            bool m = (e[i] >> bit) & 1;
+            s[i] = m ? ms : ns;
+            t[i] = m ? mt : nt;
+        }
+    }
+    for (unsigned i = 0; i < l->count; i++)
+    {
+        uint64_t x = expect >= 0 ? (uint64_t)expect % n[i] : n[i] - (uint64_t)-expect % n[i];
+        ok[i] = s[i] == 0 && t[i] == mul_mod<uint64_t, uint128_t>(x, one[i], n[i]);
+    }
+}
+
+#define INNER_RESULTS_FLUSH 4096 // bytes of results sent before the end of the block
+#define INNER_PROGRESS_TIME (15000000000ull) // ticks between two TLV_PROGRESS, approx 5 seconds
+
+typedef struct inner_tlv_s
+{
+    tlv_conn_t *c;
+    tlv_frame_t *results;
+    bool progress;       // the server keeps the part of a block done before a crash
+    uint64_t t_progress; // last TLV_PROGRESS
+} inner_tlv_t;
+
+// a pseudoprime or a pseudocomposite, the hot loop does not wait for the socket
+static int inner_result(void *arg, uint16_t cid, uint8_t type, uint128_t v)
+{
+    inner_tlv_t *t = (inner_tlv_t *)arg;
+    if (type == TLV_PROGRESS)
+    {
+        // a TLV_STOP received meanwhile : the block is done elsewhere, or the server is lost
+        if (t->c && tlv_conn_poll(t->c, TLV_STOP) != 0)
+        {
+            return -1;
+        }
+        uint64_t now = __rdtsc();
+        if (t->c && t->results && t->progress && now - t->t_progress >= INNER_PROGRESS_TIME)
+        {
+            // after the results of the seeds done, in the same frame
+            t->t_progress = now;
+            tlv_batch_add(t->results, cid, TLV_PROGRESS, v);
+            tlv_conn_write_frame(t->c, t->results);
+            tlv_batch_init(t->results, cid);
+        }
+        return 0;
+    }
+    if (!t->results)
+    {
+        if (t->c)
+        {
+            tlv_conn_write(t->c, cid, type, v);
+        }
+        return 0;
+    }
+    tlv_batch_add(t->results, cid, type, v);
+    if (t->c && t->results->len >= INNER_RESULTS_FLUSH)
+    {
+        tlv_conn_write_frame(t->c, t->results);
+        tlv_batch_init(t->results, cid);
+    }
+    return 0;
+}
+
+int inner_loop(tlv_conn_t *c, uint16_t cid, uint128_t seed, uint64_t count, tlv_frame_t *results, bool progress)
+{
+    inner_tlv_t t;
+    t.c = c;
+    t.results = results;
+    t.progress = progress;
+    t.t_progress = __rdtsc();
+    if (psp_list_enabled())
+    {
+        return psp_list_range(cid, (uint64_t)seed, count, inner_result, &t);
+    }
+    return inner_range(cid, seed, count, inner_result, &t);
+}
+
+// ground truth of a block, the seeds of a block are consecutive odd numbers
+#define SIEVE_SEGMENT INNER_PROGRESS_SEEDS // odd numbers sieved at once, one division per base prime
+#define SIEVE_SEGMENT_128 (1u << 18) // beyond 2^61, as many seconds between the progress reports
+#define SIEVE_MAX_BASE (1u << 25)  // larger survivors get Miller-Rabin
+#define SIEVE_SMALL (157ull * 157) // below, isprime() is a table lookup
+#define INNER_MAX_BITS 125         // 3 guard bits of uint128_t, beyond 61 bits the tests run in uint128_t
+
+static bool cross_check = false;
+static pthread_mutex_t sieve_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector<uint32_t> *sieve_levels[32]; // odd primes up to 2^k, never freed
+
+void inner_setup(bool miller_rabin_check)
+{
+    cross_check = miller_rabin_check;
+}
+
+// the odd primes up to 2^k, 2^k >= limit, computed once for all the threads
+static const std::vector<uint32_t> *sieve_base(uint64_t limit, uint64_t *bound)
+{
+    unsigned k = 8;
+    while ((1ull << k) < limit)
+    {
+        k++;
+    }
+    pthread_mutex_lock(&sieve_lock);
+    if (!sieve_levels[k])
+    {
+        uint32_t n = 1u << k;
+        std::vector<uint8_t> composite(n / 2 + 1, 0);
+        std::vector<uint32_t> *primes = new std::vector<uint32_t>();
+        for (uint32_t p = 3; p <= n; p += 2)
+        {
+            if (composite[p / 2])
+                continue;
+            primes->push_back(p);
+            for (uint64_t m = (uint64_t)p * p; m <= n; m += 2 * p)
+            {
+                composite[m / 2] = 1;
+            }
+        }
+        sieve_levels[k] = primes;
+    }
+    pthread_mutex_unlock(&sieve_lock);
+    *bound = 1ull << k;
+    return sieve_levels[k];
+}
+
+// composite[i] for lo + 2 * i, i < n, lo odd, with the primes up to *bound
+template <class U> static void sieve_segment(std::vector<uint8_t> &composite, U lo, uint32_t n, uint64_t *bound)
+{
+    U hi = lo + 2 * (U)(n - 1);
+    uint64_t limit = (uint64_t)sqrtl((long double)hi) + 1;
+    // about as many base primes as numbers, a short segment gets Miller-Rabin for more survivors
+    uint64_t max_base = 16 * (uint64_t)n < SIEVE_MAX_BASE ? 16 * (uint64_t)n : SIEVE_MAX_BASE;
+    const std::vector<uint32_t> *base = sieve_base(limit < max_base ? limit : max_base, bound);
+    composite.assign(n, 0);
+    for (size_t j = 0; j < base->size(); j++)
+    {
+        uint64_t p = (*base)[j];
+        if ((U)p * p > hi)
+            break;
+        U m = lo + (p - (uint64_t)(lo % p)) % p;
+        if (m < (U)p * p)
+            m = (U)p * p;
+        if (!(m & 1))
+            m += p;
+        for (uint64_t i = (uint64_t)((m - lo) / 2); i < n; i += p)
+        {
+            composite[i] = 1;
+        }
+    }
+}
+
+// ground truth of v from the sieve
+template <class U, class UU> static bool inner_truth(const U &v, bool composite, uint64_t bound)
+{
+    bool r;
+    if (v < SIEVE_SMALL)
+        r = isprime<U, UU>(v);
+    else if (composite)
+        r = false;
+    else if (v < (uint128_t)bound * bound)
+        r = true;
+    else
+        r = isprime<U, UU>(v); // a survivor beyond the base primes
+    if (cross_check && r != isprime<U, UU>(v))
+    {
+        print128("Sieve and Miller-Rabin disagree on", v);
+        fflush(stdout);
+        exit(1);
+    }
+    return r;
+}
+
+static void inner_verdict(uint16_t cid, uint128_t v, bool r, bool rl, inner_result_t result, void *arg)
+{
+    if (r)
+    {
+        if (!rl)
+        {
+            // printf("pseudocomposite %lx\n", (uint64_t)v);
+            result(arg, cid, TLV_PSEUDOCOMPOSITE, v);
+        }
+        else
+        {
+            // printf("prime %lx\n", (uint64_t)v);
+        }
+    }
+    else
+    {
+        if (rl)
+        {
+            // printf("pseudoprime %lx\n", (uint64_t)v);
+            result(arg, cid, TLV_PSEUDOPRIME, v);
+        }
+        else
+        {
+            // printf("composite %lx\n", (uint64_t)v);
+        }
+    }
+}
+
+static void inner_number(uint16_t cid, uint128_t v, bool r, inner_result_t result, void *arg)
+{
+    inner_verdict(cid, v, r, islnrc2prime<uint64_t, uint128_t>(v), result, arg);
+}
+
+#define LNRC2_MAX_A 256 // larger a, rare, are tested one by one
+
+// numbers waiting for a full set of lanes
+typedef struct lnrc2_bins_s
+{
+    lnrc2_lanes_t mod4_3;
+    lnrc2_lanes_t mod8_5;
+    lnrc2_lanes_t mod8_1[LNRC2_MAX_A];
+} lnrc2_bins_t;
+
+static void lnrc2_run(lnrc2_lanes_t *l, uint64_t a, uint16_t cid, inner_result_t result, void *arg)
+{
+    bool ok[LNRC2_LANES], ok2[LNRC2_LANES];
+    if ((l->n[0] & 3) == 3)
+    {
+        lnrc2_lanes<-1>(l, 0, 0, 5, ok);
+    }
+    else if ((l->n[0] & 7) == 5)
+    {
+        lnrc2_lanes<-2>(l, 0, 0, 6, ok);
+    }
+    else
+    {
+        lnrc2_lanes<0>(l, -1, a, 4 + (int64_t)a, ok);
+        lnrc2_lanes<0>(l, 1, a, 4 - (int64_t)a, ok2);
+        for (unsigned i = 0; i < l->count; i++)
+        {
+            ok[i] = ok[i] && ok2[i];
+        }
+    }
+    for (unsigned i = 0; i < l->count; i++)
+    {
+        inner_verdict(cid, l->n[i], l->r[i], ok[i], result, arg);
+    }
+    l->count = 0;
+}
+
+// v is tested when its lanes are full, or by lnrc2_flush()
+static void lnrc2_add(lnrc2_bins_t *b, uint64_t v, bool r, uint16_t cid, inner_result_t result, void *arg)
 {
-    bool r, rl;
+    lnrc2_lanes_t *l;
+    uint64_t a = 0;
+    if (v < 23)
+    {
+        inner_number(cid, v, r, result, arg);
+        return;
+    }
+    if ((v & 3) == 3)
+    {
+        l = &b->mod4_3;
+    }
+    else if ((v & 7) == 5)
+    {
+        l = &b->mod8_5;
+    }
+    else
+    {
+        if (!lnrc2_minimal_a<uint64_t, uint128_t>(v, &a))
+        {
+            inner_verdict(cid, v, r, false, result, arg); // composite for sure
+            return;
+        }
+        if (a >= LNRC2_MAX_A)
+        {
+            inner_number(cid, v, r, result, arg);
+            return;
+        }
+        l = &b->mod8_1[a];
+    }
+    l->n[l->count] = v;
+    l->r[l->count] = r;
+    if (++l->count == LNRC2_LANES)
+    {
+        lnrc2_run(l, a, cid, result, arg);
+    }
+}
+
+static void lnrc2_flush(lnrc2_bins_t *b, uint16_t cid, inner_result_t result, void *arg)
+{
+    if (b->mod4_3.count)
+        lnrc2_run(&b->mod4_3, 0, cid, result, arg);
+    if (b->mod8_5.count)
+        lnrc2_run(&b->mod8_5, 0, cid, result, arg);
+    for (unsigned a = 0; a < LNRC2_MAX_A; a++)
+    {
+        if (b->mod8_1[a].count)
+            lnrc2_run(&b->mod8_1[a], a, cid, result, arg);
+    }
+}
+
+static int inner_cancelled(uint16_t cid, uint128_t v)
+{
+    char buff[60];
+    sprintf(buff, "Client %4u Cancelled ..", (unsigned)cid);
+    print128(buff, v);
+    fflush(stdout);
+    return -1;
+}
+
+int inner_range(uint16_t cid, uint128_t seed, uint64_t count, inner_result_t result, void *arg)
+{
+    bool r;
     uint128_t v = 0;
     char buff[60];
     fflush(stdout);
@@ -1189,47 +1877,75 @@ int inner_loop(int s, uint16_t cid, uint128_t seed, uint64_t count)
     sprintf(buff, "Client %4u Started ....", (unsigned)cid);
     print128(buff, v);
     fflush(stdout);
-    while (count--)
+    if (!u.sequential())
     {
-        v = u.get_seed(1);
-        v = convert_seed_to_number(v);
-        if (v >> 61)
-        {
-            assert(0);
-        }
-        else
-        {
-            r = isprime<uint64_t, uint128_t>(v);
-            rl = islnrc2prime<uint64_t, uint128_t>(v, s, cid);
-        }
-        if (r)
+        // scattered numbers, Miller-Rabin only
+        while (count--)
         {
-            if (!rl)
+            v = u.get_seed(1);
+            v = convert_seed_to_number(v);
+            if (v >> INNER_MAX_BITS)
             {
-                // printf("pseudocomposite %lx\n", (uint64_t)v);
-                if (s)
-                {
-                    tlv_write(s, cid, TLV_PSEUDOCOMPOSITE, v);
-                }
+                assert(0);
+            }
+            if (v >> 61)
+            {
+                r = isprime<uint128_t, uint256_t>(v);
+                inner_verdict(cid, v, r, islnrc2prime<uint128_t, uint256_t>(v), result, arg);
             }
             else
             {
-                // printf("prime %lx\n", (uint64_t)v);
+                r = isprime<uint64_t, uint128_t>(v);
+                inner_number(cid, v, r, result, arg);
+            }
+            if (!(count & 0xffff) && result(arg, cid, TLV_PROGRESS, u.get_seed(0)) < 0)
+            {
+                return inner_cancelled(cid, v);
             }
         }
-        else
+    }
+    else
+    {
+        static thread_local std::vector<uint8_t> composite;
+        static thread_local lnrc2_bins_t bins; // all counts 0 between the blocks
+        while (count)
         {
-            if (rl)
+            uint32_t n = count < SIEVE_SEGMENT ? (uint32_t)count : SIEVE_SEGMENT;
+            uint128_t lo = convert_seed_to_number(u.get_seed(0) + 1);
+            uint128_t hi = convert_seed_to_number(u.get_seed(0) + n);
+            uint64_t bound;
+            if (hi >> INNER_MAX_BITS)
+            {
+                assert(0);
+            }
+            if (hi >> 61)
             {
-                // printf("pseudoprime %lx\n", (uint64_t)v);
-                if (s)
+                // beyond the guard bits of uint64_t, one number at a time in uint128_t
+                n = n < SIEVE_SEGMENT_128 ? n : SIEVE_SEGMENT_128;
+                sieve_segment<uint128_t>(composite, lo, n, &bound);
+                for (uint32_t i = 0; i < n; i++)
                 {
-                    tlv_write(s, cid, TLV_PSEUDOPRIME, v);
+                    v = lo + 2 * (uint64_t)i;
+                    r = inner_truth<uint128_t, uint256_t>(v, composite[i], bound);
+                    inner_verdict(cid, v, r, islnrc2prime<uint128_t, uint256_t>(v), result, arg);
                 }
             }
             else
             {
-                // printf("composite %lx\n", (uint64_t)v);
+                sieve_segment<uint64_t>(composite, (uint64_t)lo, n, &bound);
+                for (uint32_t i = 0; i < n; i++)
+                {
+                    v = lo + 2 * (uint64_t)i;
+                    r = inner_truth<uint64_t, uint128_t>((uint64_t)v, composite[i], bound);
+                    lnrc2_add(&bins, (uint64_t)v, r, cid, result, arg);
+                }
+                lnrc2_flush(&bins, cid, result, arg); // all the results of the segment before its progress
+            }
+            u.get_seed(n);
+            count -= n;
+            if (result(arg, cid, TLV_PROGRESS, u.get_seed(0)) < 0)
+            {
+                return inner_cancelled(cid, v);
             }
         }
     }
@@ -1240,6 +1956,62 @@ int inner_loop(int s, uint16_t cid, uint128_t seed, uint64_t count)
     return 0;
 }
 
+int inner_values(uint16_t cid, const uint128_t *values, size_t n, inner_result_t result, void *arg)
+{
+    static thread_local lnrc2_bins_t bins; // all counts 0 between the calls
+    for (size_t i = 0; i < n; i++)
+    {
+        uint128_t v = values[i];
+        if (v >> INNER_MAX_BITS)
+        {
+            assert(0);
+        }
+        if (v >> 61)
+        {
+            inner_verdict(cid, v, isprime<uint128_t, uint256_t>(v), islnrc2prime<uint128_t, uint256_t>(v), result,
+                          arg);
+        }
+        else
+        {
+            lnrc2_add(&bins, (uint64_t)v, isprime<uint64_t, uint128_t>(v), cid, result, arg);
+        }
+    }
+    lnrc2_flush(&bins, cid, result, arg);
+    return 0;
+}
+
+static int self_test_result(void *arg, uint16_t cid, uint8_t type, uint128_t v)
+{
+    (void)arg;
+    (void)cid;
+    (void)type;
+    (void)v;
+    return 0;
+}
+
+static int lanes_test_result(void *arg, uint16_t cid, uint8_t type, uint128_t v)
+{
+    (void)cid;
+    (void)type;
+    (void)v;
+    (*(uint64_t *)arg)++;
+    return 0;
+}
+
+// the lanes get the opposite of islnrc2prime() as ground truth, each number must be reported
+static bool lanes_self_test(uint64_t lo, unsigned count)
+{
+    static lnrc2_bins_t bins;
+    uint64_t reported = 0;
+    for (unsigned i = 0; i < count; i++)
+    {
+        uint64_t v = lo + 2 * (uint64_t)i;
+        lnrc2_add(&bins, v, !islnrc2prime<uint64_t, uint128_t>(v), 2222, lanes_test_result, &reported);
+    }
+    lnrc2_flush(&bins, 2222, lanes_test_result, &reported);
+    return reported == count;
+}
+
 static int inner_self_test_64(void)
 {
     uint64_t s, r, t;
@@ -1716,18 +2488,148 @@ static int inner_self_test_64(void)
 
 #define COUNT 12000
 #define A_60_BITS 0x43210fedcba9876ull
+#define A_50_BITS 0x3210fedcba987ull
+
+    printf("Lanes and islnrc2prime ...\n");
+    if (!lanes_self_test(1, COUNT) || !lanes_self_test(A_50_BITS * 2 + 1, COUNT) ||
+        !lanes_self_test(A_60_BITS * 2 + 1, COUNT) || !lanes_self_test(((uint64_t)1 << 61) - 2 * COUNT - 1, COUNT))
+    {
+        printf("islnrc2 lanes failed\n");
+        return -1;
+    }
+
+    printf("Sieve and Miller-Rabin ...\n");
+    inner_setup(true);
+    inner_range(2222, 0, COUNT, self_test_result, 0);
+    inner_range(2222, A_50_BITS, COUNT, self_test_result, 0);
+    inner_range(2222, A_60_BITS, COUNT, self_test_result, 0);
+    inner_setup(false);
+
     volatile uint64_t t0, t1;
     t0 = __rdtsc();
-    inner_loop(0, 2222, A_60_BITS, COUNT);
+    tlv_frame_t results;
+    tlv_frame_init(&results);
+    tlv_batch_init(&results, 2222);
+    inner_loop(0, 2222, A_60_BITS, COUNT, &results, false);
     t1 = __rdtsc();
     double d = (double)(t1 - t0);
     d /= COUNT;
+    tlv_frame_free(&results);
     printf("Average: %8.1f ticks/iteration\n", d);
     printf("Self-test completed\n");
     // pass
     return 0;
 }
 
+// (u * v) mod n by shifts and subtractions, n < 2^126
+static uint128_t mul_mod_slow(uint128_t u, uint128_t v, uint128_t n)
+{
+    uint128_t r = 0;
+    u %= n;
+    while (v)
+    {
+        if (v & 1)
+        {
+            r += u;
+            r -= r >= n ? n : 0;
+        }
+        u <<= 1;
+        u -= u >= n ? n : 0;
+        v >>= 1;
+    }
+    return r;
+}
+
+static int inner_self_test_128(void)
+{
+    uint128_t n, u, v;
+    uint64_t x = 0x0123456789abcdefull;
+
+    printf("Montgomery 128 bit ...\n");
+    for (unsigned i = 0; i < COUNT; i++)
+    {
+        // xorshift, moduli of 3 ... 125 bits
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        n = (((uint128_t)x << 64) | (x * 0x9e3779b97f4a7c15ull)) >> (3 + i % 122);
+        n |= 1;
+        if (n < 3)
+            continue;
+        u = ((uint128_t)x * 0xd1b54a32d192ed03ull) % n;
+        v = ((uint128_t)(x ^ 0x5555555555555555ull) << 61) % n;
+        if (mul_mod<uint128_t, uint256_t>(u, v, n) != mul_mod_slow(u, v, n) ||
+            square_mod<uint128_t, uint256_t>(u, n) != mul_mod_slow(u, u, n) ||
+            shift_mod<uint128_t, uint256_t>(u, i % 64, n) != mul_mod_slow(u, (uint128_t)1 << (i % 64), n))
+        {
+            print128("mul_mod 128 failed, n", n);
+            return -1;
+        }
+    }
+
+    printf("Isprime 128 bit ...\n");
+    static const unsigned mersenne[] = {61, 89, 107};
+    for (unsigned i = 0; i < sizeof(mersenne) / sizeof(mersenne[0]); i++)
+    {
+        n = ((uint128_t)1 << mersenne[i]) - 1;
+        if (!isprime<uint128_t, uint256_t>(n) || !islnrc2prime<uint128_t, uint256_t>(n))
+        {
+            printf("isprime, islnrc2 M(%u) failed\n", mersenne[i]);
+            return -1;
+        }
+    }
+    // M(67) = 193707721 * 761838257287, M(61) * M(31)
+    n = ((uint128_t)1 << 67) - 1;
+    u = (((uint128_t)1 << 61) - 1) * (((uint128_t)1 << 31) - 1);
+    if (isprime<uint128_t, uint256_t>(n) || islnrc2prime<uint128_t, uint256_t>(n) ||
+        isprime<uint128_t, uint256_t>(u) || islnrc2prime<uint128_t, uint256_t>(u))
+    {
+        printf("expected composite failed\n");
+        return -1;
+    }
+
+    printf("Isprime and islnrc2prime, 64 and 128 bit ...\n");
+    for (uint64_t t = A_60_BITS * 2 + 1; t < A_60_BITS * 2 + 1 + 2 * COUNT; t += 2)
+    {
+        if (isprime<uint64_t, uint128_t>(t) != isprime<uint128_t, uint256_t>(t) ||
+            islnrc2prime<uint64_t, uint128_t>(t) != islnrc2prime<uint128_t, uint256_t>(t))
+        {
+            print128("64 and 128 bit disagree on", t);
+            return -1;
+        }
+    }
+
+    printf("Sieve and Miller-Rabin 128 bit ...\n");
+    inner_setup(true);
+    inner_range(2222, ((uint128_t)1 << 60) - COUNT / 2, COUNT, self_test_result, 0);
+    inner_range(2222, (uint128_t)A_60_BITS << 10, COUNT, self_test_result, 0);
+    inner_range(2222, (uint128_t)A_60_BITS << 63, COUNT, self_test_result, 0);
+    inner_setup(false);
+
+    volatile uint64_t t0, t1;
+    t0 = __rdtsc();
+    tlv_frame_t results;
+    tlv_frame_init(&results);
+    tlv_batch_init(&results, 2222);
+    inner_loop(0, 2222, (uint128_t)A_60_BITS << 10, COUNT, &results, false);
+    t1 = __rdtsc();
+    double d = (double)(t1 - t0);
+    d /= COUNT;
+    tlv_frame_free(&results);
+    printf("Average 70 bits: %8.1f ticks/iteration\n", d);
+    t0 = __rdtsc();
+    tlv_frame_init(&results);
+    tlv_batch_init(&results, 2222);
+    inner_loop(0, 2222, (uint128_t)A_60_BITS << 63, COUNT, &results, false);
+    t1 = __rdtsc();
+    d = (double)(t1 - t0);
+    d /= COUNT;
+    tlv_frame_free(&results);
+    printf("Average 123 bits: %8.1f ticks/iteration\n", d);
+    printf("Self-test 128 bit completed\n");
+    return 0;
+}
+
 int inner_self_test(void)
 {
     int rc = 0;
@@ -1737,5 +2639,11 @@ int inner_self_test(void)
         printf("64/128 bit failed\n");
         return rc;
     }
+    rc = inner_self_test_128();
+    if (rc)
+    {
+        printf("128/256 bit failed\n");
+        return rc;
+    }
     return 0;
 }
@@ -2,9 +2,28 @@
 #ifndef INNER_LOOP_H_H
 #define INNER_LOOP_H_H
 
+#include <stddef.h>
+
 #include "tlv.h"
 
-int inner_loop(int s, uint16_t cid, uint128_t seed, uint64_t count);
+#define INNER_PROGRESS_SEEDS (1u << 22) // seeds between two TLV_PROGRESS at most, a sieve segment
+
+// the results are added to the TLV_BATCH results, sent to c when it is large, or
+// sent one by one without results (peer without TLV_BATCH), c is 0 for a self test
+// with progress, a TLV_PROGRESS is sent with the results every INNER_PROGRESS_TIME,
+// at the end of a sieve segment, so after INNER_PROGRESS_SEEDS seeds at most
+// -1 when a TLV_STOP from c cancelled the block, the TLV_STOP is still to be read
+int inner_loop(tlv_conn_t *c, uint16_t cid, uint128_t seed, uint64_t count, tlv_frame_t *results, bool progress);
+// a result of a block, type is TLV_PSEUDOPRIME or TLV_PSEUDOCOMPOSITE, or TLV_PROGRESS
+// with the last seed done, all its results reported, -1 abandons the block
+typedef int (*inner_result_t)(void *arg, uint16_t cid, uint8_t type, uint128_t v);
+// the numbers of the seeds seed + 1 ... seed + count, without a socket, -1 when abandoned
+int inner_range(uint16_t cid, uint128_t seed, uint64_t count, inner_result_t result, void *arg);
+// odd numbers in any order, n < 2^125, the ground truth comes from Miller-Rabin
+int inner_values(uint16_t cid, const uint128_t *values, size_t n, inner_result_t result, void *arg);
+// the ground truth of a block comes from a segmented sieve, miller_rabin_check compares
+// it with Miller-Rabin for each number
+void inner_setup(bool miller_rabin_check);
 int inner_self_test(void);
 
 #endif
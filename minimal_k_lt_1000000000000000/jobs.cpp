@@ -0,0 +1,265 @@
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "jobs.h"
+#include "setup.h"
+
+#define JOB_PENDING 0
+#define JOB_RUNNING 1
+#define JOB_DONE 2
+
+#define VERDICT_COMPOSITE 0 // same as QUADRATIC_VERDICT_*
+#define VERDICT_PRIME 1
+#define VERDICT_INVALID 2
+
+#define REQUEST_EXPRESSION 0 // same as QUADRATIC_REQUEST_EXPRESSION
+
+typedef struct job_s
+{
+    uint64_t offset; // of the expression in the file
+    uint32_t len;
+    uint32_t line;
+    time_t t_start;
+    unsigned cid;
+    unsigned state;
+} job_t;
+
+static bool enabled = false;
+static char *text = 0; // the whole file
+static job_t *jobs = 0;
+static uint64_t job_count = 0;
+static uint64_t next_job = 0; // never dispatched before
+
+// jobs to dispatch again, from lost connections and timeouts
+static uint64_t *lost = 0;
+static uint64_t lost_count = 0;
+
+static uint64_t running[MAX_CID]; // job + 1 on each cid, 0 when none
+static uint64_t done = 0, primes = 0, composites = 0, invalids = 0;
+static unsigned job_timeout = 0;
+static FILE *verdicts = 0;
+
+int jobs_setup(const char *name, unsigned timeout)
+{
+    FILE *f = fopen(name, "rb");
+    if (!f)
+    {
+        perror(name);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    text = (char *)malloc(size + 1);
+    if (!text || fread(text, 1, size, f) != (size_t)size)
+    {
+        printf("Unable to read %s\n", name);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    text[size] = 0;
+
+    // one job per line, empty lines and comments are skipped
+    uint64_t allocated = 0;
+    uint32_t line = 0;
+    char *pt = text;
+    while (*pt)
+    {
+        char *eol = strchr(pt, '\n');
+        eol = eol ? eol : pt + strlen(pt);
+        line++;
+        char *start = pt;
+        char *end = eol;
+        while (start < end && isspace(*start))
+        {
+            start++;
+        }
+        while (end > start && isspace(end[-1]))
+        {
+            end--;
+        }
+        if (end > start && *start != '#')
+        {
+            if (job_count == allocated)
+            {
+                allocated = allocated ? 2 * allocated : 1024;
+                jobs = (job_t *)realloc(jobs, allocated * sizeof(job_t));
+                if (!jobs)
+                {
+                    printf("Unable to allocate %lu jobs\n", (unsigned long)allocated);
+                    return -1;
+                }
+            }
+            job_t *j = &jobs[job_count++];
+            j->offset = start - text;
+            j->len = end - start;
+            j->line = line;
+            j->t_start = 0;
+            j->cid = MAX_CID;
+            j->state = JOB_PENDING;
+        }
+        pt = *eol ? eol + 1 : eol;
+    }
+    lost = (uint64_t *)malloc((job_count + 1) * sizeof(uint64_t));
+
+    char verdicts_name[4096];
+    snprintf(verdicts_name, sizeof(verdicts_name), "%s.verdicts", name);
+    verdicts = fopen(verdicts_name, "at");
+    if (!lost || !verdicts)
+    {
+        perror(verdicts_name);
+        return -1;
+    }
+    job_timeout = timeout;
+    enabled = true;
+    printf("%lu jobs from %s, verdicts in %s\n", (unsigned long)job_count, name, verdicts_name);
+    fflush(stdout);
+    return 0;
+}
+
+bool jobs_enabled(void)
+{
+    return enabled;
+}
+
+int jobs_assign(unsigned cid, tlv_frame_t *f)
+{
+    uint64_t id = job_count;
+    while (lost_count && id == job_count)
+    {
+        // a job can be done while waiting in the lost list
+        uint64_t k = lost[--lost_count];
+        if (jobs[k].state == JOB_PENDING)
+        {
+            id = k;
+        }
+    }
+    if (id == job_count && next_job < job_count)
+    {
+        id = next_job++;
+    }
+    if (id == job_count)
+    {
+        return done == job_count ? -1 : 0;
+    }
+
+    job_t *j = &jobs[id];
+    if (tlv_frame_reserve(f, 9 + j->len) < 0)
+    {
+        lost[lost_count++] = id;
+        return 0;
+    }
+    j->state = JOB_RUNNING;
+    j->cid = cid;
+    j->t_start = time(NULL);
+    running[cid] = id + 1;
+
+    f->type = TLV_JOB;
+    f->cid = cid;
+    f->len = 9 + j->len;
+    for (int i = 0; i < 8; i++)
+    {
+        f->value[i] = id >> (8 * i);
+    }
+    f->value[8] = REQUEST_EXPRESSION;
+    memcpy(&f->value[9], &text[j->offset], j->len);
+    return 1;
+}
+
+void jobs_verdict(unsigned cid, const tlv_frame_t *f)
+{
+    if (f->len < 9)
+    {
+        return;
+    }
+    uint64_t id = 0;
+    for (int i = 7; i >= 0; i--)
+    {
+        id = (id << 8) + f->value[i];
+    }
+    if (running[cid] == id + 1)
+    {
+        running[cid] = 0;
+    }
+    if (id >= job_count || jobs[id].state == JOB_DONE)
+    {
+        return; // dispatched twice, the first verdict won
+    }
+
+    job_t *j = &jobs[id];
+    uint8_t verdict = f->value[8];
+    const char *s = verdict == VERDICT_PRIME       ? "might be prime"
+                    : verdict == VERDICT_COMPOSITE ? "composite for sure"
+                                                   : "invalid";
+    j->state = JOB_DONE;
+    done++;
+    primes += verdict == VERDICT_PRIME;
+    composites += verdict == VERDICT_COMPOSITE;
+    invalids += verdict != VERDICT_PRIME && verdict != VERDICT_COMPOSITE;
+    fprintf(verdicts, "%.*s %s\n", (int)j->len, &text[j->offset], s);
+    fflush(verdicts);
+    if (verdict == VERDICT_INVALID)
+    {
+        printf("Invalid expression line %u\n", (unsigned)j->line);
+    }
+
+    time_t now = time(NULL);
+    static time_t last_display = 0;
+    if (now - last_display > 5 || done == job_count)
+    {
+        last_display = now;
+        printf("Jobs done %lu/%lu, %lu primes, %lu composites, %lu invalid\n", (unsigned long)done,
+               (unsigned long)job_count, (unsigned long)primes, (unsigned long)composites, (unsigned long)invalids);
+    }
+    fflush(stdout);
+}
+
+void jobs_release(unsigned cid)
+{
+    if (running[cid])
+    {
+        uint64_t id = running[cid] - 1;
+        running[cid] = 0;
+        if (jobs[id].state == JOB_RUNNING && jobs[id].cid == cid)
+        {
+            jobs[id].state = JOB_PENDING;
+            jobs[id].cid = MAX_CID;
+            lost[lost_count++] = id;
+        }
+    }
+}
+
+bool jobs_timeout(void)
+{
+    static time_t last_check = 0;
+    time_t now = time(NULL);
+    if (!enabled || !job_timeout || now == last_check)
+    {
+        return lost_count > 0 || done == job_count;
+    }
+    last_check = now;
+    for (unsigned cid = 0; cid < MAX_CID; cid++)
+    {
+        if (running[cid])
+        {
+            job_t *j = &jobs[running[cid] - 1];
+            if (j->state == JOB_RUNNING && j->cid == cid && now > j->t_start + (time_t)job_timeout)
+            {
+                // the worker can still send its verdict, the first one wins
+                printf("Job timeout line %u cid %d\n", (unsigned)j->line, cid);
+                fflush(stdout);
+                j->state = JOB_PENDING;
+                j->cid = MAX_CID;
+                lost[lost_count++] = running[cid] - 1;
+            }
+        }
+    }
+    return lost_count > 0 || done == job_count;
+}
@@ -0,0 +1,26 @@
+#ifndef JOBS_H_H
+#define JOBS_H_H
+
+// jobs from a file of candidates, one expression per line, tested by workers
+//
+//     quadratic -t 8 --worker 192.168.1.2 15002
+//
+// A job is a TLV_JOB sent after a TLV_READY, the worker answers with a TLV_VERDICT.
+// Jobs of a lost connection, or running for too long, are dispatched again, the
+// first verdict wins.
+
+#include <stdint.h>
+
+#include "tlv.h"
+
+int jobs_setup(const char *name, unsigned timeout);
+bool jobs_enabled(void);
+// 1 : a job for cid is in f, 0 : no job now, -1 : all jobs done
+int jobs_assign(unsigned cid, tlv_frame_t *f);
+void jobs_verdict(unsigned cid, const tlv_frame_t *f);
+// the connection of cid is lost
+void jobs_release(unsigned cid);
+// true when idle workers must be served again, with lost jobs or with a TLV_STOP
+bool jobs_timeout(void);
+
+#endif
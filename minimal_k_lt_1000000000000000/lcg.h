@@ -7,6 +7,8 @@ class Lcg
     const uint64_t A;
     const uint64_t C;
     const uint64_t M;
+    // sequential numbering wraps at the 3 guard bits of uint128_t numbers, not at M
+    static constexpr uint128_t MS = ((uint128_t)1 << 124) - 1;
 
     uint64_t modpow(uint64_t b, uint64_t e)
     {
@@ -67,7 +69,7 @@ class Lcg
                 // sequential numbering
                 uint128_t t = C;
                 t += seed;
-                seed = t % M;
+                seed = t % MS;
                 xn = seed;
             }
             else
@@ -84,7 +86,7 @@ class Lcg
                 uint128_t t = n;
                 t *= C;
                 t += seed;
-                seed = t % M;
+                seed = t % MS;
                 xn = seed;
             }
             else
@@ -0,0 +1,231 @@
+
+#include <ctype.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <set>
+
+#include "inner_loop.h"
+#include "lcg.h"
+#include "local_loop.h"
+#include "report.h"
+#include "tlv.h"
+
+#define LOCAL_BLOCK (1ull << 22) // numbers per block, a few seconds
+#define LOCAL_RING 4096          // results in flight, power of 2
+#define LOCAL_MAX_THREADS 1024
+
+// bounded lock-free ring, many threads post, the main thread takes
+typedef struct local_slot_s
+{
+    std::atomic<uint64_t> seq;
+    uint8_t type; // TLV_PSEUDOPRIME, TLV_PSEUDOCOMPOSITE, or TLV_READY when value is a completed block
+    uint128_t value;
+} local_slot_t;
+
+static local_slot_t ring[LOCAL_RING];
+static std::atomic<uint64_t> ring_head(0); // next slot to post
+static uint64_t ring_tail = 0;             // next slot to take
+
+static std::atomic<uint64_t> next_block(0);
+static std::atomic<unsigned> finished(0);
+static uint128_t first_seed, end_seed; // the threads test the seeds first_seed + 1 ... end_seed
+
+static void local_post(uint8_t type, uint128_t value)
+{
+    uint64_t pos = ring_head.load(std::memory_order_relaxed);
+    local_slot_t *slot;
+    while (1)
+    {
+        slot = &ring[pos & (LOCAL_RING - 1)];
+        int64_t diff = (int64_t)(slot->seq.load(std::memory_order_acquire) - pos);
+        if (diff == 0)
+        {
+            if (ring_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            // full, the main thread is behind
+            sched_yield();
+            pos = ring_head.load(std::memory_order_relaxed);
+        }
+        else
+        {
+            pos = ring_head.load(std::memory_order_relaxed);
+        }
+    }
+    slot->type = type;
+    slot->value = value;
+    slot->seq.store(pos + 1, std::memory_order_release);
+}
+
+static bool local_take(uint8_t *type, uint128_t *value)
+{
+    local_slot_t *slot = &ring[ring_tail & (LOCAL_RING - 1)];
+    if (slot->seq.load(std::memory_order_acquire) != ring_tail + 1)
+    {
+        return false;
+    }
+    *type = slot->type;
+    *value = slot->value;
+    slot->seq.store(ring_tail + LOCAL_RING, std::memory_order_release);
+    ring_tail++;
+    return true;
+}
+
+static int local_result(void *arg, uint16_t cid, uint8_t type, uint128_t v)
+{
+    (void)arg;
+    (void)cid;
+    if (type != TLV_PROGRESS)
+    {
+        local_post(type, v);
+    }
+    return 0;
+}
+
+static void *local_thread(void *arg)
+{
+    uint16_t cid = (uint16_t)(uintptr_t)arg;
+    while (1)
+    {
+        uint64_t b = next_block.fetch_add(1, std::memory_order_relaxed);
+        uint128_t seed = first_seed + (uint128_t)b * LOCAL_BLOCK;
+        if (seed >= end_seed)
+        {
+            break;
+        }
+        uint64_t count = end_seed - seed < LOCAL_BLOCK ? (uint64_t)(end_seed - seed) : LOCAL_BLOCK;
+        inner_range(cid, seed, count, local_result, 0);
+        local_post(TLV_READY, b);
+    }
+    finished.fetch_add(1, std::memory_order_release);
+    return 0;
+}
+
+// same line as the server
+static void local_progress(uint128_t seed)
+{
+    char buff[60];
+    time_t rawtime = time(NULL);
+    ctime_r(&rawtime, buff);
+    int len = strlen(buff);
+    while (len > 0 && isspace(buff[len - 1]))
+    {
+        len--;
+    }
+    buff[len++] = 0;
+    strcat(buff, " Completed");
+    print128(buff, convert_seed_to_number(seed));
+    fflush(stdout);
+}
+
+int local_run(unsigned thread_count, uint128_t first, uint128_t last)
+{
+    if (first < 3)
+    {
+        first = 3;
+    }
+    if (thread_count < 1 || thread_count > LOCAL_MAX_THREADS || last < first || last >= ((uint128_t)1 << 125) - 1)
+    {
+        printf("Invalid local range, or thread count (1 ... %u)\n", LOCAL_MAX_THREADS);
+        return -1;
+    }
+    // odd numbers of [first, last]
+    first_seed = convert_number_to_seed(first) - 1;
+    end_seed = convert_number_to_seed(last - 1 + (last & 1));
+    for (unsigned i = 0; i < LOCAL_RING; i++)
+    {
+        ring[i].seq.store(i, std::memory_order_relaxed);
+    }
+    if (report_setup("lnrc.log") < 0)
+    {
+        return -1;
+    }
+    printf("Local run with %u threads\n", thread_count);
+    print128("From", convert_seed_to_number(first_seed + 1));
+    print128("To  ", convert_seed_to_number(end_seed));
+    fflush(stdout);
+
+    for (unsigned i = 0; i < thread_count; i++)
+    {
+        pthread_t tid;
+        if (pthread_create(&tid, 0, local_thread, (void *)(uintptr_t)i))
+        {
+            printf("Unable to start thread %u\n", i);
+            exit(1);
+        }
+        pthread_detach(tid);
+    }
+
+    uint64_t pseudoprimes = 0, pseudocomposites = 0;
+    uint64_t done = 0; // the blocks before done are completed
+    std::set<uint64_t> completed;
+    time_t last_display = 0;
+    uint128_t last_seed = first_seed;
+    while (1)
+    {
+        bool all = finished.load(std::memory_order_acquire) == thread_count;
+        uint8_t type;
+        uint128_t v;
+        unsigned n = 0;
+        while (local_take(&type, &v))
+        {
+            n++;
+            switch (type)
+            {
+            case TLV_PSEUDOPRIME:
+                pseudoprimes++;
+                report("Pseudoprime", v);
+                break;
+            case TLV_PSEUDOCOMPOSITE:
+                pseudocomposites++;
+                report("Pseudocomposite", v);
+                break;
+            case TLV_READY:
+                completed.insert((uint64_t)v);
+                while (!completed.empty() && *completed.begin() == done)
+                {
+                    completed.erase(completed.begin());
+                    done++;
+                }
+                break;
+            }
+        }
+        time_t now = time(NULL);
+        if (n && now != last_display)
+        {
+            last_display = now;
+            uint128_t seed = first_seed + (uint128_t)done * LOCAL_BLOCK;
+            last_seed = seed < end_seed ? seed : end_seed;
+            local_progress(last_seed);
+        }
+        if (!n)
+        {
+            if (all)
+            {
+                break;
+            }
+            usleep(1000);
+        }
+    }
+    if (last_seed != end_seed)
+    {
+        local_progress(end_seed);
+    }
+    report_flush();
+    printf("Local run done, %lu pseudoprimes, %lu pseudocomposites\n", (unsigned long)pseudoprimes,
+           (unsigned long)pseudocomposites);
+    return 0;
+}
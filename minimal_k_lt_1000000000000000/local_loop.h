@@ -0,0 +1,17 @@
+
+#ifndef LOCAL_LOOP_H_H
+#define LOCAL_LOOP_H_H
+
+// one host, no server : the threads test the odd numbers first ... last
+//
+//     lnrc -local -t 12 -range 1000000 2000000000
+//
+// Blocks are taken from a shared counter, results and completed blocks go
+// through a lock-free ring to the main thread, which displays the progress
+// and appends the results to lnrc.log, as the server does.
+
+#include "tlv.h"
+
+int local_run(unsigned thread_count, uint128_t first, uint128_t last);
+
+#endif
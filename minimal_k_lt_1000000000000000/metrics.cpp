@@ -0,0 +1,221 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <x86intrin.h>
+
+#include <map>
+#include <string>
+
+#include "metrics.h"
+
+#define METRICS_LINGER 5 // seconds, a connection still open is then closed
+
+static const char header[] = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n";
+
+typedef struct metrics_conn_s
+{
+    std::string text; // to write
+    size_t pos;
+    bool shut; // all written
+    bool eof;  // the peer has sent everything
+    time_t t_open;
+} metrics_conn_t;
+
+static int metrics_epfd = -1;
+static int metrics_sd = -1;
+static metrics_render_t metrics_render = 0;
+static std::map<int, metrics_conn_t> metrics_conns;
+
+static uint64_t t0_ticks;
+static struct timespec t0_clock;
+
+int metrics_setup(int epfd, unsigned short port, metrics_render_t render)
+{
+    struct sockaddr_in addr;
+    struct epoll_event ev;
+    int one = 1;
+
+    t0_ticks = __rdtsc();
+    clock_gettime(CLOCK_MONOTONIC, &t0_clock);
+
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); // local only
+    addr.sin_port = htons(port);
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s, 16) < 0)
+    {
+        printf("No metrics on port %u : %s\n", (unsigned)port, strerror(errno));
+        fflush(stdout);
+        close(s);
+        return -1;
+    }
+    fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = s;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        close(s);
+        return -1;
+    }
+    metrics_epfd = epfd;
+    metrics_sd = s;
+    metrics_render = render;
+    printf("Metrics on 127.0.0.1:%u\n", (unsigned)port);
+    fflush(stdout);
+    return s;
+}
+
+bool metrics_socket(int s)
+{
+    return s >= 0 && (s == metrics_sd || metrics_conns.count(s));
+}
+
+double metrics_tick(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t ticks = __rdtsc() - t0_ticks;
+    double seconds = (now.tv_sec - t0_clock.tv_sec) + (now.tv_nsec - t0_clock.tv_nsec) * 1e-9;
+    // the first scrapes use a nominal 3 GHz
+    return ticks && seconds > 0.1 ? seconds / ticks : 1.0 / 3e9;
+}
+
+static time_t metrics_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec;
+}
+
+static void metrics_close(int s)
+{
+    metrics_conns.erase(s);
+    close(s); // removed from the epoll set
+}
+
+void metrics_expire(void)
+{
+    time_t now = metrics_now();
+    for (auto it = metrics_conns.begin(); it != metrics_conns.end();)
+    {
+        int s = it->first;
+        bool expired = now - it->second.t_open >= METRICS_LINGER;
+        ++it;
+        if (expired)
+        {
+            // a peer which never closes, or never reads
+            metrics_close(s);
+        }
+    }
+}
+
+// write as much as the socket accepts, then no more writes, -1 when broken
+static int metrics_flush(int s, metrics_conn_t *m)
+{
+    while (m->pos < m->text.size())
+    {
+        ssize_t w = send(s, m->text.data() + m->pos, m->text.size() - m->pos, MSG_NOSIGNAL);
+        if (w < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        m->pos += w;
+    }
+    if (!m->shut)
+    {
+        // the peer reads until the end, the request is drained until it closes
+        m->shut = true;
+        m->text.clear();
+        shutdown(s, SHUT_WR);
+    }
+    return 0;
+}
+
+static void metrics_accept(void)
+{
+    while (1)
+    {
+        int s = accept(metrics_sd, 0, 0);
+        if (s < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = s;
+        if (epoll_ctl(metrics_epfd, EPOLL_CTL_ADD, s, &ev) < 0)
+        {
+            close(s);
+            continue;
+        }
+        metrics_conn_t *m = &metrics_conns[s];
+        m->text = header;
+        m->pos = 0;
+        m->shut = false;
+        m->eof = false;
+        m->t_open = metrics_now();
+        metrics_render(m->text);
+        if (metrics_flush(s, m) < 0)
+        {
+            metrics_close(s);
+        }
+    }
+}
+
+void metrics_event(int s, uint32_t events)
+{
+    if (s == metrics_sd)
+    {
+        metrics_accept();
+        return;
+    }
+    metrics_conn_t *m = &metrics_conns[s];
+    if ((events & EPOLLERR) || ((events & EPOLLOUT) && metrics_flush(s, m) < 0))
+    {
+        metrics_close(s);
+        return;
+    }
+    char buff[1024];
+    while (!m->eof && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)))
+    {
+        ssize_t r = recv(s, buff, sizeof(buff), 0);
+        if (r > 0 || (r < 0 && errno == EINTR))
+            continue;
+        if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        {
+            metrics_close(s);
+            return;
+        }
+        m->eof = r == 0;
+        break;
+    }
+    if (m->eof && m->shut)
+    {
+        // the peer has read everything and closed
+        metrics_close(s);
+    }
+}
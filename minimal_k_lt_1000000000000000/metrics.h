@@ -0,0 +1,32 @@
+
+#ifndef METRICS_H_H
+#define METRICS_H_H
+
+// a text endpoint of the server, Prometheus exposition format, on 127.0.0.1
+//
+//     curl http://127.0.0.1:15004/metrics
+//     nc 127.0.0.1 15004
+//
+// The sockets are non-blocking and in the epoll set of the server : a connection gets
+// the text rendered when it is accepted, written as the socket accepts it, then the
+// connection is closed when the peer closes it, or 5 seconds after it was accepted. The
+// request is read and ignored.
+
+#include <stdint.h>
+
+#include <string>
+
+// the rendering of the metrics, called from the event loop
+typedef void (*metrics_render_t)(std::string &text);
+
+// listening socket in epfd, -1 when it cannot be opened (the server runs without it)
+int metrics_setup(int epfd, unsigned short port, metrics_render_t render);
+// s is the listening socket or a connection of the endpoint
+bool metrics_socket(int s);
+void metrics_event(int s, uint32_t events);
+// close the connections open for too long, called from the event loop
+void metrics_expire(void);
+// seconds per rdtsc tick, calibrated since metrics_setup()
+double metrics_tick(void);
+
+#endif
@@ -1,6 +1,8 @@
 
-#include <poll.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -12,17 +14,30 @@
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
-#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 #include <x86intrin.h>
 
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "checkpoint.h"
 #include "client_loop.h"
 #include "inner_loop.h"
+#include "jobs.h"
 #include "lcg.h"
+#include "local_loop.h"
+#include "metrics.h"
 #include "proxy_loop.h"
+#include "psp_list.h"
+#include "report.h"
 #include "setup.h"
 #include "tlv.h"
 
@@ -34,30 +49,41 @@ static unsigned short server_port;
 #define STATE_RUNNING 2
 #define STATE_DONE 3
 #define STATE_DEAD 4
+#define STATE_IDLE 5 // waiting for a job, all jobs running
 
-#define MAX_BLOCK (MAX_CID * 32)          // power of 2
+#define MAX_BLOCK (MAX_CID * 8)           // power of 2, the last MAX_CID entries for the blocks lost
 #define BLOCK_TIME (120000000000ull)      // approx 10 seconds
 #define RATE (10000ull)                   // approx 1 check per 10000 ticks
 #define BLOCK_TIMEOUT (2ull * BLOCK_TIME) // approx 20 seconds
+#define BLOCK_LATE (BLOCK_TIME / 4)       // a block late by more gets a second worker
+#define PROGRESS_TIMEOUT (BLOCK_TIME / 2) // a worker which sends TLV_PROGRESS is hung after this silence at least
 #define INIT_SEED (1)
 
 typedef struct connection_s
 {
     uint64_t rate;
     uint64_t t_connect;
+    uint64_t t_start;    // of its block
+    uint64_t t_progress; // last TLV_PROGRESS, or t_start
+    uint64_t count;      // of its block, for the rate
     uint64_t progress;
     int s;
     unsigned state;
     unsigned cid;
+    bool batch;  // the client understands TLV_BATCH
+    bool cancel; // and TLV_STOP_CANCEL
+    bool heartbeat; // and TLV_PROGRESS
 } connection_t;
 
 typedef struct progress_s
 {
     uint128_t seed;
     uint64_t count;
+    uint64_t done; // seeds seed + 1 ... seed + done reported by TLV_PROGRESS
     uint64_t t_start;
     uint64_t expected_t_end;
     unsigned cid;
+    unsigned dup_cid; // a second worker on a late block, MAX_CID when none
     unsigned state;
 } progress_t;
 
@@ -66,9 +92,83 @@ static progress_t progress[MAX_BLOCK];
 static uint64_t head = MAX_CID;
 static uint64_t tail = MAX_CID;
 static uint128_t done_count = 0;
+static uint64_t pseudoprime_count = 0;
+static uint64_t pseudocomposite_count = 0;
+static uint64_t b1_count = 0;
+static unsigned idle_count = 0; // STATE_IDLE connections
+static uint128_t end_seed = ~(uint128_t)0; // the size of a list of pseudoprimes, no end otherwise
+
+// counters since the start of the server, for the metrics
+static uint64_t dead_total = 0;       // blocks lost by their worker
+static uint64_t redispatch_total = 0; // parts of dead blocks dispatched again
+static uint64_t duplicate_total = 0;  // late blocks given to a second worker
+static uint64_t cancel_total = 0;     // workers cancelled by the other worker of their block
+static uint64_t hung_total = 0;       // workers silent for hung_time()
+static uint128_t salvage_total = 0;   // seeds of dead blocks done before their worker died
+static uint64_t drop_total = 0;       // results of a block sent again, or by a worker not running it any more
+static uint64_t loop_count = 0;       // iterations of the event loop, events to group commit
+static uint64_t loop_ticks = 0;
+static uint64_t loop_ticks_max = 0;
+static int metrics_port = -1; // server port + METRICS_PORT_OFFSET unless -metrics
 
 static Lcg lll;
 
+// the results received for a block in the ring, by block index, until the tail passes it. They are
+// counted, journaled and written to lnrc.log with the numbers they come from : all of them when
+// the block is done, the ones before the last TLV_PROGRESS of their worker when it is salvaged.
+// A block resumed after a crash finds again only the results not counted.
+typedef struct held_result_s
+{
+    unsigned cid;
+    uint8_t type;
+    bool covered; // a TLV_PROGRESS of cid came after it
+    uint128_t v;
+} held_result_t;
+
+typedef struct block_results_s
+{
+    std::set<std::pair<uint8_t, uint128_t>> seen; // from any worker of the block, once
+    std::vector<held_result_t> held;              // not counted yet
+} block_results_t;
+
+static std::map<uint64_t, block_results_t> block_results;
+
+// count and log the results held for the block index, all or only the covered ones, drop the others
+static void block_commit(uint64_t index, bool all)
+{
+    std::map<uint64_t, block_results_t>::iterator it = block_results.find(index);
+    if (it == block_results.end())
+        return;
+    for (size_t k = 0; k < it->second.held.size(); k++)
+    {
+        const held_result_t *r = &it->second.held[k];
+        if (!all && !r->covered)
+        {
+            drop_total++; // found again where the block is dispatched again
+            continue;
+        }
+        switch (r->type)
+        {
+        case TLV_PSEUDOPRIME:
+            pseudoprime_count++;
+            report("Pseudoprime", r->v);
+            break;
+        case TLV_PSEUDOCOMPOSITE:
+            pseudocomposite_count++;
+            report("Pseudocomposite", r->v);
+            break;
+        case TLV_B1:
+            b1_count++;
+            report("B == 1", r->v);
+            break;
+        }
+    }
+    it->second.held.clear();
+}
+
+// blocks not done by a previous run, from the checkpoint journal
+static std::vector<checkpoint_block_t> resume_blocks;
+
 #if 0
 #if __clang__
 #if __clang_major__ < 4
@@ -82,20 +182,6 @@ static uint64_t __rdtsc(void)
 #endif
 #endif
 
-static void report(const char *s, uint128_t v)
-{
-    // display
-    print128(s, v);
-
-    // append to log file
-    FILE *l = fopen("lnrc.log", "at");
-    if (l)
-    {
-        print128(s, v, l);
-        fclose(l);
-    }
-}
-
 static void connections_init(void)
 {
     int i;
@@ -111,26 +197,61 @@ static void connections_init(void)
     tail = MAX_CID;
 }
 
-// check if a socket is unexpectedly closed, This can happen from network disruption, tcp timeout
-// Enter reality : the impact of a broken socket can include SIG_PIPE, read return -1, or return 0 and errno is set, or
-// .....
-static bool is_closed_socket(int fd)
+static void checkpoint(uint64_t index, uint128_t seed, uint64_t count)
 {
-    struct pollfd pfd;
-    int ret;
+    checkpoint_state_t state;
+    state.next_seed = lll.get_seed(0);
+    state.done_count = done_count;
+    state.pseudoprimes = pseudoprime_count;
+    state.pseudocomposites = pseudocomposite_count;
+    state.b1 = b1_count;
+    checkpoint_block(index, seed, count, &state);
+}
 
-    pfd.fd = fd;
-    pfd.events = POLLRDHUP;
-    pfd.revents = 0;
-    ret = poll(&pfd, 1, 0);
-    if (ret > 0 && (pfd.revents & (POLLHUP | POLLERR | POLLRDHUP)))
+// the part of a block done before its worker died is not dispatched again
+static void block_salvage(uint64_t index)
+{
+    progress_t *pg = &progress[index % MAX_BLOCK];
+    block_commit(index, false); // in the next record, with the seeds done
+    if (!pg->done)
+        return;
+    Lcg u;
+    u.set_seed(pg->seed);
+    pg->seed = u.get_seed(pg->done);
+    pg->count -= pg->done;
+    done_count += pg->done;
+    salvage_total += pg->done;
+    pg->done = 0;
+    if (!pg->count)
     {
-        return true;
+        pg->state = STATE_DONE;
     }
-    else
+    checkpoint(index, pg->count ? pg->seed : 0, pg->count);
+}
+
+// cid leaves its running block, dead unless a second worker runs it too
+static void block_release(unsigned cid)
+{
+    if (connections[cid].state != STATE_RUNNING)
+        return;
+    progress_t *pg = &progress[connections[cid].progress % MAX_BLOCK];
+    if (pg->state != STATE_RUNNING)
+        return;
+    if (pg->dup_cid == cid)
     {
-        return false;
+        pg->dup_cid = MAX_CID;
+        return;
     }
+    if (pg->cid == cid && pg->dup_cid != MAX_CID)
+    {
+        pg->cid = pg->dup_cid;
+        pg->dup_cid = MAX_CID;
+        pg->expected_t_end = connections[pg->cid].t_start + pg->count * connections[pg->cid].rate;
+        return;
+    }
+    pg->state = STATE_DEAD;
+    dead_total++;
+    block_salvage(connections[cid].progress);
 }
 
 // close all connections related to socket s
@@ -141,15 +262,10 @@ static void set_broken_socket(int s)
     {
         if (connections[i].s == s && connections[i].state != STATE_UNUSED)
         {
-            if (connections[i].state == STATE_RUNNING)
-            {
-                progress_t *pg = &progress[connections[i].progress % MAX_BLOCK];
-                if (pg->state == STATE_RUNNING)
-                {
-                    pg->state = STATE_DEAD;
-                }
-            }
+            block_release(i);
+            idle_count -= connections[i].state == STATE_IDLE;
             connections[i].state = STATE_UNUSED;
+            jobs_release(i);
             printf("End cid %d\n", i);
         }
     }
@@ -166,6 +282,7 @@ static void set_timeout(void)
             break;
         tail++;
     }
+    block_results.erase(block_results.begin(), block_results.lower_bound(tail));
 
     // printf("%lu %lu\n", tail, head);
     if (tail < head)
@@ -176,7 +293,7 @@ static void set_timeout(void)
             if (current_t > progress[i].expected_t_end + BLOCK_TIMEOUT)
             {
                 unsigned cid = progress[i].cid;
-                progress[i].state = STATE_DEAD;
+                block_release(cid);
                 connections[cid].state = STATE_DEAD;
                 printf("Server Timeout Cid %d\n", cid);
                 fflush(stdout);
@@ -185,6 +302,38 @@ static void set_timeout(void)
     }
 }
 
+// TLV_PROGRESS comes after a sieve segment, the silence of a slow worker can be longer
+static uint64_t hung_time(const connection_t *cn)
+{
+    uint64_t count = cn->count < INNER_PROGRESS_SEEDS ? cn->count : INNER_PROGRESS_SEEDS;
+    uint64_t t = 2 * count * cn->rate;
+    return t > PROGRESS_TIMEOUT ? t : PROGRESS_TIMEOUT;
+}
+
+// a worker which sends TLV_PROGRESS and is silent for hung_time() is hung, its block
+// is dead long before BLOCK_TIMEOUT, a check per second
+static void set_hung(void)
+{
+    static time_t last_check = 0;
+    time_t now = time(NULL);
+    if (now == last_check)
+        return;
+    last_check = now;
+    uint64_t current_t = __rdtsc();
+    for (unsigned cid = 0; cid < MAX_CID; cid++)
+    {
+        connection_t *cn = &connections[cid];
+        if (cn->state == STATE_RUNNING && cn->heartbeat && current_t > cn->t_progress + hung_time(cn))
+        {
+            block_release(cid);
+            cn->state = STATE_DEAD;
+            hung_total++;
+            printf("Server Hung Cid %d\n", cid);
+            fflush(stdout);
+        }
+    }
+}
+
 static uint64_t get_count_from_rate(uint64_t rate)
 {
     uint64_t ncount = (BLOCK_TIME + rate - 1) / rate;
@@ -193,16 +342,24 @@ static uint64_t get_count_from_rate(uint64_t rate)
     return ncount;
 }
 
-static void get_next(uint128_t *seed, uint64_t *count, uint64_t rate)
+// block index changed, the record is written with the next batch
+// false when all the blocks are dispatched, or when the ring is full : an entry is never
+// overwritten, the worker waits in STATE_IDLE for the tail
+static bool get_next(uint128_t *seed, uint64_t *count, uint64_t rate)
 {
     uint64_t ncount;
-    int j, i;
+    uint64_t j, i;
+    if (head - tail >= MAX_BLOCK)
+    {
+        return false;
+    }
     for (j = tail; j < head; j++)
     {
         i = j % MAX_BLOCK;
         if (progress[i].state == STATE_DEAD && progress[i].count > 0)
         {
             *seed = progress[i].seed;
+            redispatch_total++;
             ncount = get_count_from_rate(rate);
             if (ncount < progress[i].count)
             {
@@ -217,16 +374,93 @@ static void get_next(uint128_t *seed, uint64_t *count, uint64_t rate)
                 progress[i].count = 0;
                 progress[i].state = STATE_DONE;
             }
+            checkpoint(j, progress[i].seed, progress[i].count);
             *count = ncount;
-            return;
+            return true;
         }
     }
 
+    if (head - tail >= MAX_BLOCK - MAX_CID)
+    {
+        return false; // a lost block at the tail can still be dispatched again
+    }
     *seed = lll.get_seed(0);
+    if (*seed >= end_seed)
+    {
+        return false;
+    }
     ncount = get_count_from_rate(rate);
+    if (ncount > end_seed - *seed)
+    {
+        ncount = (uint64_t)(end_seed - *seed);
+    }
     lll.get_seed(ncount);
     *count = ncount;
-    return;
+    return true;
+}
+
+// a block lost, to dispatch again
+static bool blocks_dead(void)
+{
+    for (uint64_t j = tail; j < head; j++)
+    {
+        progress_t *pg = &progress[j % MAX_BLOCK];
+        if (pg->state == STATE_DEAD && pg->count > 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a running block for a second worker : the block at the tail when its worker is late by its own
+// rate and cid is not slower, or when cid would be idle, the oldest one cid can complete first
+static bool get_duplicate(unsigned cid, uint64_t *index, bool idle)
+{
+    uint64_t current_t = __rdtsc();
+    for (uint64_t j = tail; j < head; j++)
+    {
+        progress_t *pg = &progress[j % MAX_BLOCK];
+        if (pg->state == STATE_DONE)
+            continue;
+        bool single = pg->state == STATE_RUNNING && pg->dup_cid == MAX_CID && pg->cid != cid;
+        bool late = current_t > pg->expected_t_end + BLOCK_LATE;
+        if (!idle)
+        {
+            // the block which holds back the completed mark
+            if (single && late && connections[cid].rate <= connections[pg->cid].rate)
+            {
+                *index = j;
+                return true;
+            }
+            return false;
+        }
+        if (single && (late || current_t + pg->count * connections[cid].rate < pg->expected_t_end))
+        {
+            *index = j;
+            return true;
+        }
+    }
+    return false;
+}
+
+// blocks dispatched and not done yet
+static bool blocks_running(void)
+{
+    for (uint64_t j = tail; j < head; j++)
+    {
+        if (progress[j % MAX_BLOCK].state != STATE_DONE)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// a lost block for the idle workers, or the end of the list
+static bool blocks_pending(void)
+{
+    return blocks_dead() || !blocks_running();
 }
 
 static void display_progress()
@@ -262,8 +496,15 @@ static void display_progress()
                 len--;
             }
             buff[len++] = 0;
-            min_seed = convert_seed_to_number(min_seed);
-            strcat(buff, " Completed");
+            if (psp_list_enabled())
+            {
+                strcat(buff, " Completed offset"); // of the list
+            }
+            else
+            {
+                min_seed = convert_seed_to_number(min_seed);
+                strcat(buff, " Completed");
+            }
             print128(buff, min_seed);
             fflush(stdout);
         }
@@ -291,17 +532,526 @@ static void display_progress()
     }
 }
 
+static void metrics_line(std::string &text, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void metrics_line(std::string &text, const char *fmt, ...)
+{
+    char buff[200];
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(buff, sizeof(buff), fmt, ap);
+    va_end(ap);
+    text += buff;
+}
+
+// the state of the server, Prometheus text format, for the metrics endpoint
+static void server_metrics(std::string &text)
+{
+    double tick = metrics_tick();
+    uint64_t in_flight = 0, dead = 0, duplicated = 0;
+    unsigned workers[STATE_IDLE + 1] = {0};
+    static const char *state_names[STATE_IDLE + 1] = {"unused", "pending", "running", "done", "dead", "idle"};
+
+    for (uint64_t j = tail; j < head; j++)
+    {
+        progress_t *pg = &progress[j % MAX_BLOCK];
+        in_flight += pg->state == STATE_RUNNING;
+        duplicated += pg->state == STATE_RUNNING && pg->dup_cid != MAX_CID;
+        dead += pg->state == STATE_DEAD && pg->count > 0;
+    }
+
+    text += "# HELP lnrc_worker_numbers_per_second Measured rate of a worker, bytes of the list with -psp.\n";
+    text += "# TYPE lnrc_worker_numbers_per_second gauge\n";
+    for (unsigned cid = 0; cid < MAX_CID; cid++)
+    {
+        connection_t *cn = &connections[cid];
+        workers[cn->state]++;
+        if (cn->state == STATE_UNUSED)
+            continue;
+        metrics_line(text, "lnrc_worker_numbers_per_second{cid=\"%u\",state=\"%s\"} %.1f\n", cid,
+                     state_names[cn->state], cn->rate ? 1.0 / (cn->rate * tick) : 0.0);
+    }
+    text += "# HELP lnrc_workers Connected workers by state.\n";
+    text += "# TYPE lnrc_workers gauge\n";
+    for (unsigned st = STATE_PENDING; st <= STATE_IDLE; st++)
+    {
+        metrics_line(text, "lnrc_workers{state=\"%s\"} %u\n", state_names[st], workers[st]);
+    }
+
+    text += "# HELP lnrc_blocks_in_flight Blocks running on a worker.\n";
+    text += "# TYPE lnrc_blocks_in_flight gauge\n";
+    metrics_line(text, "lnrc_blocks_in_flight %lu\n", (unsigned long)in_flight);
+    text += "# HELP lnrc_blocks_duplicated Blocks running on two workers.\n";
+    text += "# TYPE lnrc_blocks_duplicated gauge\n";
+    metrics_line(text, "lnrc_blocks_duplicated %lu\n", (unsigned long)duplicated);
+    text += "# HELP lnrc_blocks_dead Lost blocks waiting to be dispatched again.\n";
+    text += "# TYPE lnrc_blocks_dead gauge\n";
+    metrics_line(text, "lnrc_blocks_dead %lu\n", (unsigned long)dead);
+    text += "# HELP lnrc_ring_occupancy Blocks between the tail and the head of the ring.\n";
+    text += "# TYPE lnrc_ring_occupancy gauge\n";
+    metrics_line(text, "lnrc_ring_occupancy %lu\n", (unsigned long)(head - tail));
+    text += "# HELP lnrc_ring_size Blocks of the ring.\n";
+    text += "# TYPE lnrc_ring_size gauge\n";
+    metrics_line(text, "lnrc_ring_size %lu\n", (unsigned long)MAX_BLOCK);
+
+    text += "# HELP lnrc_blocks_dead_total Blocks lost by their worker.\n";
+    text += "# TYPE lnrc_blocks_dead_total counter\n";
+    metrics_line(text, "lnrc_blocks_dead_total %lu\n", (unsigned long)dead_total);
+    text += "# HELP lnrc_blocks_redispatched_total Parts of lost blocks dispatched again.\n";
+    text += "# TYPE lnrc_blocks_redispatched_total counter\n";
+    metrics_line(text, "lnrc_blocks_redispatched_total %lu\n", (unsigned long)redispatch_total);
+    text += "# HELP lnrc_blocks_duplicated_total Late blocks given to a second worker.\n";
+    text += "# TYPE lnrc_blocks_duplicated_total counter\n";
+    metrics_line(text, "lnrc_blocks_duplicated_total %lu\n", (unsigned long)duplicate_total);
+    text += "# HELP lnrc_blocks_cancelled_total Workers cancelled by the other worker of their block.\n";
+    text += "# TYPE lnrc_blocks_cancelled_total counter\n";
+    metrics_line(text, "lnrc_blocks_cancelled_total %lu\n", (unsigned long)cancel_total);
+    text += "# HELP lnrc_workers_hung_total Workers silent for longer than the progress timeout.\n";
+    text += "# TYPE lnrc_workers_hung_total counter\n";
+    metrics_line(text, "lnrc_workers_hung_total %lu\n", (unsigned long)hung_total);
+    text += "# HELP lnrc_salvaged_total Numbers of dead blocks done before their worker died, not dispatched again.\n";
+    text += "# TYPE lnrc_salvaged_total counter\n";
+    metrics_line(text, "lnrc_salvaged_total %.0f\n", (double)salvage_total);
+
+    text += "# HELP lnrc_done_total Numbers verified, bytes of the list with -psp.\n";
+    text += "# TYPE lnrc_done_total counter\n";
+    metrics_line(text, "lnrc_done_total %.0f\n", (double)done_count);
+    text += "# HELP lnrc_results_total Results reported by the workers.\n";
+    text += "# TYPE lnrc_results_total counter\n";
+    metrics_line(text, "lnrc_results_total{type=\"pseudoprime\"} %lu\n", (unsigned long)pseudoprime_count);
+    metrics_line(text, "lnrc_results_total{type=\"pseudocomposite\"} %lu\n", (unsigned long)pseudocomposite_count);
+    metrics_line(text, "lnrc_results_total{type=\"b1\"} %lu\n", (unsigned long)b1_count);
+    text += "# HELP lnrc_results_dropped_total Results sent again for a block, by a worker cancelled or dead, or past the "
+            "progress of a salvaged block.\n";
+    text += "# TYPE lnrc_results_dropped_total counter\n";
+    metrics_line(text, "lnrc_results_dropped_total %lu\n", (unsigned long)drop_total);
+
+    // from the events to the group commit and its replies, the idle wait excluded
+    text += "# HELP lnrc_loop_seconds Time of an iteration of the event loop.\n";
+    text += "# TYPE lnrc_loop_seconds summary\n";
+    metrics_line(text, "lnrc_loop_seconds_sum %.9f\n", loop_ticks * tick);
+    metrics_line(text, "lnrc_loop_seconds_count %lu\n", (unsigned long)loop_count);
+    text += "# HELP lnrc_loop_seconds_max Longest iteration since the previous scrape.\n";
+    text += "# TYPE lnrc_loop_seconds_max gauge\n";
+    metrics_line(text, "lnrc_loop_seconds_max %.9f\n", loop_ticks_max * tick);
+    loop_ticks_max = 0;
+}
+
+// connections of the epoll loop, by socket descriptor
+static tlv_conn_t **sockets = 0;
+static int sockets_size = 0;
+static tlv_frame_t job_frame;
+static tlv_frame_t assign_frame; // SEED, COUNT and GO of a work unit
+static tlv_frame_t batch_tlv;    // one tlv of a TLV_BATCH from a client
+
+// connections with replies on hold until the checkpoint journal is synced
+static std::vector<int> held;
+
+static tlv_conn_t *socket_conn(int s)
+{
+    return s >= 0 && s < sockets_size ? sockets[s] : 0;
+}
+
+static void socket_hold(tlv_conn_t *c)
+{
+    if (c->hold && c->out_commit == c->out_len)
+    {
+        held.push_back(c->s);
+    }
+}
+
+static int socket_write(int s, uint16_t cid, uint8_t type, uint128_t value)
+{
+    tlv_conn_t *c = socket_conn(s);
+    if (!c)
+    {
+        return -1;
+    }
+    socket_hold(c);
+    return tlv_conn_write(c, cid, type, value);
+}
+
+static int socket_write_frame(int s, const tlv_frame_t *f)
+{
+    tlv_conn_t *c = socket_conn(s);
+    if (!c)
+    {
+        return -1;
+    }
+    socket_hold(c);
+    return tlv_conn_write_frame(c, f);
+}
+
+static int socket_add(int epfd, int s)
+{
+    if (s >= sockets_size)
+    {
+        int n = sockets_size ? sockets_size : 1024;
+        while (n <= s)
+        {
+            n *= 2;
+        }
+        tlv_conn_t **p = (tlv_conn_t **)realloc(sockets, n * sizeof(tlv_conn_t *));
+        if (!p)
+        {
+            return -1;
+        }
+        memset(p + sockets_size, 0, (n - sockets_size) * sizeof(tlv_conn_t *));
+        sockets = p;
+        sockets_size = n;
+    }
+    sockets[s] = tlv_conn_create(s);
+    if (!sockets[s])
+    {
+        return -1;
+    }
+    sockets[s]->hold = checkpoint_enabled();
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = s;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        tlv_conn_destroy(sockets[s]);
+        sockets[s] = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// close all connections related to socket s, and the socket
+static void socket_close(int s)
+{
+    set_broken_socket(s);
+    if (socket_conn(s))
+    {
+        tlv_conn_destroy(sockets[s]);
+        sockets[s] = 0;
+    }
+    close(s); // removed from the epoll set
+}
+
+static void set_state(unsigned cid, unsigned state)
+{
+    idle_count -= connections[cid].state == STATE_IDLE;
+    idle_count += state == STATE_IDLE;
+    connections[cid].state = state;
+}
+
+// next job of a file of candidates, 0 or a write error
+static int send_job(unsigned cid)
+{
+    int rc = jobs_assign(cid, &job_frame);
+    if (rc > 0)
+    {
+        set_state(cid, STATE_RUNNING);
+        return socket_write_frame(connections[cid].s, &job_frame);
+    }
+    if (rc == 0)
+    {
+        set_state(cid, STATE_IDLE);
+        return 0;
+    }
+    set_state(cid, STATE_UNUSED);
+    return socket_write(connections[cid].s, cid, TLV_STOP, 0);
+}
+
+// SEED, COUNT and GO of the block index to cid
+static int send_assignment(unsigned cid, uint64_t index)
+{
+    int rc, i = connections[cid].s;
+    progress_t *pg = &progress[index % MAX_BLOCK];
+    set_state(cid, STATE_RUNNING);
+    connections[cid].progress = index;
+    connections[cid].t_start = __rdtsc();
+    connections[cid].t_progress = connections[cid].t_start;
+    connections[cid].count = pg->count;
+    if (connections[cid].batch)
+    {
+        // one frame, one write
+        tlv_batch_init(&assign_frame, cid);
+        rc = tlv_batch_add(&assign_frame, cid, TLV_SEED, pg->seed);
+        rc = rc < 0 ? rc : tlv_batch_add(&assign_frame, cid, TLV_COUNT, pg->count);
+        rc = rc < 0 ? rc : tlv_batch_add(&assign_frame, cid, TLV_GO, 0);
+        rc = rc < 0 ? rc : socket_write_frame(i, &assign_frame);
+    }
+    else
+    {
+        rc = socket_write(i, cid, TLV_SEED, pg->seed);
+        rc = rc < 0 ? rc : socket_write(i, cid, TLV_COUNT, pg->count);
+        rc = rc < 0 ? rc : socket_write(i, cid, TLV_GO, 0);
+    }
+    return rc;
+}
+
+// the block index, already running, to cid too, the first TLV_READY wins
+static int send_duplicate(unsigned cid, uint64_t index)
+{
+    progress_t *pg = &progress[index % MAX_BLOCK];
+    pg->dup_cid = cid;
+    duplicate_total++;
+    printf("Duplicate block of cid %u to cid %u\n", pg->cid, cid);
+    fflush(stdout);
+    return send_assignment(cid, index);
+}
+
+// the block of cid is done by another worker, cid abandons it and asks for the next one
+static void block_cancel(unsigned cid, uint64_t index)
+{
+    if (cid == MAX_CID || connections[cid].progress != index || connections[cid].state != STATE_RUNNING)
+        return;
+    set_state(cid, STATE_PENDING);
+    cancel_total++;
+    printf("Cancel cid %u\n", cid);
+    fflush(stdout);
+    if (connections[cid].cancel)
+    {
+        socket_write(connections[cid].s, cid, TLV_STOP, TLV_STOP_CANCEL);
+    }
+}
+
+// a result counts once for its block : both workers of a duplicated block send it, and a worker
+// cancelled, hung or timed out may still send the results it has. It is held until the block is done.
+static void block_result(unsigned cid, uint8_t type, uint128_t v)
+{
+    uint64_t index = connections[cid].progress;
+    if (jobs_enabled() || connections[cid].state != STATE_RUNNING || !index ||
+        progress[index % MAX_BLOCK].state != STATE_RUNNING)
+    {
+        drop_total++;
+        return;
+    }
+    block_results_t *br = &block_results[index];
+    if (!br->seen.insert(std::make_pair(type, v)).second)
+    {
+        drop_total++;
+        return;
+    }
+    held_result_t r;
+    r.cid = cid;
+    r.type = type;
+    r.covered = false;
+    r.v = v;
+    br->held.push_back(r);
+}
+
+// the results of cid received before its TLV_PROGRESS are part of the seeds done
+static void block_cover(unsigned cid, uint64_t index)
+{
+    std::map<uint64_t, block_results_t>::iterator it = block_results.find(index);
+    if (it == block_results.end())
+        return;
+    for (size_t k = 0; k < it->second.held.size(); k++)
+    {
+        it->second.held[k].covered |= it->second.held[k].cid == cid;
+    }
+}
+
+// next block after TLV_READY, the worker is idle while the end of a list is running elsewhere
+static int send_block(unsigned cid)
+{
+    int rc;
+    uint128_t v_seed;
+    uint64_t v_count, current_t, current_p, index;
+
+    if (!blocks_dead() && get_duplicate(cid, &index, false))
+    {
+        return send_duplicate(cid, index);
+    }
+    if (!get_next(&v_seed, &v_count, connections[cid].rate))
+    {
+        if (get_duplicate(cid, &index, true))
+        {
+            return send_duplicate(cid, index);
+        }
+        if (blocks_running())
+        {
+            set_state(cid, STATE_IDLE);
+            return 0;
+        }
+        printf("All blocks done\n");
+        fflush(stdout);
+        set_state(cid, STATE_UNUSED);
+        return socket_write(connections[cid].s, cid, TLV_STOP, 0);
+    }
+    current_t = __rdtsc();
+    current_p = head % MAX_BLOCK;
+    progress[current_p].seed = v_seed;
+    progress[current_p].count = v_count;
+    progress[current_p].done = 0;
+    progress[current_p].t_start = current_t;
+    progress[current_p].expected_t_end = v_count * connections[cid].rate + current_t;
+    progress[current_p].cid = cid;
+    progress[current_p].dup_cid = MAX_CID;
+    progress[current_p].state = STATE_RUNNING;
+    checkpoint(head, v_seed, v_count);
+    head++; // the block is in the ring, dead if the connection is lost
+    rc = send_assignment(cid, head - 1);
+    if (rc < 0)
+    {
+        return rc;
+    }
+    display_progress();
+    return 0;
+}
+
+// one message from a worker or a proxy, -1 when the socket is broken
+static int server_message(int i, const tlv_frame_t *frame)
+{
+    int rc = 0, j;
+    uint8_t t = frame->type;
+    uint16_t cid = frame->cid;
+    uint128_t v = tlv_frame_value(frame);
+    uint64_t current_t;
+
+    switch (t)
+    {
+    case TLV_NEW:
+        for (j = 0; j < MAX_CID; j++)
+        {
+            if (connections[j].state == STATE_UNUSED)
+            {
+                current_t = __rdtsc();
+                connections[j].state = STATE_PENDING;
+                connections[j].s = i;
+                connections[j].rate = RATE * 20;
+                connections[j].progress = 0;
+                connections[j].t_connect = current_t;
+                connections[j].batch = v >= TLV_VERSION_BATCH;
+                connections[j].cancel = v >= TLV_VERSION_CANCEL;
+                connections[j].heartbeat = v >= TLV_VERSION_PROGRESS;
+                rc = socket_write(i, j, TLV_NEW, TLV_VERSION_PROGRESS);
+                printf("New cid %d\n", connections[j].cid);
+                break;
+            }
+        }
+        break;
+    case TLV_STOP:
+        if (!jobs_enabled())
+        {
+            block_release(cid);
+        }
+        jobs_release(cid);
+        set_state(cid, STATE_UNUSED);
+        connections[cid].progress = 0;
+        break;
+    case TLV_READY:
+        if (jobs_enabled())
+        {
+            rc = send_job(cid);
+            break;
+        }
+        if (connections[cid].progress &&
+            (connections[cid].state == STATE_RUNNING || connections[cid].state == STATE_DEAD))
+        {
+            // a worker back after a hung or a timeout is measured too, its block is lost
+            progress_t *pg = &progress[connections[cid].progress % MAX_BLOCK];
+            current_t = __rdtsc();
+            connections[cid].rate = (current_t - connections[cid].t_start) / connections[cid].count;
+            connections[cid].rate += !connections[cid].rate; // a block shorter than a tick per seed
+            if (connections[cid].state == STATE_RUNNING && pg->state == STATE_RUNNING)
+            {
+                // the first worker of a duplicated block wins
+                pg->state = STATE_DONE;
+                done_count += pg->count;
+                block_commit(connections[cid].progress, true);
+                checkpoint(connections[cid].progress, 0, 0);
+                block_cancel(pg->cid == cid ? pg->dup_cid : pg->cid, connections[cid].progress);
+            }
+        }
+        else if (connections[cid].state != STATE_PENDING || !connections[cid].progress)
+        {
+            connections[cid].rate = RATE * 20; // a cancelled worker keeps its rate
+        }
+        rc = send_block(cid);
+        break;
+    case TLV_PROGRESS:
+        // the seeds up to v are done and their results received
+        if (!jobs_enabled() && connections[cid].state == STATE_RUNNING && connections[cid].progress)
+        {
+            progress_t *pg = &progress[connections[cid].progress % MAX_BLOCK];
+            connections[cid].t_progress = __rdtsc();
+            if (pg->state == STATE_RUNNING && lll.sequential() && v > pg->seed)
+            {
+                // the last line of a unit of a list ends after the unit
+                uint64_t done = v - pg->seed < pg->count ? (uint64_t)(v - pg->seed) : pg->count;
+                pg->done = done > pg->done ? done : pg->done;
+                block_cover(cid, connections[cid].progress);
+            }
+        }
+        break;
+    case TLV_PSEUDOPRIME:
+    case TLV_PSEUDOCOMPOSITE:
+    case TLV_B1:
+        block_result(cid, t, v);
+        break;
+    case TLV_VERDICT:
+        jobs_verdict(cid, frame);
+        break;
+    case TLV_BATCH:
+    {
+        // the tlvs of the batch, in order, a batch in a batch is invalid
+        uint32_t pos = 0;
+        while ((rc = tlv_batch_next(frame, &pos, &batch_tlv)) > 0)
+        {
+            if (batch_tlv.type == TLV_BATCH || batch_tlv.cid >= MAX_CID)
+            {
+                return -1;
+            }
+            rc = server_message(i, &batch_tlv);
+            if (rc < 0)
+            {
+                break;
+            }
+        }
+        break;
+    }
+    case TLV_SEED:
+    case TLV_COUNT:
+    default:
+        break;
+    }
+    return rc;
+}
+
+#define MAX_EVENTS 256
+
 void *server_thread(void *arg)
 {
-    int max_sd = 0, listen_sd = 0, conn_sd = 0;
-    int rc, i, j;
+    int listen_sd = 0, conn_sd = 0;
+    int epfd, rc, i, j, k, n;
     struct sockaddr_in serv_addr;
-    fd_set read_sds, master_sds, except_sds;
-    struct timeval timeout;
-    uint64_t current_t;
-    uint64_t current_p;
+    struct epoll_event ev, events[MAX_EVENTS];
+    tlv_frame_t frame;
+
+    time_t idle_check = 0;
 
     connections_init();
+    tlv_frame_init(&frame);
+    tlv_frame_init(&job_frame);
+    tlv_frame_init(&assign_frame);
+    tlv_frame_init(&batch_tlv);
+
+    // the blocks of a previous run are dispatched again first
+    for (size_t b = 0; b < resume_blocks.size(); b++)
+    {
+        progress_t *pg = &progress[head % MAX_BLOCK];
+        pg->seed = resume_blocks[b].seed;
+        pg->count = resume_blocks[b].count;
+        pg->done = 0;
+        pg->cid = MAX_CID;
+        pg->dup_cid = MAX_CID;
+        pg->state = STATE_DEAD;
+        head++;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // one socket per worker, or per proxy
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+    {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
 
     listen_sd = socket(AF_INET, SOCK_STREAM, 0);
     memset(&serv_addr, '0', sizeof(serv_addr));
@@ -315,223 +1065,194 @@ void *server_thread(void *arg)
     {
         perror("bind");
     }
-    rc = listen(listen_sd, 10);
+    rc = listen(listen_sd, 1024);
     if (rc < 0)
     {
         perror("listen");
     }
+    fcntl(listen_sd, F_SETFL, fcntl(listen_sd, F_GETFL, 0) | O_NONBLOCK);
 
-    FD_ZERO(&master_sds);
-    FD_SET(listen_sd, &master_sds);
-    max_sd = listen_sd;
+    epfd = epoll_create1(0);
+    if (epfd < 0)
+    {
+        perror("epoll_create1");
+        exit(1);
+    }
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.fd = listen_sd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_sd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        exit(1);
+    }
+    if (metrics_port > 0)
+    {
+        metrics_setup(epfd, (unsigned short)metrics_port, server_metrics);
+    }
 
     while (1)
     {
         set_timeout();
-        memcpy(&read_sds, &master_sds, sizeof(read_sds));
-        memcpy(&except_sds, &master_sds, sizeof(except_sds));
-        timeout.tv_sec = 3 * 60;
-        timeout.tv_usec = 0;
-        rc = select(max_sd + 1, &read_sds, NULL, &except_sds, &timeout);
-        if (rc < 0)
-        {
-            perror("select");
+        set_hung();
+        metrics_expire();
+        if (jobs_enabled() && idle_count && jobs_timeout())
+        {
+            // jobs lost or timed out to the idle workers
+            for (j = 0; j < MAX_CID && idle_count; j++)
+            {
+                if (connections[j].state == STATE_IDLE && send_job(j) < 0)
+                {
+                    socket_close(connections[j].s);
+                }
+            }
+        }
+        // the timeouts and the hung workers are checked each second
+        n = epoll_wait(epfd, events, MAX_EVENTS, 1000);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("epoll_wait");
             exit(1);
         }
-        if (rc > 0)
+        uint64_t t_loop = __rdtsc();
+        for (k = 0; k < n; k++)
         {
-            for (i = 0; i <= max_sd; i++)
+            i = events[k].data.fd;
+            if (metrics_socket(i))
             {
-                if (FD_ISSET(i, &except_sds))
+                metrics_event(i, events[k].events);
+                continue;
+            }
+            if (i == listen_sd)
+            {
+                if (events[k].events & (EPOLLERR | EPOLLHUP))
                 {
-                    if (i == listen_sd)
-                    {
-                        printf("Exception listen socket %d\n", i);
-                        fflush(stdout);
-                        exit(1);
-                    }
-                    printf("Exception connection %d\n", i);
+                    printf("Exception listen socket %d\n", i);
                     fflush(stdout);
-                    set_broken_socket(i);
-                    FD_CLR(i, &master_sds);
-                    FD_CLR(i, &read_sds);
-                    close(i);
+                    exit(1);
                 }
-            }
-            for (i = 0; i <= max_sd; i++)
-            {
-                if (FD_ISSET(i, &read_sds))
+                // edge-triggered, accept all the pending connections
+                while (1)
                 {
-                    if (i == listen_sd)
+                    struct sockaddr_in peer_addr;
+                    socklen_t peer_addr_size;
+                    char peer_name[INET_ADDRSTRLEN];
+
+                    peer_addr_size = sizeof(struct sockaddr_in);
+                    memset(&peer_addr, 0, peer_addr_size);
+                    conn_sd = accept(listen_sd, (struct sockaddr *)&peer_addr, &peer_addr_size);
+                    if (conn_sd < 0)
                     {
-                        struct sockaddr_in peer_addr;
-                        socklen_t peer_addr_size;
-                        char peer_name[INET_ADDRSTRLEN];
-
-                        peer_addr_size = sizeof(struct sockaddr_in);
-                        memset(&peer_addr, 0, peer_addr_size);
-                        conn_sd = accept(listen_sd, (struct sockaddr *)&peer_addr, &peer_addr_size);
-                        if (conn_sd < 0)
+                        if (errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
                         {
-                            if (errno != EWOULDBLOCK)
-                            {
-                                goto err;
-                            }
-                            continue;
+                            perror("accept");
                         }
-                        FD_SET(conn_sd, &master_sds);
-                        if (conn_sd > max_sd)
+                        if (errno == EINTR || errno == ECONNABORTED)
                         {
-                            max_sd = conn_sd;
+                            continue;
                         }
-                        inet_ntop(AF_INET, &peer_addr.sin_addr, peer_name, INET_ADDRSTRLEN);
-                        printf("New connection %d from %s\n", conn_sd, peer_name);
-                        fflush(stdout);
+                        break;
                     }
-                    else
+                    if (socket_add(epfd, conn_sd) < 0)
                     {
-                        uint8_t t;
-                        uint128_t v, v_seed;
-                        uint64_t v_count;
-                        uint16_t cid;
-                        int n = 0;
-                        rc = ioctl(i, FIONREAD, &n);
-                        if (rc < 0)
-                        {
-                            printf("Broken connection %d\n", i);
-                            fflush(stdout);
-                        }
-                        else if (n == 0)
-                        {
-                            if (is_closed_socket(i))
-                            {
-                                printf("Closed connection %d\n", i);
-                                fflush(stdout);
-                                rc = -1;
-                            }
-                            else
-                            {
-                                continue;
-                            }
-                        }
-                        else
-                        {
-                            rc = tlv_read(i, &cid, &t, &v);
-                            if (rc < 0)
-                            {
-                                printf("Invalid read on connection %d\n", i);
-                                fflush(stdout);
-                            }
-                        }
-                        if (rc < 0)
-                        {
-                            set_broken_socket(i);
-                            FD_CLR(i, &master_sds);
-                            close(i);
-                            continue;
-                        }
-                        switch (t)
-                        {
-                        case TLV_NEW:
-                            for (j = 0; j < MAX_CID; j++)
-                            {
-                                if (connections[j].state == STATE_UNUSED)
-                                {
-                                    current_t = __rdtsc();
-                                    connections[j].state = STATE_PENDING;
-                                    connections[j].s = i;
-                                    connections[j].rate = RATE * 20;
-                                    connections[j].progress = 0;
-                                    connections[j].t_connect = current_t;
-                                    rc = tlv_write(i, j, TLV_NEW, 0);
-                                    printf("New cid %d\n", connections[j].cid);
-                                    if (rc < 0)
-                                    {
-                                        set_broken_socket(i);
-                                        FD_CLR(i, &master_sds);
-                                        close(i);
-                                    }
-                                    break;
-                                }
-                            }
-                            break;
-                        case TLV_STOP:
-                            if (connections[cid].state == STATE_RUNNING)
-                            {
-                                progress[connections[cid].progress % MAX_BLOCK].state = STATE_DEAD;
-                            }
-                            connections[cid].state = STATE_UNUSED;
-                            connections[cid].progress = 0;
-                            break;
-                        case TLV_READY:
-                            if (connections[cid].progress && connections[cid].state == STATE_RUNNING)
-                            {
-                                progress_t *pg = &progress[connections[cid].progress % MAX_BLOCK];
-                                current_t = __rdtsc();
-                                connections[cid].rate = (current_t - pg->t_start) / pg->count;
-                                pg->state = STATE_DONE;
-                                done_count += pg->count;
-                            }
-                            else
-                            {
-                                connections[cid].rate = RATE * 20;
-                            }
-                            get_next(&v_seed, &v_count, connections[cid].rate);
-                            current_t = __rdtsc();
-                            current_p = head % MAX_BLOCK;
-                            progress[current_p].seed = v_seed;
-                            progress[current_p].count = v_count;
-                            progress[current_p].t_start = current_t;
-                            progress[current_p].expected_t_end = v_count * connections[cid].rate + current_t;
-                            progress[current_p].cid = cid;
-                            progress[current_p].state = STATE_RUNNING;
-                            connections[cid].state = STATE_RUNNING;
-                            connections[cid].progress = head;
-                            rc = tlv_write(i, cid, TLV_SEED, progress[current_p].seed);
-                            rc = rc < 0 ? rc : tlv_write(i, cid, TLV_COUNT, progress[current_p].count);
-                            rc = rc < 0 ? rc : tlv_write(i, cid, TLV_GO, 0);
-                            if (rc < 0)
-                            {
-                                set_broken_socket(i);
-                                FD_CLR(i, &master_sds);
-                                close(i);
-                                continue;
-                            }
-                            head++;
-                            display_progress();
-                            break;
-                        case TLV_PSEUDOPRIME:
-                            report("Pseudoprime", v);
-                            break;
-                        case TLV_PSEUDOCOMPOSITE:
-                            report("Pseudocomposite", v);
-                            break;
-                        case TLV_B1:
-                            report("B == 1", v);
-                            break;
-                        case TLV_SEED:
-                        case TLV_COUNT:
-                        default:
-                            break;
-                        }
+                        close(conn_sd);
+                        continue;
+                    }
+                    inet_ntop(AF_INET, &peer_addr.sin_addr, peer_name, INET_ADDRSTRLEN);
+                    printf("New connection %d from %s\n", conn_sd, peer_name);
+                    fflush(stdout);
+                }
+                continue;
+            }
+
+            tlv_conn_t *c = socket_conn(i);
+            if (!c)
+            {
+                continue; // closed by a previous event
+            }
+            if ((events[k].events & EPOLLOUT) && tlv_conn_flush(c) < 0)
+            {
+                printf("Broken connection %d\n", i);
+                fflush(stdout);
+                socket_close(i);
+                continue;
+            }
+            if (!(events[k].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+            {
+                continue;
+            }
+            // the complete frames are processed before a close, a buffer at a time
+            int closed;
+            do
+            {
+                closed = tlv_conn_fill(c);
+                while ((rc = tlv_conn_next(c, &frame)) > 0)
+                {
+                    if (frame.cid >= MAX_CID)
+                    {
+                        rc = -1;
+                        break;
+                    }
+                    if (server_message(i, &frame) < 0)
+                    {
+                        closed = -1;
+                        break;
                     }
                 }
+            } while (closed > 0 && rc == 0);
+            if (rc < 0)
+            {
+                printf("Invalid read on connection %d\n", i);
+                fflush(stdout);
+                closed = -1;
+            }
+            else if (closed < 0)
+            {
+                printf("Closed connection %d\n", i);
+                fflush(stdout);
+            }
+            if (closed < 0)
+            {
+                socket_close(i);
             }
         }
-    }
 
-err:
-    for (i = 0; i < max_sd; i++)
-    {
-        if (FD_ISSET(i, &master_sds))
+        time_t now = time(NULL);
+        if (!jobs_enabled() && idle_count && (blocks_pending() || now != idle_check))
+        {
+            // blocks lost meanwhile, late ones, or a TLV_STOP, to the idle workers
+            idle_check = now;
+            for (j = 0; j < MAX_CID && idle_count; j++)
+            {
+                if (connections[j].state == STATE_IDLE && send_block(j) < 0)
+                {
+                    socket_close(connections[j].s);
+                }
+            }
+        }
+
+        // group commit, one fsync for the whole batch, then the replies, the result lines of a
+        // block are durable before the block is journaled as done
+        report_flush();
+        checkpoint_sync();
+        for (size_t h = 0; h < held.size(); h++)
         {
-            if (i != listen_sd)
-                tlv_write(i, 0, TLV_STOP, 0);
-            FD_CLR(i, &master_sds);
-            close(i);
+            tlv_conn_t *c = socket_conn(held[h]);
+            if (c && tlv_conn_commit(c) < 0)
+            {
+                socket_close(held[h]);
+            }
         }
+        held.clear();
+
+        uint64_t t_end = __rdtsc() - t_loop;
+        loop_ticks += t_end;
+        loop_count++;
+        loop_ticks_max = t_end > loop_ticks_max ? t_end : loop_ticks_max;
     }
-    max_sd = 0;
     return 0;
 }
 
@@ -544,6 +1265,12 @@ int main(int argc, char **argv)
     bool start_proxy = false;
     bool start_client = false;
     unsigned short port = SERVER_PORT;
+    const char *job_file = 0;
+    unsigned job_timeout = 3600;
+    bool resume = true;
+    bool start_local = false;
+    uint128_t range_first = 3, range_last = 0;
+    const char *list_file = 0;
 
     strcpy(server, "127.0.0.1");
 
@@ -570,6 +1297,27 @@ int main(int argc, char **argv)
             scan128(argv[++i], &done_count);
             lll.set_seed(INIT_SEED);
             lll.get_seed(convert_number_to_seed(done_count));
+            resume = false;
+            continue;
+        }
+        if (!strcmp(argv[i], "-j"))
+        {
+            job_file = argv[++i];
+            continue;
+        }
+        if (!strcmp(argv[i], "-psp"))
+        {
+            list_file = argv[++i];
+            continue;
+        }
+        if (!strcmp(argv[i], "-metrics"))
+        {
+            metrics_port = atol(argv[++i]);
+            continue;
+        }
+        if (!strcmp(argv[i], "-jt"))
+        {
+            job_timeout = atol(argv[++i]);
             continue;
         }
         if (!strcmp(argv[i], "-server"))
@@ -582,21 +1330,94 @@ int main(int argc, char **argv)
             start_proxy = true;
             continue;
         }
+        if (!strcmp(argv[i], "-mr"))
+        {
+            inner_setup(true);
+            continue;
+        }
+        if (!strcmp(argv[i], "-local"))
+        {
+            start_local = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "-range") && i + 2 < (long)argc)
+        {
+            scan128(argv[++i], &range_first);
+            scan128(argv[++i], &range_last);
+            continue;
+        }
         if (!strcmp(argv[i], "-st"))
         {
-            printf("self-test %s\n", (inner_self_test() == 0) ? "passed" : "failed");
+            printf("self-test %s\n", (inner_self_test() == 0 && psp_list_self_test() == 0) ? "passed" : "failed");
             exit(1);
         }
         if (!strcmp(argv[i], "-h"))
         {
             printf("Usage %s -s remote_server -p remote_port [-t client_thread_count] [-e next] [-server] [-proxy]\n",
                    argv[0]);
+            printf("      (-server without -e resumes from lnrc.journal)\n");
+            printf("      %s -server [-p port] -j candidates_file [-jt job_timeout_seconds]\n", argv[0]);
+            printf("      (jobs are tested by workers \"quadratic -t thread_count --worker server port\")\n");
+            printf("      %s -local [-t thread_count] -range first last\n", argv[0]);
+            printf("      %s -server [-e offset] -psp list_file, and workers with the same -psp list_file\n", argv[0]);
+            printf("      (a list of base-2 pseudoprimes, one number per line, journal lnrc.psp.journal)\n");
+            printf("      (-metrics port : text metrics of the server on 127.0.0.1, default port + %d, 0 for none)\n",
+                   METRICS_PORT_OFFSET);
+            printf("      (-mr : Miller-Rabin cross-check of the sieve in the client threads)\n");
             exit(1);
         }
     }
 
+    if (metrics_port < 0)
+    {
+        metrics_port = port + METRICS_PORT_OFFSET;
+    }
+
+    if (start_local)
+    {
+        exit(local_run(t, range_first, range_last) < 0 ? 1 : 0);
+    }
+
+    if (list_file)
+    {
+        uint64_t list_size;
+        if (psp_list_open(list_file, &list_size) < 0)
+        {
+            exit(1);
+        }
+        // the seeds are offsets in the list, -e is the first offset
+        end_seed = list_size;
+        lll.set_seed(done_count);
+    }
+
     if (start_server)
     {
+        if (job_file && jobs_setup(job_file, job_timeout) < 0)
+        {
+            exit(1);
+        }
+        if (!job_file)
+        {
+            checkpoint_state_t state;
+            state.next_seed = lll.get_seed(0);
+            state.done_count = done_count;
+            state.pseudoprimes = state.pseudocomposites = state.b1 = 0;
+            const char *journal = list_file ? "lnrc.psp.journal" : "lnrc.journal";
+            if (checkpoint_open(journal, resume, MAX_CID, &state, &resume_blocks))
+            {
+                lll.set_seed(state.next_seed);
+                done_count = state.done_count;
+                pseudoprime_count = state.pseudoprimes;
+                pseudocomposite_count = state.pseudocomposites;
+                b1_count = state.b1;
+                printf("Resumed from %s, %lu blocks to do again\n", journal, (unsigned long)resume_blocks.size());
+                print128("Next", list_file ? lll.get_seed(0) : convert_seed_to_number(lll.get_seed(0)));
+            }
+        }
+        if (report_setup("lnrc.log") < 0)
+        {
+            exit(1);
+        }
         printf("Starting server ....\n");
         server_port = port;
         pthread_create(&tid, 0, server_thread, 0);
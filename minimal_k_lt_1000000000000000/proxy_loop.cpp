@@ -1,6 +1,7 @@
 
-#include <poll.h>
+#include <fcntl.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -11,7 +12,7 @@
 #include <errno.h>
 #include <netdb.h>
 #include <netinet/in.h>
-#include <sys/ioctl.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
@@ -35,25 +36,6 @@ void proxy_setup(const char *local_addr, unsigned short local_port, const char *
     server_port = remote_port;
 }
 
-static bool closed_socket(int fd)
-{
-    struct pollfd pfd;
-    int ret;
-
-    pfd.fd = fd;
-    pfd.events = POLLRDHUP;
-    pfd.revents = 0;
-    ret = poll(&pfd, 1, 0);
-    if (ret > 0 && (pfd.revents & (POLLHUP | POLLERR | POLLRDHUP)))
-    {
-        return true;
-    }
-    else
-    {
-        return false;
-    }
-}
-
 static int proxy_connect(void)
 {
     int server_sd;
@@ -109,23 +91,106 @@ typedef struct new_conn_s
 #define MAX_NEW_CONN 300
 static new_conn_t new_conn[MAX_NEW_CONN];
 
+// client connections of the epoll loop, by socket descriptor
+static tlv_conn_t **sockets = 0;
+static int sockets_size = 0;
+
+static tlv_conn_t *proxy_conn(int s)
+{
+    return s >= 0 && s < sockets_size ? sockets[s] : 0;
+}
+
+static int proxy_add(int epfd, int s)
+{
+    if (s >= sockets_size)
+    {
+        int n = sockets_size ? sockets_size : 1024;
+        while (n <= s)
+        {
+            n *= 2;
+        }
+        tlv_conn_t **p = (tlv_conn_t **)realloc(sockets, n * sizeof(tlv_conn_t *));
+        if (!p)
+        {
+            return -1;
+        }
+        memset(p + sockets_size, 0, (n - sockets_size) * sizeof(tlv_conn_t *));
+        sockets = p;
+        sockets_size = n;
+    }
+    sockets[s] = tlv_conn_create(s);
+    if (!sockets[s])
+    {
+        return -1;
+    }
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = s;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        tlv_conn_destroy(sockets[s]);
+        sockets[s] = 0;
+        return -1;
+    }
+    return 0;
+}
+
+// close a client connection, the server forgets its cids
+static void proxy_close(int s, tlv_conn_t *server)
+{
+    int j;
+    for (j = 0; j < MAX_CID; j++)
+    {
+        if (proxy[j].in_use == true && proxy[j].s == s)
+        {
+            if (server)
+            {
+                tlv_conn_write(server, j, TLV_STOP, 0);
+            }
+            proxy[j].in_use = false;
+        }
+    }
+    for (j = 0; j < MAX_NEW_CONN; j++)
+    {
+        if (new_conn[j].in_use == true && new_conn[j].s == s)
+        {
+            new_conn[j].in_use = false;
+        }
+    }
+    if (proxy_conn(s))
+    {
+        tlv_conn_destroy(sockets[s]);
+        sockets[s] = 0;
+    }
+    close(s); // removed from the epoll set
+}
+
+#define MAX_EVENTS 256
+
 void *proxy_thread(void *arg)
 {
-    int max_sd = 0, listen_sd = 0, conn_sd = 0, server_sd = -1;
-    int rc, i, j;
+    int listen_sd = -1, conn_sd = 0, server_sd = -1, epfd = -1;
+    int rc, i, j, k, n;
     struct sockaddr_in proxy_addr;
-    fd_set read_sds, master_sds, except_sds;
-    struct timeval timeout;
-    uint8_t t;
-    uint128_t v;
+    struct epoll_event ev, events[MAX_EVENTS];
+    tlv_frame_t frame; // forwarded as is, whatever the length of the value
+    tlv_conn_t *server = 0;
     uint16_t cid;
 
+    tlv_frame_init(&frame);
+    signal(SIGPIPE, SIG_IGN);
+
     while (1)
     {
         for (j = 0; j < MAX_NEW_CONN; j++)
         {
             new_conn[j].in_use = false;
         }
+        for (j = 0; j < MAX_CID; j++)
+        {
+            proxy[j].in_use = false;
+        }
 
         /* connect to server */
         server_sd = proxy_connect();
@@ -154,125 +219,102 @@ void *proxy_thread(void *arg)
             perror("bind");
             goto done;
         }
-        rc = listen(listen_sd, 10);
+        rc = listen(listen_sd, 1024);
         if (rc < 0)
         {
             perror("listen");
             goto done;
         }
+        fcntl(listen_sd, F_SETFL, fcntl(listen_sd, F_GETFL, 0) | O_NONBLOCK);
 
-        FD_ZERO(&master_sds);
-        FD_SET(listen_sd, &master_sds);
-        FD_SET(server_sd, &master_sds);
-        max_sd = listen_sd;
-        if (server_sd > max_sd)
+        epfd = epoll_create1(0);
+        server = tlv_conn_create(server_sd);
+        if (epfd < 0 || !server)
+        {
+            perror("epoll_create1");
+            goto done;
+        }
+        server->hold = true; // sent at the end of each batch of events
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.fd = listen_sd;
+        rc = epoll_ctl(epfd, EPOLL_CTL_ADD, listen_sd, &ev);
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.fd = server_sd;
+        rc = rc < 0 ? rc : epoll_ctl(epfd, EPOLL_CTL_ADD, server_sd, &ev);
+        if (rc < 0)
         {
-            max_sd = server_sd;
+            perror("epoll_ctl");
+            goto err;
         }
 
         while (1)
         {
-            memcpy(&read_sds, &master_sds, sizeof(read_sds));
-            memcpy(&except_sds, &master_sds, sizeof(except_sds));
-            timeout.tv_sec = 3 * 60;
-            timeout.tv_usec = 0;
-            rc = select(max_sd + 1, &read_sds, NULL, &except_sds, &timeout);
-            if (rc < 0)
+            n = epoll_wait(epfd, events, MAX_EVENTS, 3 * 60 * 1000);
+            if (n < 0)
             {
-                perror("select");
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                perror("epoll_wait");
                 exit(1);
             }
-            if (rc > 0)
+            for (k = 0; k < n; k++)
             {
-                for (i = 0; i <= max_sd; i++)
+                i = events[k].data.fd;
+                if (i == listen_sd)
                 {
-                    if (FD_ISSET(i, &except_sds))
+                    if (events[k].events & (EPOLLERR | EPOLLHUP))
                     {
-                        if (i == server_sd)
-                        {
-                            printf("Proxy: Exception server socket %d\n", i);
-                            fflush(stdout);
-                            goto err;
-                        }
-                        if (i == listen_sd)
-                        {
-                            printf("Proxy: Exception listen socket %d\n", i);
-                            fflush(stdout);
-                            goto err;
-                        }
-                        printf("Proxy: Exception connection %d\n", i);
+                        printf("Proxy: Exception listen socket %d\n", i);
                         fflush(stdout);
-                        for (j = 0; j < MAX_CID; j++)
+                        goto err;
+                    }
+                    // edge-triggered, accept all the pending connections
+                    while ((conn_sd = accept(listen_sd, (struct sockaddr *)NULL, NULL)) >= 0)
+                    {
+                        for (j = 0; j < MAX_NEW_CONN; j++)
                         {
-                            if (proxy[j].in_use == true && proxy[j].s == i)
+                            if (new_conn[j].in_use == false)
                             {
-                                rc = tlv_write(server_sd, j, TLV_STOP, 0);
-                                proxy[j].in_use = false;
+                                break;
                             }
                         }
-                        close(i);
-                        FD_CLR(i, &master_sds);
-                        FD_CLR(i, &read_sds);
+                        if (j == MAX_NEW_CONN || proxy_add(epfd, conn_sd) < 0)
+                        {
+                            close(conn_sd);
+                            continue;
+                        }
+                        new_conn[j].in_use = true;
+                        new_conn[j].s = conn_sd;
+                        printf("Proxy : New connection %d\n", conn_sd);
+                        fflush(stdout);
+                    }
+                    if (errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR && errno != ECONNABORTED)
+                    {
+                        goto err;
                     }
                 }
-
-                for (i = 0; i <= max_sd; i++)
+                else if (i == server_sd)
                 {
-                    if (FD_ISSET(i, &read_sds))
+                    if ((events[k].events & EPOLLOUT) && tlv_conn_flush(server) < 0)
                     {
-                        if (i == listen_sd)
-                        {
-                            conn_sd = accept(listen_sd, (struct sockaddr *)NULL, NULL);
-                            if (conn_sd < 0)
-                            {
-                                if (errno != EWOULDBLOCK)
-                                {
-                                    goto err;
-                                }
-                                continue;
-                            }
-                            for (j = 0; j < MAX_NEW_CONN; j++)
-                            {
-                                if (new_conn[j].in_use == false)
-                                {
-                                    new_conn[j].in_use = true;
-                                    new_conn[j].s = conn_sd;
-                                    break;
-                                }
-                            }
-                            if (j == MAX_NEW_CONN)
-                            {
-                                close(conn_sd);
-                                continue;
-                            }
-
-                            FD_SET(conn_sd, &master_sds);
-                            if (conn_sd > max_sd)
-                            {
-                                max_sd = conn_sd;
-                            }
-                            printf("Proxy : New connection %d\n", conn_sd);
-                            fflush(stdout);
-                        }
-                        else if (i == server_sd)
+                        printf("Proxy : write to server error on connection %d\n", server_sd);
+                        fflush(stdout);
+                        goto err;
+                    }
+                    if (!(events[k].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                    {
+                        continue;
+                    }
+                    int closed;
+                    do
+                    {
+                        closed = tlv_conn_fill(server);
+                        while ((rc = tlv_conn_next(server, &frame)) > 0)
                         {
-                            int n = 0;
-                            rc = ioctl(i, FIONREAD, &n);
-                            if (rc < 0)
-                            {
-                                rc = -1;
-                                printf("Proxy : End connection %d\n", i);
-                                fflush(stdout);
-                            }
-                            else if (n == 0)
-                            {
-                                continue;
-                            }
-                            else
-                            {
-                                rc = tlv_read(i, &cid, &t, &v);
-                            }
-                            if (rc < 0)
+                            cid = frame.cid;
+                            if (cid >= MAX_CID)
                             {
                                 goto err;
                             }
@@ -290,101 +332,102 @@ void *proxy_thread(void *arg)
                                 }
                                 if (j == MAX_NEW_CONN)
                                 {
-                                    rc = tlv_write(i, cid, TLV_STOP, 0);
+                                    tlv_conn_write(server, cid, TLV_STOP, 0);
                                     goto err;
                                 }
                             }
-                            rc = tlv_write(proxy[cid].s, cid, t, v);
-                            if (rc < 0)
+                            tlv_conn_t *c = proxy_conn(proxy[cid].s);
+                            if (!c || tlv_conn_write_frame(c, &frame) < 0)
                             {
                                 printf("Proxy : write to client error on connection %d\n", proxy[cid].s);
                                 fflush(stdout);
-                                for (j = 0; j < MAX_CID; j++)
-                                {
-                                    if (proxy[j].in_use == true && proxy[j].s == proxy[cid].s)
-                                    {
-                                        rc = tlv_write(i, j, TLV_STOP, 0);
-                                        proxy[j].in_use = false;
-                                    }
-                                }
-                                close(proxy[cid].s);
-                                FD_CLR(proxy[cid].s, &master_sds);
+                                proxy_close(proxy[cid].s, server);
                             }
                         }
-                        else
+                    } while (closed > 0 && rc == 0);
+                    if (rc < 0 || closed < 0)
+                    {
+                        printf("Proxy : End connection %d\n", i);
+                        fflush(stdout);
+                        goto err;
+                    }
+                }
+                else
+                {
+                    tlv_conn_t *c = proxy_conn(i);
+                    if (!c)
+                    {
+                        continue; // closed by a previous event
+                    }
+                    if ((events[k].events & EPOLLOUT) && tlv_conn_flush(c) < 0)
+                    {
+                        printf("Proxy : broken connection %d\n", i);
+                        fflush(stdout);
+                        proxy_close(i, server);
+                        continue;
+                    }
+                    if (!(events[k].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+                    {
+                        continue;
+                    }
+                    int closed;
+                    do
+                    {
+                        closed = tlv_conn_fill(c);
+                        while ((rc = tlv_conn_next(c, &frame)) > 0)
                         {
-                            int n = 0;
-                            rc = ioctl(i, FIONREAD, &n);
-                            if (rc < 0)
-                            {
-                                rc = -1;
-                                printf("Proxy : broken connection %d\n", i);
-                                fflush(stdout);
-                            }
-                            else if (n == 0)
-                            {
-                                if (closed_socket(i))
-                                {
-                                    rc = -1;
-                                    printf("Proxy : closed connection %d\n", i);
-                                    fflush(stdout);
-                                }
-                                else
-                                {
-                                    continue;
-                                }
-                            }
-                            else
-                            {
-                                rc = tlv_read(i, &cid, &t, &v);
-                                if (rc < 0)
-                                {
-                                    printf("Proxy : read error on connection %d\n", i);
-                                    fflush(stdout);
-                                }
-                            }
-                            if (rc < 0)
-                            {
-                                for (j = 0; j < MAX_CID; j++)
-                                {
-                                    if (proxy[j].in_use == true && proxy[j].s == i)
-                                    {
-                                        rc = tlv_write(server_sd, j, TLV_STOP, 0);
-                                        proxy[j].in_use = false;
-                                    }
-                                }
-                                close(i);
-                                FD_CLR(i, &master_sds);
-                                continue;
-                            }
-                            rc = tlv_write(server_sd, cid, t, v);
-                            if (rc < 0)
+                            if (tlv_conn_write_frame(server, &frame) < 0)
                             {
                                 printf("Proxy : write to server error on connection %d\n", server_sd);
                                 fflush(stdout);
                                 goto err;
                             }
                         }
+                    } while (closed > 0 && rc == 0);
+                    if (rc < 0)
+                    {
+                        printf("Proxy : read error on connection %d\n", i);
+                        fflush(stdout);
+                        closed = -1;
+                    }
+                    else if (closed < 0)
+                    {
+                        printf("Proxy : closed connection %d\n", i);
+                        fflush(stdout);
+                    }
+                    if (closed < 0)
+                    {
+                        proxy_close(i, server);
                     }
                 }
             }
+
+            // the frames of all the workers of the batch, in one write to the server
+            if (tlv_conn_commit(server) < 0)
+            {
+                printf("Proxy : write to server error on connection %d\n", server_sd);
+                fflush(stdout);
+                goto err;
+            }
         }
 
     err:
-        for (i = 0; i < max_sd; i++)
+        for (i = 0; i < sockets_size; i++)
         {
-            if (FD_ISSET(i, &master_sds))
+            tlv_conn_t *c = proxy_conn(i);
+            if (c)
             {
-                FD_CLR(i, &master_sds);
-                if (i != listen_sd && i != server_sd)
-                {
-                    tlv_write(i, 0, TLV_STOP, 0);
-                }
-                close(i);
+                tlv_conn_write(c, 0, TLV_STOP, 0);
+                proxy_close(i, 0);
             }
         }
     done:
-        max_sd = 0;
+        if (epfd >= 0)
+            close(epfd);
+        epfd = -1;
+        if (server)
+            tlv_conn_destroy(server);
+        server = 0;
         if (listen_sd > 0)
             close(listen_sd);
         listen_sd = -1;
@@ -0,0 +1,199 @@
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "inner_loop.h"
+#include "psp_list.h"
+#include "tlv.h"
+
+#define PSP_LIST_CHUNK 4096 // numbers tested at once, the lanes are filled across lines
+#define PSP_LIST_MAX_BITS 125 // the tests run up to 2^125 (INNER_MAX_BITS)
+
+static const char *text = 0; // the whole file, read only
+static uint64_t text_size = 0;
+
+int psp_list_open(const char *name, uint64_t *size)
+{
+    int fd = open(name, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(name);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        printf("Unable to read %s\n", name);
+        close(fd);
+        return -1;
+    }
+    void *p = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    // a work unit is read once, from the start to the end
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    text = (const char *)p;
+    text_size = st.st_size;
+    *size = text_size;
+    return 0;
+}
+
+bool psp_list_enabled(void)
+{
+    return text != 0;
+}
+
+// the line at *pos, *pos is then the start of the next line : 1 and the number in *v, 0 for a
+// comment or an even number, -1 for a number out of range or followed by something else
+static int psp_list_line(uint64_t *pos, uint128_t *v)
+{
+    const uint128_t max = ((uint128_t)1 << PSP_LIST_MAX_BITS) - 1;
+    uint64_t p = *pos;
+    int rc = 1;
+    *v = 0;
+    while (p < text_size && text[p] != '\n' && isspace(text[p]))
+        p++;
+    if (p >= text_size || !isdigit(text[p]))
+        rc = 0; // comment or empty line
+    while (p < text_size && isdigit(text[p]))
+    {
+        unsigned d = text[p++] - '0';
+        if (*v > (max - d) / 10)
+            rc = -1; // no wrap around, the digits are still skipped
+        else
+            *v = *v * 10 + d;
+    }
+    if (p < text_size && !isspace(text[p]))
+        rc = rc ? -1 : 0;
+    while (p < text_size && text[p] != '\n')
+        p++;
+    *pos = p + 1;
+    return rc > 0 && !(*v & 1) ? 0 : rc;
+}
+
+int psp_list_range(uint16_t cid, uint64_t offset, uint64_t count, inner_result_t result, void *arg)
+{
+    uint128_t values[PSP_LIST_CHUNK];
+    unsigned n = 0;
+    char buff[60];
+    uint64_t pos = offset;
+    uint64_t end = offset + count < text_size ? offset + count : text_size;
+
+    sprintf(buff, "Client %4u Started ....", (unsigned)cid);
+    print128(buff, offset);
+    fflush(stdout);
+    // a line started before offset belongs to the previous unit
+    if (pos > 0 && pos < text_size && text[pos - 1] != '\n')
+    {
+        while (pos < text_size && text[pos] != '\n')
+            pos++;
+        pos++;
+    }
+    while (pos < end)
+    {
+        uint128_t v;
+        uint64_t line = pos;
+        int rc = psp_list_line(&pos, &v);
+        if (rc < 0)
+        {
+            printf("Client %4u skips the line at offset %llu, not a number below 2^%u\n", (unsigned)cid,
+                   (unsigned long long)line, PSP_LIST_MAX_BITS);
+            fflush(stdout);
+        }
+        if (rc <= 0)
+            continue; // comment, not an odd number, or skipped
+        values[n++] = v;
+        if (n == PSP_LIST_CHUNK)
+        {
+            inner_values(cid, values, n, result, arg);
+            n = 0;
+            if (result(arg, cid, TLV_PROGRESS, pos) < 0)
+            {
+                sprintf(buff, "Client %4u Cancelled ..", (unsigned)cid);
+                print128(buff, pos);
+                fflush(stdout);
+                return -1;
+            }
+        }
+    }
+    inner_values(cid, values, n, result, arg);
+
+    sprintf(buff, "Client %4u Completed ..", (unsigned)cid);
+    print128(buff, end);
+    fflush(stdout);
+    return 0;
+}
+
+static int psp_list_result(void *arg, uint16_t cid, uint8_t type, uint128_t v)
+{
+    (void)arg;
+    (void)cid;
+    (void)type;
+    (void)v;
+    return 0;
+}
+
+int psp_list_self_test(void)
+{
+    static const char list[] = "# comment\n"
+                               "341\n"
+                               "  561  \r\n"
+                               "1000\n"
+                               "340282366920938463463374607431768211457\n" // 2^128 + 1, wraps around
+                               "42535295865117307932921825928971026433\n"  // 2^125 + 1
+                               "42535295865117307932921825928971026431\n"  // 2^125 - 1
+                               "1e30\n"
+                               "1905";
+    char name[] = "/tmp/lnrc.psp.XXXXXX";
+    int fd = mkstemp(name);
+    if (fd < 0 || write(fd, list, sizeof(list) - 1) != (ssize_t)(sizeof(list) - 1))
+    {
+        perror(name);
+        return -1;
+    }
+    close(fd);
+    uint64_t size;
+    int rc = psp_list_open(name, &size);
+    unlink(name);
+    if (rc < 0)
+        return -1;
+
+    static const int expected[] = {0, 1, 1, 0, -1, -1, 1, -1, 1};
+    uint64_t pos = 0;
+    uint128_t v;
+    for (unsigned i = 0; i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        if (pos >= size || psp_list_line(&pos, &v) != expected[i])
+        {
+            printf("psp list line %u failed\n", i);
+            rc = -1;
+        }
+    }
+    if (rc == 0 && (pos <= size || v != 1905))
+    {
+        printf("psp list end failed\n");
+        rc = -1;
+    }
+    // the lines out of range are skipped, the others tested
+    if (rc == 0 && psp_list_range(2222, 0, size, psp_list_result, 0) < 0)
+        rc = -1;
+
+    munmap((void *)text, text_size);
+    text = 0;
+    text_size = 0;
+    if (rc == 0)
+        printf("Psp list self-test completed\n");
+    return rc;
+}
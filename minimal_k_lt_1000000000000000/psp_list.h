@@ -0,0 +1,27 @@
+
+#ifndef PSP_LIST_H_H
+#define PSP_LIST_H_H
+
+// a list of base-2 Fermat pseudoprimes, one decimal number per line, instead of all the odd numbers
+//
+//     lnrc -server -psp psp2.txt
+//     lnrc -t 12 -s 192.168.1.2 -psp psp2.txt
+//
+// The server and each worker map the same file. A work unit is a range of byte offsets :
+// seed is the first offset, count the number of bytes, a number belongs to the unit where
+// its line starts. Lines without a number (comments) are skipped, and so are the numbers
+// of 2^125 and more and the lines of a number followed by something else, with a message.
+
+#include <stdint.h>
+
+#include "inner_loop.h"
+#include "tlv.h"
+
+// map the file, *size is its length
+int psp_list_open(const char *name, uint64_t *size);
+bool psp_list_enabled(void);
+// the numbers whose line starts at offset ... offset + count - 1
+int psp_list_range(uint16_t cid, uint64_t offset, uint64_t count, inner_result_t result, void *arg);
+int psp_list_self_test(void);
+
+#endif
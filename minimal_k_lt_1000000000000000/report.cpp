@@ -0,0 +1,114 @@
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "report.h"
+
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t report_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t report_written = PTHREAD_COND_INITIALIZER;
+static std::string queued;         // lines not written yet
+static uint64_t queued_count = 0;  // lines queued since the start
+static uint64_t written_count = 0; // lines written since the start
+static int fd = -1;
+
+static void report_write(int f, const std::string &lines)
+{
+    const char *pt = lines.data();
+    size_t len = lines.size();
+    while (len)
+    {
+        ssize_t r = write(f, pt, len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0)
+        {
+            perror("lnrc.log");
+            return;
+        }
+        pt += r;
+        len -= r;
+    }
+}
+
+static void *report_thread(void *arg)
+{
+    std::string lines;
+    (void)arg;
+    pthread_mutex_lock(&report_lock);
+    while (1)
+    {
+        while (queued.empty())
+        {
+            pthread_cond_wait(&report_cond, &report_lock);
+        }
+        // all the lines queued meanwhile, in one write and one fsync
+        lines.swap(queued);
+        uint64_t count = queued_count;
+        pthread_mutex_unlock(&report_lock);
+
+        report_write(STDOUT_FILENO, lines);
+        if (fd >= 0)
+        {
+            report_write(fd, lines);
+            fdatasync(fd);
+        }
+        lines.clear();
+
+        pthread_mutex_lock(&report_lock);
+        written_count = count;
+        pthread_cond_broadcast(&report_written);
+    }
+    return 0;
+}
+
+int report_setup(const char *name)
+{
+    pthread_t tid;
+    fd = open(name, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+    {
+        perror(name);
+    }
+    if (pthread_create(&tid, 0, report_thread, 0))
+    {
+        printf("Unable to start the log writer\n");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+void report(const char *s, uint128_t v)
+{
+    char line[128];
+    uint64_t lo = (uint64_t)v, hi = (uint64_t)(v >> 64);
+    int l = snprintf(line, sizeof(line), "%s 0x%16.16llx%16.16llx\n", s, (unsigned long long)hi,
+                     (unsigned long long)lo);
+    // stdout is written by the writer thread too, the lines stay in order
+    fflush(stdout);
+    pthread_mutex_lock(&report_lock);
+    queued.append(line, l < (int)sizeof(line) ? l : sizeof(line) - 1);
+    queued_count++;
+    pthread_cond_signal(&report_cond);
+    pthread_mutex_unlock(&report_lock);
+}
+
+void report_flush(void)
+{
+    pthread_mutex_lock(&report_lock);
+    while (written_count < queued_count)
+    {
+        pthread_cond_wait(&report_written, &report_lock);
+    }
+    pthread_mutex_unlock(&report_lock);
+}
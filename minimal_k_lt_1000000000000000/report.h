@@ -0,0 +1,20 @@
+#ifndef REPORT_H_H
+#define REPORT_H_H
+
+// results of the server, displayed and appended to a log file by one writer thread
+//
+// The event loop only queues the lines. The writer takes all the lines queued
+// meanwhile, and writes them with one write and one fsync (group commit). The
+// server waits for them with report_flush() before the fsync of its journal.
+
+#include <stdint.h>
+
+#include "tlv.h"
+
+int report_setup(const char *name);
+// same line as print128(s, v)
+void report(const char *s, uint128_t v);
+// wait until the lines queued so far are written
+void report_flush(void);
+
+#endif
@@ -4,8 +4,9 @@
 
 #define PROXY_PORT 15001
 #define SERVER_PORT 15002
+#define METRICS_PORT_OFFSET 2 // metrics on server port + 2, 127.0.0.1 only, the proxy is on port + 1
 
-#define MAX_CID 2048 // a power of 2
+#define MAX_CID 32768 // a power of 2, cid are 16 bits in tlv
 
 void *server_thread(void *arg);
 void *proxy_thread(void *arg);
@@ -1,7 +1,12 @@
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #include "tlv.h"
@@ -17,6 +22,11 @@ int block_read(int s, unsigned len, uint8_t *p)
             perror("read");
             return -1;
         }
+        if (r == 0)
+        {
+            // connection closed by the peer
+            return -1;
+        }
         l += r;
     }
     return len;
@@ -38,22 +48,59 @@ int block_write(int s, unsigned len, uint8_t *p)
     return len;
 }
 
-int tlv_read(int s, uint16_t *cid, uint8_t *type, uint128_t *value)
+static int tlv_header_read(int s, uint16_t *cid, uint8_t *type, uint32_t *len)
 {
-    uint8_t *p;
-    uint128_t v;
-    uint16_t l;
-    p = (uint8_t *)alloca(5);
-    int len = block_read(s, 5, p);
-    if (len < 5)
+    uint8_t p[5];
+    uint32_t l;
+    if (block_read(s, 5, p) < 5)
         return -1;
     *type = p[0];
     *cid = p[2] * 256 + p[1];
     l = p[4] * 256 + p[3];
+    if (l == TLV_LONG)
+    {
+        if (block_read(s, 4, p) < 4)
+            return -1;
+        l = ((uint32_t)p[3] << 24) + ((uint32_t)p[2] << 16) + ((uint32_t)p[1] << 8) + p[0];
+        if (l > TLV_MAX_LENGTH)
+            return -1;
+    }
     if (l < 1)
         return -1;
-    p = (uint8_t *)alloca(l);
-    len = block_read(s, l, p);
+    *len = l;
+    return 0;
+}
+
+static unsigned tlv_header(uint8_t *p, uint16_t cid, uint8_t type, uint32_t l)
+{
+    p[0] = type;
+    p[1] = cid % 256;
+    p[2] = cid / 256;
+    if (l < TLV_LONG)
+    {
+        p[3] = l % 256;
+        p[4] = l / 256;
+        return 5;
+    }
+    p[3] = TLV_LONG % 256;
+    p[4] = TLV_LONG / 256;
+    p[5] = l;
+    p[6] = l >> 8;
+    p[7] = l >> 16;
+    p[8] = l >> 24;
+    return 9;
+}
+
+int tlv_read(int s, uint16_t *cid, uint8_t *type, uint128_t *value)
+{
+    uint8_t p[16];
+    uint128_t v;
+    uint32_t l;
+    if (tlv_header_read(s, cid, type, &l) < 0)
+        return -1;
+    if (l > 16)
+        return -1; // not a number, use tlv_frame_read()
+    int len = block_read(s, l, p);
     if (len < (int)l)
         return -1;
     v = 0;
@@ -65,34 +112,371 @@ int tlv_read(int s, uint16_t *cid, uint8_t *type, uint128_t *value)
     return 0;
 }
 
-int tlv_write(int s, uint16_t cid, uint8_t type, uint128_t value)
+// one frame from p, 1 : frame in f and *used bytes, 0 : incomplete, -1 : invalid
+static int tlv_parse(const uint8_t *p, uint32_t avail, tlv_frame_t *f, uint32_t *used)
 {
-    uint8_t *p;
-    uint128_t cmp, v = value;
-    uint16_t i, l;
-    l = 1;
-    cmp = 0xff;
-    while (l < 16 && v > cmp)
+    uint32_t h = 5, l;
+    if (avail < 5)
+        return 0;
+    l = p[4] * 256 + p[3];
+    if (l == TLV_LONG)
     {
-        cmp = (cmp << 8) + 0xff;
-        l++;
+        h = 9;
+        if (avail < 9)
+            return 0;
+        l = ((uint32_t)p[8] << 24) + ((uint32_t)p[7] << 16) + ((uint32_t)p[6] << 8) + p[5];
+        if (l > TLV_MAX_LENGTH)
+            return -1;
     }
-    p = (uint8_t *)alloca(l + 4);
-    p[0] = type;
-    p[1] = cid % 256;
-    p[2] = cid / 256;
-    p[3] = l % 256;
-    p[4] = l / 256;
-    int len = block_write(s, 5, p);
-    if (len < 5)
+    if (l < 1)
         return -1;
-    for (i = 0; i < l; i++)
+    if (avail < h + l)
+        return 0;
+    if (tlv_frame_reserve(f, l) < 0)
+        return -1;
+    f->type = p[0];
+    f->cid = p[2] * 256 + p[1];
+    f->len = l;
+    memcpy(f->value, p + h, l);
+    *used = h + l;
+    return 1;
+}
+
+// header and value of a tlv with a number, the shortest little-endian value
+static unsigned tlv_short(uint8_t *p, uint16_t cid, uint8_t type, uint128_t value)
+{
+    uint32_t l = 0;
+    do
+    {
+        p[5 + l++] = value & 0xff;
+        value >>= 8;
+    } while (l < 16 && value);
+    return tlv_header(p, cid, type, l) + l;
+}
+
+int tlv_write(int s, uint16_t cid, uint8_t type, uint128_t value)
+{
+    uint8_t p[TLV_SHORT_MAX];
+    unsigned l = tlv_short(p, cid, type, value);
+    // one write, one segment
+    int len = block_write(s, l, p);
+    if (len < (int)l)
+        return -1;
+    return 0;
+}
+
+void tlv_frame_init(tlv_frame_t *f)
+{
+    memset(f, 0, sizeof(*f));
+}
+
+void tlv_frame_free(tlv_frame_t *f)
+{
+    free(f->value);
+    tlv_frame_init(f);
+}
+
+int tlv_frame_reserve(tlv_frame_t *f, uint32_t len)
+{
+    if (len > f->size)
     {
-        p[i] = v & 0xff;
-        v >>= 8;
+        uint8_t *p = (uint8_t *)realloc(f->value, len);
+        if (!p)
+        {
+            printf("Unable to allocate %u bytes\n", (unsigned)len);
+            return -1;
+        }
+        f->value = p;
+        f->size = len;
     }
-    len = block_write(s, l, p);
+    return 0;
+}
+
+int tlv_frame_read(int s, tlv_frame_t *f)
+{
+    uint32_t l;
+    if (tlv_header_read(s, &f->cid, &f->type, &l) < 0)
+        return -1;
+    if (tlv_frame_reserve(f, l) < 0)
+        return -1;
+    f->len = l;
+    int len = block_read(s, l, f->value);
     if (len < (int)l)
         return -1;
     return 0;
 }
+
+int tlv_frame_write(int s, const tlv_frame_t *f)
+{
+    uint8_t p[9];
+    unsigned h = tlv_header(p, f->cid, f->type, f->len);
+    struct iovec iov[2];
+    iov[0].iov_base = p;
+    iov[0].iov_len = h;
+    iov[1].iov_base = f->value;
+    iov[1].iov_len = f->len;
+    size_t l = h + f->len;
+    // header and value in one writev, the rest after a partial write
+    ssize_t r = writev(s, iov, 2);
+    if (r < 0)
+    {
+        perror("writev");
+        return -1;
+    }
+    if ((size_t)r < h)
+    {
+        if (block_write(s, h - r, p + r) < (int)(h - r))
+            return -1;
+        r = h;
+    }
+    if ((size_t)r < l && block_write(s, l - r, f->value + (r - h)) < (int)(l - r))
+        return -1;
+    return 0;
+}
+
+uint128_t tlv_frame_value(const tlv_frame_t *f)
+{
+    uint128_t v = 0;
+    uint32_t l = f->len < 16 ? f->len : 16;
+    while (l--)
+    {
+        v = v * 256 + f->value[l];
+    }
+    return v;
+}
+
+void tlv_batch_init(tlv_frame_t *b, uint16_t cid)
+{
+    b->type = TLV_BATCH;
+    b->cid = cid;
+    b->len = 0;
+}
+
+int tlv_batch_add(tlv_frame_t *b, uint16_t cid, uint8_t type, uint128_t value)
+{
+    if (b->len + TLV_SHORT_MAX > TLV_MAX_LENGTH)
+        return -1;
+    if (b->len + TLV_SHORT_MAX > b->size && tlv_frame_reserve(b, 2 * b->size + 256) < 0)
+        return -1;
+    b->len += tlv_short(b->value + b->len, cid, type, value);
+    return 0;
+}
+
+int tlv_batch_next(const tlv_frame_t *b, uint32_t *pos, tlv_frame_t *f)
+{
+    uint32_t used;
+    if (*pos >= b->len)
+        return 0;
+    // a batch is complete, a partial tlv is invalid
+    if (tlv_parse(b->value + *pos, b->len - *pos, f, &used) <= 0)
+        return -1;
+    *pos += used;
+    return 1;
+}
+
+tlv_conn_t *tlv_conn_create(int s, bool nonblocking)
+{
+    int flags = nonblocking ? fcntl(s, F_GETFL, 0) : 0;
+    if (nonblocking && (flags < 0 || fcntl(s, F_SETFL, flags | O_NONBLOCK) < 0))
+    {
+        perror("fcntl");
+        return 0;
+    }
+    tlv_conn_t *c = (tlv_conn_t *)calloc(1, sizeof(tlv_conn_t));
+    if (c)
+    {
+        c->s = s;
+    }
+    return c;
+}
+
+void tlv_conn_destroy(tlv_conn_t *c)
+{
+    free(c->in);
+    free(c->out);
+    free(c);
+}
+
+static int tlv_conn_reserve(uint8_t **p, uint32_t *size, uint32_t len)
+{
+    if (len > *size)
+    {
+        uint32_t n = *size ? *size : 256;
+        while (n < len)
+        {
+            n *= 2;
+        }
+        uint8_t *q = (uint8_t *)realloc(*p, n);
+        if (!q)
+        {
+            printf("Unable to allocate %u bytes\n", (unsigned)n);
+            return -1;
+        }
+        *p = q;
+        *size = n;
+    }
+    return 0;
+}
+
+int tlv_conn_fill(tlv_conn_t *c)
+{
+    // keep the partial frame only
+    if (c->in_pos)
+    {
+        memmove(c->in, c->in + c->in_pos, c->in_len - c->in_pos);
+        c->in_len -= c->in_pos;
+        c->in_pos = 0;
+    }
+    // a fast peer is not read faster than its frames are processed
+    while (c->in_len < TLV_CONN_MAX_IN)
+    {
+        if (tlv_conn_reserve(&c->in, &c->in_size, c->in_len + 4096) < 0)
+            return -1;
+        ssize_t r = read(c->s, c->in + c->in_len, c->in_size - c->in_len);
+        if (r > 0)
+        {
+            c->in_len += r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0;
+        return -1; // closed by the peer, or broken
+    }
+    return 1; // edge-triggered, the rest is read after the frames of the buffer
+}
+
+int tlv_conn_next(tlv_conn_t *c, tlv_frame_t *f)
+{
+    uint32_t used;
+    int rc = tlv_parse(c->in + c->in_pos, c->in_len - c->in_pos, f, &used);
+    if (rc > 0)
+        c->in_pos += used;
+    return rc;
+}
+
+int tlv_conn_read(tlv_conn_t *c, tlv_frame_t *f)
+{
+    while (1)
+    {
+        int rc = tlv_conn_next(c, f);
+        if (rc > 0)
+            return 0;
+        if (rc < 0)
+            return -1;
+        if (c->in_pos)
+        {
+            memmove(c->in, c->in + c->in_pos, c->in_len - c->in_pos);
+            c->in_len -= c->in_pos;
+            c->in_pos = 0;
+        }
+        if (tlv_conn_reserve(&c->in, &c->in_size, c->in_len + 4096) < 0)
+            return -1;
+        // all the frames already sent by the peer, in one read
+        ssize_t r = read(c->s, c->in + c->in_len, c->in_size - c->in_len);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        c->in_len += r;
+    }
+}
+
+int tlv_conn_poll(tlv_conn_t *c, uint8_t type)
+{
+    while (c->in_len < TLV_CONN_MAX_IN)
+    {
+        if (tlv_conn_reserve(&c->in, &c->in_size, c->in_len + 4096) < 0)
+            return -1;
+        ssize_t r = recv(c->s, c->in + c->in_len, c->in_size - c->in_len, MSG_DONTWAIT);
+        if (r > 0)
+        {
+            c->in_len += r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        return -1;
+    }
+    // the frames stay in the buffer, for tlv_conn_read()
+    uint32_t pos = c->in_pos, used;
+    tlv_frame_t f;
+    tlv_frame_init(&f);
+    int found = 0;
+    while (!found && tlv_parse(c->in + pos, c->in_len - pos, &f, &used) > 0)
+    {
+        found = f.type == type;
+        pos += used;
+    }
+    tlv_frame_free(&f);
+    return found;
+}
+
+int tlv_conn_flush(tlv_conn_t *c)
+{
+    while (c->out_pos < c->out_commit)
+    {
+        ssize_t r = write(c->s, c->out + c->out_pos, c->out_commit - c->out_pos);
+        if (r > 0)
+        {
+            c->out_pos += r;
+            continue;
+        }
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return 0; // the rest when the socket is writable again
+        return -1;
+    }
+    if (c->out_commit == c->out_len)
+    {
+        c->out_pos = c->out_len = c->out_commit = 0;
+    }
+    return 0;
+}
+
+static int tlv_conn_queue(tlv_conn_t *c, const uint8_t *header, uint32_t h, const uint8_t *value, uint32_t l)
+{
+    if (c->out_len - c->out_pos + h + l > TLV_CONN_MAX_OUT)
+        return -1; // the peer does not read any more
+    if (c->out_pos)
+    {
+        memmove(c->out, c->out + c->out_pos, c->out_len - c->out_pos);
+        c->out_len -= c->out_pos;
+        c->out_commit -= c->out_pos;
+        c->out_pos = 0;
+    }
+    if (tlv_conn_reserve(&c->out, &c->out_size, c->out_len + h + l) < 0)
+        return -1;
+    memcpy(c->out + c->out_len, header, h);
+    if (l)
+        memcpy(c->out + c->out_len + h, value, l);
+    c->out_len += h + l;
+    if (c->hold)
+        return 0; // sent by tlv_conn_commit()
+    c->out_commit = c->out_len;
+    return tlv_conn_flush(c);
+}
+
+int tlv_conn_commit(tlv_conn_t *c)
+{
+    c->out_commit = c->out_len;
+    return tlv_conn_flush(c);
+}
+
+int tlv_conn_write(tlv_conn_t *c, uint16_t cid, uint8_t type, uint128_t value)
+{
+    uint8_t p[TLV_SHORT_MAX];
+    unsigned l = tlv_short(p, cid, type, value);
+    return tlv_conn_queue(c, p, l, 0, 0);
+}
+
+int tlv_conn_write_frame(tlv_conn_t *c, const tlv_frame_t *f)
+{
+    uint8_t p[9];
+    unsigned h = tlv_header(p, f->cid, f->type, f->len);
+    return tlv_conn_queue(c, p, h, f->value, f->len);
+}
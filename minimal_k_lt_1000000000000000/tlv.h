@@ -3,6 +3,7 @@
 #define TLV_H_H
 
 #include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 
 #define TLV_SEED 1
@@ -14,6 +15,24 @@
 #define TLV_B1 20
 #define TLV_READY 12
 #define TLV_NEW 13
+#define TLV_PROGRESS 14 // last seed done of the running block, all its results sent before
+#define TLV_JOB 30     // uint64 job id, uint8 request type, candidate (see ../quadratic_primality_server.h)
+#define TLV_VERDICT 31 // uint64 job id, uint8 verdict
+#define TLV_BATCH 40   // tlvs, header and value, sent and parsed as one frame
+
+// value of TLV_NEW from a client which understands TLV_BATCH, a work unit is then
+// one TLV_BATCH with SEED, COUNT and GO, instead of 3 frames
+#define TLV_VERSION_BATCH 1
+// and which can abandon a block on a TLV_STOP with TLV_STOP_CANCEL, the block is done by another worker
+#define TLV_VERSION_CANCEL 2
+#define TLV_STOP_CANCEL 1
+// and which sends a TLV_PROGRESS every few seconds of a block, in the TLV_BATCH of its results
+#define TLV_VERSION_PROGRESS 3
+
+// tlv header : type, cid (16 bits), length (16 bits), all integers little-endian
+// a length of TLV_LONG is followed by the real length on 32 bits
+#define TLV_LONG 0xffff
+#define TLV_MAX_LENGTH (1u << 28)
 
 typedef unsigned __int128 uint128_t;
 
@@ -50,9 +69,68 @@ static inline void scan128(const char *s, uint128_t *value)
     *value = v;
 }
 
+// a tlv with a value of any length, forwarded as is by the proxy
+typedef struct tlv_frame_s
+{
+    uint8_t type;
+    uint16_t cid;
+    uint32_t len;
+    uint32_t size; // allocated
+    uint8_t *value;
+} tlv_frame_t;
+
+// non-blocking socket, with buffers for partial frames, for the epoll loops
+typedef struct tlv_conn_s
+{
+    int s;
+    uint8_t *in;
+    uint32_t in_pos, in_len, in_size;
+    uint8_t *out;
+    uint32_t out_pos, out_len, out_size;
+    uint32_t out_commit; // bytes which can be sent
+    bool hold;           // queued bytes wait for tlv_conn_commit()
+} tlv_conn_t;
+
+#define TLV_CONN_MAX_OUT (1u << 24) // unsent bytes before the peer is declared dead
+#define TLV_SHORT_MAX (9 + 16)       // largest tlv with a number
+#define TLV_CONN_MAX_IN (TLV_MAX_LENGTH + 9) // buffered bytes before the reads wait for the frames to be processed
+
 int block_read(int s, unsigned len, uint8_t *p);
 int block_write(int s, unsigned len, uint8_t *p);
 int tlv_read(int s, uint16_t *cid, uint8_t *type, uint128_t *value);
 int tlv_write(int s, uint16_t cid, uint8_t type, uint128_t value);
 
+void tlv_frame_init(tlv_frame_t *f);
+void tlv_frame_free(tlv_frame_t *f);
+int tlv_frame_reserve(tlv_frame_t *f, uint32_t len);
+int tlv_frame_read(int s, tlv_frame_t *f);
+int tlv_frame_write(int s, const tlv_frame_t *f);
+// the value of a short tlv, little-endian, up to 16 bytes
+uint128_t tlv_frame_value(const tlv_frame_t *f);
+
+// b becomes an empty TLV_BATCH for cid
+void tlv_batch_init(tlv_frame_t *b, uint16_t cid);
+int tlv_batch_add(tlv_frame_t *b, uint16_t cid, uint8_t type, uint128_t value);
+// next tlv of the batch from *pos, 1 : tlv in f, 0 : end of batch, -1 : invalid
+int tlv_batch_next(const tlv_frame_t *b, uint32_t *pos, tlv_frame_t *f);
+
+tlv_conn_t *tlv_conn_create(int s, bool nonblocking = true);
+void tlv_conn_destroy(tlv_conn_t *c);
+// read until the socket would block, 0, or until TLV_CONN_MAX_IN bytes are buffered, 1 : to call
+// again after tlv_conn_next() has taken the complete frames, -1 when closed
+int tlv_conn_fill(tlv_conn_t *c);
+// blocking socket : next frame, from the read buffer or from as few reads as possible, -1 when closed
+int tlv_conn_read(tlv_conn_t *c, tlv_frame_t *f);
+// blocking socket : read what is already received, without waiting, 1 when a frame of this type is in
+// the read buffer, 0 when not, -1 when closed
+int tlv_conn_poll(tlv_conn_t *c, uint8_t type);
+// next complete frame of the read buffer, 1 : frame in f, 0 : incomplete, -1 : invalid
+int tlv_conn_next(tlv_conn_t *c, tlv_frame_t *f);
+// queue and write until the socket would block, the rest is written by tlv_conn_flush(), -1 on error
+int tlv_conn_write(tlv_conn_t *c, uint16_t cid, uint8_t type, uint128_t value);
+int tlv_conn_write_frame(tlv_conn_t *c, const tlv_frame_t *f);
+int tlv_conn_flush(tlv_conn_t *c);
+// send the bytes queued on hold
+int tlv_conn_commit(tlv_conn_t *c);
+
 #endif
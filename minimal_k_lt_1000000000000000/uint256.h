@@ -0,0 +1,144 @@
+
+#ifndef UINT256_H_H
+#define UINT256_H_H
+
+// the double width type TT when T is uint128_t, for the templates of inner_loop.cpp
+//
+// Only what the templates need : sums, products by a uint128_t, shifts and
+// comparisons. There is no division, the reductions mod n are Montgomery.
+
+#include <stdint.h>
+
+#include "tlv.h"
+
+struct uint256_t
+{
+    uint128_t lo, hi;
+
+    uint256_t(void) : lo(0), hi(0)
+    {
+    }
+    uint256_t(uint128_t v) : lo(v), hi(0)
+    {
+    }
+    uint256_t(uint128_t h, uint128_t l) : lo(l), hi(h)
+    {
+    }
+
+    explicit operator uint128_t(void) const
+    {
+        return lo;
+    }
+
+    uint256_t &operator+=(const uint256_t &v)
+    {
+        uint128_t l = lo + v.lo;
+        hi += v.hi + (l < lo);
+        lo = l;
+        return *this;
+    }
+
+    uint256_t &operator<<=(unsigned s)
+    {
+        if (s >= 128)
+        {
+            hi = s >= 256 ? 0 : lo << (s - 128);
+            lo = 0;
+        }
+        else if (s)
+        {
+            hi = (hi << s) | (lo >> (128 - s));
+            lo <<= s;
+        }
+        return *this;
+    }
+
+    uint256_t &operator>>=(unsigned s)
+    {
+        if (s >= 128)
+        {
+            lo = s >= 256 ? 0 : hi >> (s - 128);
+            hi = 0;
+        }
+        else if (s)
+        {
+            lo = (lo >> s) | (hi << (128 - s));
+            hi >>= s;
+        }
+        return *this;
+    }
+
+    // low 256 bits of the product
+    uint256_t &operator*=(const uint128_t &v);
+};
+
+// full product of 2 uint128_t
+static inline uint256_t mul256(const uint128_t &u, const uint128_t &v)
+{
+    uint64_t u0 = (uint64_t)u, u1 = (uint64_t)(u >> 64);
+    uint64_t v0 = (uint64_t)v, v1 = (uint64_t)(v >> 64);
+    uint128_t p00 = (uint128_t)u0 * v0;
+    uint128_t p01 = (uint128_t)u0 * v1;
+    uint128_t p10 = (uint128_t)u1 * v0;
+    uint128_t p11 = (uint128_t)u1 * v1;
+    uint128_t mid = (p00 >> 64) + (uint64_t)p01 + (uint64_t)p10;
+    uint256_t r;
+    r.lo = (mid << 64) | (uint64_t)p00;
+    r.hi = p11 + (p01 >> 64) + (p10 >> 64) + (mid >> 64);
+    return r;
+}
+
+inline uint256_t &uint256_t::operator*=(const uint128_t &v)
+{
+    uint256_t r = mul256(lo, v);
+    r.hi += hi * v;
+    *this = r;
+    return *this;
+}
+
+static inline uint256_t operator+(uint256_t u, const uint256_t &v)
+{
+    return u += v;
+}
+
+static inline uint256_t operator+(const uint128_t &u, const uint256_t &v)
+{
+    return uint256_t(u) += v;
+}
+
+static inline uint256_t operator*(uint256_t u, const uint128_t &v)
+{
+    return u *= v;
+}
+
+static inline uint256_t operator<<(uint256_t u, unsigned s)
+{
+    return u <<= s;
+}
+
+static inline uint256_t operator>>(uint256_t u, unsigned s)
+{
+    return u >>= s;
+}
+
+static inline bool operator==(const uint256_t &u, const uint256_t &v)
+{
+    return u.lo == v.lo && u.hi == v.hi;
+}
+
+static inline bool operator!=(const uint256_t &u, const uint256_t &v)
+{
+    return !(u == v);
+}
+
+static inline bool operator<(const uint256_t &u, const uint256_t &v)
+{
+    return u.hi < v.hi || (u.hi == v.hi && u.lo < v.lo);
+}
+
+static inline bool operator>=(const uint256_t &u, const uint256_t &v)
+{
+    return !(u < v);
+}
+
+#endif
@@ -1,23 +1,62 @@
+%code requires {
+#include "gmp.h"
+struct gmp_expr_state_t;
+}
+
 %{
+#include<assert.h>
 #include<stdio.h>
+#include<stdint.h>
+#include<stdlib.h>
 #include<string.h>
+#include<pthread.h>
 #include "gmp.h"
 #include "bison.gmp_expr.h"
 
-void gmp_expr_lex_init(char * str);
-void gmp_expr_lex_terminate(void);
+#define STACK_SIZE 20
+#define POWER_CACHE_SIZE 8
+#define POWER_CACHE_MIN_BITS 4096        // smaller powers are cheaper to compute than to look up
+#define POWER_CACHE_MAX_BITS (1ul << 26) // do not keep huge numbers alive
+#define POSTFIX_MAX (1ul << 26)          // largest operand of ! and #, 2^26! has about 1.6 billion bits
+#define POWER_MAX_BITS (1ul << 32)       // largest result of ^, GMP aborts on larger numbers
 
-int yylex();
-int yyerror(const char *s);
+// recently computed powers like 2^86243, files of k*b^n+c share a few b^n
+struct gmp_expr_power_t
+{
+    unsigned long base, exponent; // base 0 : free entry
+    uint64_t last_use;
+    mpz_t value;
+};
 
-#define STACK_SIZE 20
-static mpz_t stack[STACK_SIZE]; // this static data is not thread-safe
-static mpz_ptr stack_ptr = stack[0];
+// structure of a value on the stack
+#define FORM_NONE 0
+#define FORM_CONSTANT 1 // small constant c
+#define FORM_POWER 2    // k * b^n + c
+struct gmp_expr_form_t
+{
+    int kind;
+    uint64_t k, b, n;
+    int64_t c;
+};
+
+// per-thread parser state, reused from one expression to the next
+struct gmp_expr_state_t
+{
+    mpz_t stack[STACK_SIZE];
+    struct gmp_expr_form_t forms[STACK_SIZE];
+    mpz_ptr stack_ptr;
+    void *scanner;
+    uint64_t tick;
+    struct gmp_expr_power_t cache[POWER_CACHE_SIZE];
+};
 
 %}
 
+%define api.pure full
 %define api.prefix {gmp_expr}
 %file-prefix "bison.gmp_expr"
+%lex-param {void *scanner}
+%parse-param {void *scanner} {struct gmp_expr_state_t *state}
 
 /* token type */
 %union {
@@ -25,63 +64,348 @@ char *str;
 int lval;
 }
 
+%code {
+void *gmp_expr_lex_create(void);
+void gmp_expr_lex_start(void *scanner, char *str);
+void gmp_expr_lex_destroy(void *scanner);
+
+int yylex(GMP_EXPRSTYPE *lvalp, void *scanner);
+int yyerror(void *scanner, struct gmp_expr_state_t *state, const char *s);
+static void gmp_expr_pow(struct gmp_expr_state_t *state, mpz_ptr r, unsigned long e);
+static void gmp_expr_form_binary(struct gmp_expr_state_t *state, char op);
+static void gmp_expr_form_value(struct gmp_expr_state_t *state);
+static bool gmp_expr_postfix(struct gmp_expr_state_t *state, int op, int multiplicity);
+}
+
 /* token declaration */
 %token <str> NUMBER
-%token OPEN_B CLOSE_B ADD SUB MUL DIV EXP
+%token <lval> FACT /* !, !!, !!! ... the value is the number of ! */
+%token OPEN_B CLOSE_B ADD SUB MUL DIV EXP PRIM
+%token INVALID /* a character which is not part of an expression, a syntax error */
 
 %%
 
 calclist:
- sum { if (mpz_cmp_ui(stack_ptr, 0) < 0) yyerror("negative expression"); 
-       mpz_set(stack[0], stack_ptr); }
+ sum { if (mpz_cmp_ui(state->stack_ptr, 0) < 0) { yyerror(scanner, state, "negative expression"); YYABORT; }
+       mpz_set(state->stack[0], state->stack_ptr);
+       state->forms[0] = state->forms[state->stack_ptr - state->stack[0]]; }
  ;
 sum: factor
- | sum ADD factor { stack_ptr--; mpz_add(stack_ptr, stack_ptr, stack_ptr+1); }
- | sum SUB factor { stack_ptr--; mpz_sub(stack_ptr, stack_ptr, stack_ptr+1); }
+ | sum ADD factor { state->stack_ptr--; mpz_add(state->stack_ptr, state->stack_ptr, state->stack_ptr+1); gmp_expr_form_binary(state, '+'); }
+ | sum SUB factor { state->stack_ptr--; mpz_sub(state->stack_ptr, state->stack_ptr, state->stack_ptr+1); gmp_expr_form_binary(state, '-'); }
  ;
 factor: exp
- | factor MUL exp { stack_ptr--; mpz_mul(stack_ptr, stack_ptr, stack_ptr+1); }
- | factor DIV exp { if (mpz_cmp_ui(stack_ptr, 0) == 0) yyerror("division by 0"); 
-                     stack_ptr--; mpz_fdiv_q(stack_ptr, stack_ptr, stack_ptr+1); }
+ | factor MUL exp { state->stack_ptr--; mpz_mul(state->stack_ptr, state->stack_ptr, state->stack_ptr+1); gmp_expr_form_binary(state, '*'); }
+ | factor DIV exp { if (mpz_cmp_ui(state->stack_ptr, 0) == 0) { yyerror(scanner, state, "division by 0"); YYABORT; }
+                     state->stack_ptr--; mpz_fdiv_q(state->stack_ptr, state->stack_ptr, state->stack_ptr+1); gmp_expr_form_binary(state, '/'); }
  ;
-exp: sterm 
- | sterm EXP exp { stack_ptr--;
-                  if (mpz_cmp_si(stack_ptr, 2) >= 0 || mpz_cmp_si(stack_ptr, -2) <= 0)
+exp: sterm
+ | sterm EXP exp { state->stack_ptr--;
+                  if (mpz_cmp_si(state->stack_ptr, 2) >= 0 || mpz_cmp_si(state->stack_ptr, -2) <= 0)
                   {
-                      if (mpz_cmp_ui(stack_ptr+1, 0) < 0) yyerror("negative exponent"); 
+                      if (mpz_cmp_ui(state->stack_ptr+1, 0) < 0) { yyerror(scanner, state, "negative exponent"); YYABORT; }
                   }
                   else
                   {
-			mpz_set_si(stack_ptr+1, mpz_cmp_ui(stack_ptr+1, 0));
+			mpz_set_si(state->stack_ptr+1, mpz_cmp_ui(state->stack_ptr+1, 0));
                   }
-                  if (mpz_sizeinbase(stack_ptr+1, 2) >= 64) yyerror("exponentiation overflow"); 
-                  mpz_pow_ui(stack_ptr, stack_ptr, mpz_get_ui(stack_ptr+1)); }
+                  if (mpz_sizeinbase(state->stack_ptr+1, 2) >= 64) { yyerror(scanner, state, "exponentiation overflow"); YYABORT; }
+                  if (mpz_cmpabs_ui(state->stack_ptr, 1) > 0 && mpz_get_ui(state->stack_ptr+1) > POWER_MAX_BITS / (mpz_sizeinbase(state->stack_ptr, 2) - 1))
+                  { yyerror(scanner, state, "exponentiation overflow"); YYABORT; }
+                  gmp_expr_pow(state, state->stack_ptr, mpz_get_ui(state->stack_ptr+1)); gmp_expr_form_binary(state, '^'); }
  ;
-sterm: term
- | ADD term { }
- | SUB term { mpz_neg(stack_ptr, stack_ptr); }
+sterm: post
+ | ADD post { }
+ | SUB post { mpz_neg(state->stack_ptr, state->stack_ptr); gmp_expr_form_value(state); }
  ;
-term: NUMBER { if (stack_ptr - stack[0] >= STACK_SIZE - 1) yyerror("expression overflow"); 
-               stack_ptr++; int v = mpz_set_str(stack_ptr, $1, 0); if (v) yyerror("invalid number representation"); }
+post: term
+ | post FACT { if (!gmp_expr_postfix(state, '!', $2)) { yyerror(scanner, state, "factorial overflow"); YYABORT; } }
+ | post PRIM { if (!gmp_expr_postfix(state, '#', 1)) { yyerror(scanner, state, "primorial overflow"); YYABORT; } }
+ ;
+term: NUMBER { if (state->stack_ptr - state->stack[0] >= STACK_SIZE - 1) { yyerror(scanner, state, "expression overflow"); YYABORT; }
+               state->stack_ptr++; int v = mpz_set_str(state->stack_ptr, $1, 0); if (v) { yyerror(scanner, state, "invalid number representation"); YYABORT; }
+               gmp_expr_form_value(state); }
  | OPEN_B sum CLOSE_B
  ;
 
 %%
 
+// r = r^e, large powers of small bases come from the cache when possible
+static void gmp_expr_pow(struct gmp_expr_state_t *state, mpz_ptr r, unsigned long e)
+{
+ if (mpz_cmp_ui(r, 2) < 0 || !mpz_fits_ulong_p(r) || e > POWER_CACHE_MAX_BITS)
+ {
+  mpz_pow_ui(r, r, e);
+  return;
+ }
+ unsigned long bits = e * (mpz_sizeinbase(r, 2) - 1);
+ if (bits < POWER_CACHE_MIN_BITS || bits > POWER_CACHE_MAX_BITS)
+ {
+  mpz_pow_ui(r, r, e);
+  return;
+ }
+ unsigned long b = mpz_get_ui(r);
+ struct gmp_expr_power_t *lru = &state->cache[0];
+ for (unsigned i = 0; i < POWER_CACHE_SIZE; i++)
+ {
+  struct gmp_expr_power_t *c = &state->cache[i];
+  if (c->base == b && c->exponent == e)
+  {
+   c->last_use = ++state->tick;
+   mpz_set(r, c->value);
+   return;
+  }
+  if (c->last_use < lru->last_use)
+  {
+   lru = c;
+  }
+ }
+ mpz_ui_pow_ui(r, b, e);
+ lru->base = b;
+ lru->exponent = e;
+ lru->last_use = ++state->tick;
+ mpz_set(lru->value, r);
+}
+
+// n! n!! ... n# on top of the stack, from the product trees of GMP
+static bool gmp_expr_postfix(struct gmp_expr_state_t *state, int op, int multiplicity)
+{
+ mpz_ptr r = state->stack_ptr;
+ if (mpz_cmp_ui(r, 0) < 0 || mpz_cmp_ui(r, POSTFIX_MAX) > 0)
+ {
+  return false;
+ }
+ unsigned long n = mpz_get_ui(r);
+ if (op == '#')
+ {
+  mpz_primorial_ui(r, n);
+ }
+ else if (multiplicity == 1)
+ {
+  mpz_fac_ui(r, n);
+ }
+ else if (multiplicity == 2)
+ {
+  mpz_2fac_ui(r, n);
+ }
+ else
+ {
+  mpz_mfac_uiui(r, n, multiplicity);
+ }
+ // the result has no k * b^n + c structure, unless small
+ gmp_expr_form_value(state);
+ return true;
+}
+
+// the value on top of the stack is a small constant, or has no known structure
+static void gmp_expr_form_value(struct gmp_expr_state_t *state)
+{
+ struct gmp_expr_form_t *f = &state->forms[state->stack_ptr - state->stack[0]];
+ if (mpz_fits_slong_p(state->stack_ptr))
+ {
+  f->kind = FORM_CONSTANT;
+  f->c = mpz_get_si(state->stack_ptr);
+ }
+ else
+ {
+  f->kind = FORM_NONE;
+ }
+}
+
+// track k * b^n + c through the operation which left its result on top of the stack
+static void gmp_expr_form_binary(struct gmp_expr_state_t *state, char op)
+{
+ struct gmp_expr_form_t *f = &state->forms[state->stack_ptr - state->stack[0]];
+ struct gmp_expr_form_t x = f[0], y = f[1];
+ gmp_expr_form_value(state);
+ if (f->kind == FORM_CONSTANT)
+ {
+  return;
+ }
+ if (op == '^' && x.kind == FORM_CONSTANT && x.c >= 2 && y.kind == FORM_CONSTANT && y.c >= 1)
+ {
+  // b^n
+  f->kind = FORM_POWER;
+  f->k = 1;
+  f->b = x.c;
+  f->n = y.c;
+  f->c = 0;
+ }
+ else if (op == '*' && (x.kind == FORM_POWER || y.kind == FORM_POWER))
+ {
+  // k * b^n or b^n * k
+  struct gmp_expr_form_t p = x.kind == FORM_POWER ? x : y;
+  struct gmp_expr_form_t k = x.kind == FORM_POWER ? y : x;
+  uint64_t product;
+  if (p.c == 0 && k.kind == FORM_CONSTANT && k.c >= 1 && !__builtin_mul_overflow(p.k, (uint64_t)k.c, &product))
+  {
+   *f = p;
+   f->k = product;
+  }
+ }
+ else if ((op == '+' || op == '-') && x.kind == FORM_POWER && y.kind == FORM_CONSTANT)
+ {
+  // k * b^n + c - c ...
+  int64_t c;
+  bool overflow = op == '+' ? __builtin_add_overflow(x.c, y.c, &c) : __builtin_sub_overflow(x.c, y.c, &c);
+  if (!overflow)
+  {
+   *f = x;
+   f->c = c;
+  }
+ }
+ else if (op == '+' && x.kind == FORM_CONSTANT && y.kind == FORM_POWER)
+ {
+  // c + k * b^n
+  int64_t c;
+  if (!__builtin_add_overflow(x.c, y.c, &c))
+  {
+   *f = y;
+   f->c = c;
+  }
+ }
+}
+
+static pthread_key_t gmp_expr_state_key;
+static pthread_once_t gmp_expr_state_once = PTHREAD_ONCE_INIT;
+
+static void gmp_expr_state_destroy(void *p)
+{
+ struct gmp_expr_state_t *state = (struct gmp_expr_state_t *)p;
+ for (unsigned i = 0; i < STACK_SIZE; i++) { mpz_clear(state->stack[i]); }
+ for (unsigned i = 0; i < POWER_CACHE_SIZE; i++) { mpz_clear(state->cache[i].value); }
+ gmp_expr_lex_destroy(state->scanner);
+ free(state);
+}
+
+static void gmp_expr_state_key_create(void)
+{
+ pthread_key_create(&gmp_expr_state_key, gmp_expr_state_destroy);
+}
+
+// one state per thread, created on first use, released at thread exit
+static struct gmp_expr_state_t *gmp_expr_state_get(void)
+{
+ pthread_once(&gmp_expr_state_once, gmp_expr_state_key_create);
+ struct gmp_expr_state_t *state = (struct gmp_expr_state_t *)pthread_getspecific(gmp_expr_state_key);
+ if (!state)
+ {
+  state = (struct gmp_expr_state_t *)calloc(1, sizeof(struct gmp_expr_state_t));
+  if (!state)
+  {
+   printf("Unable to allocate the parser state\n");
+   exit(1);
+  }
+  for (unsigned i = 0; i < STACK_SIZE; i++) { mpz_init(state->stack[i]); }
+  for (unsigned i = 0; i < POWER_CACHE_SIZE; i++) { mpz_init(state->cache[i].value); }
+  state->scanner = gmp_expr_lex_create();
+  pthread_setspecific(gmp_expr_state_key, state);
+ }
+ return state;
+}
+
+int mpz_expression_parse_checked(mpz_t n, char *str, struct number_form_t *form)
+{
+ struct gmp_expr_state_t *state = gmp_expr_state_get();
+ state->stack_ptr = state->stack[0];
+ mpz_set_ui(state->stack[0], 0);
+ state->forms[0].kind = FORM_NONE;
+ gmp_expr_lex_start(state->scanner, str);
+ if (yyparse(state->scanner, state) != 0)
+ {
+  // the parse stopped at the first error, the stack is not a result
+  mpz_set_ui(n, 0);
+  return -1;
+ }
+ mpz_set(n, state->stack[0]);
+ struct gmp_expr_form_t *f = &state->forms[0];
+ if (f->kind != FORM_POWER)
+ {
+  return 0;
+ }
+ if (form)
+ {
+  form->k = f->k;
+  form->b = f->b;
+  form->n = f->n;
+  form->c = f->c;
+ }
+ return 1;
+}
+
+bool mpz_expression_parse_form(mpz_t n, char *str, struct number_form_t *form)
+{
+ return mpz_expression_parse_checked(n, str, form) > 0;
+}
+
 void mpz_expression_parse(mpz_t n, char *str)
 {
- for (unsigned i = 0; i < STACK_SIZE; i++) { mpz_init(stack[i]); }
- stack_ptr = stack[0];
-gmp_expr_lex_init(str);
- yyparse();
-gmp_expr_lex_terminate();
- mpz_set(n , stack[0]);
- for (unsigned i = 0; i < STACK_SIZE; i++) { mpz_clear (stack[i]); }
+ mpz_expression_parse_form(n, str, 0);
 }
 
-int yyerror(const char *s)
+// ------------------------------------------------------------------------------
+// Simple foolguard unit tests
+// ------------------------------------------------------------------------------
+
+void mpz_expression_self_test(void)
+{
+ printf("Expressions ...\n");
+ mpz_t n;
+ mpz_init(n);
+ char e1[] = "2*(12*12+1)-1";
+ mpz_expression_parse(n, e1);
+ assert(mpz_cmp_ui(n, 289) == 0);
+ char e2[] = "5!+1";
+ mpz_expression_parse(n, e2);
+ assert(mpz_cmp_ui(n, 121) == 0);
+ char e3[] = "9!!";
+ mpz_expression_parse(n, e3);
+ assert(mpz_cmp_ui(n, 945) == 0);
+ char e4[] = "10!!!";
+ mpz_expression_parse(n, e4);
+ assert(mpz_cmp_ui(n, 280) == 0);
+ char e5[] = "13#-1";
+ mpz_expression_parse(n, e5);
+ assert(mpz_cmp_ui(n, 30029) == 0);
+ // postfix operators bind tighter than ^ and unary -
+ char e6[] = "2^3!-3!!";
+ mpz_expression_parse(n, e6);
+ assert(mpz_cmp_ui(n, 61) == 0);
+ // large results have no k * b^n + c form
+ number_form_t form;
+ char e7[] = "1000#+1";
+ assert(mpz_expression_parse_form(n, e7, &form) == false);
+ char e8[] = "3*2^1000-1";
+ assert(mpz_expression_parse_form(n, e8, &form) == true);
+ assert(form.k == 3 && form.b == 2 && form.n == 1000 && form.c == -1);
+ // the parse stops at the first error
+ char e9[] = "2*(3+1";
+ assert(mpz_expression_parse_checked(n, e9, &form) == -1);
+ char e10[] = "2^127-1$";
+ assert(mpz_expression_parse_checked(n, e10, &form) == -1);
+ char e11[] = "12/(3-3)";
+ assert(mpz_expression_parse_checked(n, e11, &form) == -1);
+ char e12[] = "3-5";
+ assert(mpz_expression_parse_checked(n, e12, &form) == -1);
+ char e13[] = "2^-3";
+ assert(mpz_expression_parse_checked(n, e13, &form) == -1);
+ char e14[] = "3^99999999999";
+ assert(mpz_expression_parse_checked(n, e14, &form) == -1);
+ // more operands waiting than the stack has room for
+ char e15[4 * STACK_SIZE + 8] = "";
+ for (unsigned i = 0; i < STACK_SIZE + 1; i++) { strcat(e15, "1+("); }
+ strcat(e15, "1");
+ for (unsigned i = 0; i < STACK_SIZE + 1; i++) { strcat(e15, ")"); }
+ assert(mpz_expression_parse_checked(n, e15, &form) == -1);
+ // the state is clean after an error
+ char e16[] = "2*(12*12+1)-1";
+ assert(mpz_expression_parse_checked(n, e16, &form) == 0);
+ assert(mpz_cmp_ui(n, 289) == 0);
+ mpz_clear(n);
+}
+
+int yyerror(void *scanner, struct gmp_expr_state_t *state, const char *s)
 {
  fprintf(stderr,"error: %s\n",s);
  return 0;
 }
-
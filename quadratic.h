@@ -0,0 +1,55 @@
+#pragma once
+
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// C interface of libquadratic.a / libquadratic.so
+//
+// quadratic_context_t
+//    opaque scratch space reused from one test to the next. A context must
+//    not be shared between threads, create one per thread.
+//
+// quadratic_test_mpz(), quadratic_test_uint64(), quadratic_test_expression()
+//    1 : might be prime
+//    0 : composite for sure
+//
+// quadratic_test_expression() parses expressions like 2^127-1.
+//   -1 : invalid expression (the parser error is printed on stderr), or
+//        out of memory, nothing is tested
+//
+// quadratic_test_batch_mpz(), quadratic_test_batch_uint64()
+//    test count numbers with the same context, one verdict byte per number
+//    (1 or 0 as above), return the number of possible primes.
+//    Batches amortize the call overhead and the scratch allocations when
+//    numbers are small.
+//
+// C++ callers get the native interface from quadratic_primality.h too.
+// -----------------------------------------------------------------------
+
+#include "gmp.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+#include "quadratic_primality.h"
+extern "C"
+{
+#else
+typedef struct quadratic_context_t quadratic_context_t;
+#endif
+
+    struct quadratic_context_t *quadratic_context_create(void);
+    void quadratic_context_destroy(struct quadratic_context_t *ctx);
+
+    int quadratic_test_mpz(struct quadratic_context_t *ctx, mpz_srcptr v);
+    int quadratic_test_uint64(uint64_t v);
+    int quadratic_test_expression(struct quadratic_context_t *ctx, const char *str);
+
+    size_t quadratic_test_batch_mpz(struct quadratic_context_t *ctx, const mpz_t *v, size_t count, uint8_t *verdicts);
+    size_t quadratic_test_batch_uint64(const uint64_t *v, size_t count, uint8_t *verdicts);
+
+    const char *quadratic_version(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -7,13 +7,23 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "quadratic_primality.h"
 #include "quadratic_primality_alloc.h"
+#include "quadratic_primality_cache.h"
 #include "quadratic_primality_precompute.h"
 
 typedef unsigned __int128 uint128_t;
 
+// monotonic time in nanoseconds, for optional statistics
+static inline uint64_t quadratic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 // x % (2^b -1)
 static uint64_t mpz_mod_mersenne(mpz_t x, uint64_t b)
 {
@@ -733,21 +743,49 @@ static inline __attribute__((always_inline)) void uint64_exponentiate(uint64_t &
     }
 }
 
+// grow a scratch number, never shrink it
+static inline void mpz_reserve(mpz_t x, unsigned bits)
+{
+    if ((unsigned)x->_mp_alloc * GMP_NUMB_BITS < bits)
+    {
+        mpz_realloc2(x, bits);
+    }
+}
+
+quadratic_context_t *quadratic_context_create(void)
+{
+    quadratic_context_t *ctx = (quadratic_context_t *)quadratic_allocate_function(sizeof(quadratic_context_t));
+    mpz_inits(ctx->temp, ctx->bs, ctx->bt, ctx->e, 0);
+    mpz_inits(ctx->s2, ctx->t2, ctx->t0, ctx->tmp, 0);
+    ctx->cancel = 0;
+    return ctx;
+}
+
+void quadratic_context_destroy(quadratic_context_t *ctx)
+{
+    if (ctx)
+    {
+        mpz_clears(ctx->temp, ctx->bs, ctx->bt, ctx->e, 0);
+        mpz_clears(ctx->s2, ctx->t2, ctx->t0, ctx->tmp, 0);
+        quadratic_free_function(ctx, sizeof(quadratic_context_t));
+    }
+}
+
 // Iterate a second order linear recurrence using "double and add" steps
 //  Mod(Mod(s*x+t,n),x^2-(sgn*a))^e
 //
 // Require input s == 1
 // Make output s,t < n
 static inline __attribute__((always_inline)) void mpz_exponentiate(mpz_t s, mpz_t t, mpz_t e, mod_precompute_t *p,
-                                                                   int sgn, uint64_t a)
+                                                                   int sgn, uint64_t a, quadratic_context_t *ctx)
 {
     unsigned bit = mpz_sizeinbase(e, 2) - 1;
     unsigned new_size = (p->n + 256) * 2;
-    mpz_t s2, t2, t0, tmp;
-    mpz_init2(s2, new_size);
-    mpz_init2(t2, new_size);
-    mpz_init2(t0, new_size);
-    mpz_init2(tmp, new_size);
+    mpz_ptr s2 = ctx->s2, t2 = ctx->t2, t0 = ctx->t0, tmp = ctx->tmp;
+    mpz_reserve(s2, new_size);
+    mpz_reserve(t2, new_size);
+    mpz_reserve(t0, new_size);
+    mpz_reserve(tmp, new_size);
     mpz_set(t0, t);
 
     mpz_mod_to_montg(s, p);
@@ -755,6 +793,11 @@ static inline __attribute__((always_inline)) void mpz_exponentiate(mpz_t s, mpz_
 
     while (bit--)
     {
+        if (ctx->cancel && __atomic_load_n(ctx->cancel, __ATOMIC_RELAXED))
+        {
+            break; // result is meaningless, the caller checks the flag again
+        }
+
         // Double
         // s, t = 2 * s*t, s^2 * a + t^2
         if (__builtin_constant_p(sgn) && sgn == -1 && __builtin_constant_p(a) && a == 1)
@@ -847,8 +890,6 @@ static inline __attribute__((always_inline)) void mpz_exponentiate(mpz_t s, mpz_
 
     mpz_mod_slow_reduce(s, p->m);
     mpz_mod_slow_reduce(t, p->m);
-
-    mpz_clears(s2, t2, t0, tmp, 0);
 }
 
 /*
@@ -857,7 +898,7 @@ If n==5 mod 8 test Mod(Mod(x+2,n),x^2+2)^(n+1)==6.
 If n==1 mod 8 test Mod(Mod(x+2,n),x^2-a)^(n+1)==4-a and Mod(Mod(x+2,n),x^2+a)^(n+1)==4+a for kronecker(a,n)==-1
 */
 
-static bool uint64_quadratic_primality(uint64_t n, bool verbose = false)
+bool uint64_quadratic_primality(uint64_t n, bool verbose, quadratic_stats_t *stats)
 {
     if (n >> 61)
     {
@@ -867,11 +908,23 @@ static bool uint64_quadratic_primality(uint64_t n, bool verbose = false)
         // More precise constraint is n < 2^64/6
         mpz_t v;
         mpz_init_set_ui(v, n);
-        bool r = mpz_quadratic_primality(v, verbose);
+        bool r = mpz_quadratic_primality(v, verbose, stats);
         mpz_clear(v);
         return r;
     }
 
+    uint64_t t0 = stats ? quadratic_ns() : 0;
+    if (stats)
+    {
+        stats->bits = n ? 64 - lzcnt(n) : 0;
+        stats->mod8 = n & 7;
+        stats->a = 0;
+        stats->reduction = "uint64";
+        stats->sieve_ns = 0;
+        stats->precompute_ns = 0;
+        stats->exponentiate_ns = 0;
+    }
+
     if ((n & 1) == 0)
     {
         return n == 2; // even
@@ -879,6 +932,12 @@ static bool uint64_quadratic_primality(uint64_t n, bool verbose = false)
 
     // sieve small numbers with small factors
     sieve_t sv = uint64_composite_sieve(n);
+    if (stats)
+    {
+        uint64_t t1 = quadratic_ns();
+        stats->sieve_ns = t1 - t0;
+        t0 = t1;
+    }
     switch (sv)
     {
     case COMPOSITE_FOR_SURE:
@@ -906,6 +965,11 @@ static bool uint64_quadratic_primality(uint64_t n, bool verbose = false)
         // (x+2)^(n+1) mod (n, x^2+1) == 5
         uint64_exponentiate(bs, bt, n + 1, n, -1, 1);
         // printf("3 mod 4 : %lx %lx %lx\n", bs, bt, n);
+        if (stats)
+        {
+            stats->a = 1;
+            stats->exponentiate_ns = quadratic_ns() - t0;
+        }
         return (bs == 0 && bt == 5); // ?? n prime ? n composite for sure ?
     }
     if (mod8 == 5)
@@ -913,6 +977,11 @@ static bool uint64_quadratic_primality(uint64_t n, bool verbose = false)
         // (x+2)^(n+1) mod (n, x^2+2) == 6
         uint64_exponentiate(bs, bt, n + 1, n, -1, 2);
         // printf("5 mod 8 : %lx %lx %lx\n", bs, bt, n);
+        if (stats)
+        {
+            stats->a = 2;
+            stats->exponentiate_ns = quadratic_ns() - t0;
+        }
         return (bs == 0 && bt == 6); // ?? n prime ? n composite for sure ?
     }
 
@@ -949,16 +1018,30 @@ static bool uint64_quadratic_primality(uint64_t n, bool verbose = false)
         if (j == -1)
             break;
     }
+    if (stats)
+    {
+        stats->a = a;
+    }
     // (x+2)^(n+1) mod (n, x^2+a) == 4+a
     uint64_exponentiate(bs, bt, n + 1, n, -1, a);
     temp = 4 + a;
     if (!(bs == 0 && bt == temp))
+    {
+        if (stats)
+        {
+            stats->exponentiate_ns = quadratic_ns() - t0;
+        }
         return false; // composite for sure
+    }
 
     // (x+2)^(n+1) mod (n, x^2-a) == 4-a
     bs = 1;
     bt = 2;
     uint64_exponentiate(bs, bt, n + 1, n, 1, a);
+    if (stats)
+    {
+        stats->exponentiate_ns = quadratic_ns() - t0;
+    }
     temp = 4 + n - a;
     temp = temp >= n ? temp - n : temp;
     if (!(bs == 0 && bt == temp))
@@ -972,7 +1055,8 @@ static bool uint64_quadratic_primality(uint64_t n, bool verbose = false)
     return true; // ?? n prime ?
 }
 
-bool mpz_quadratic_primality(mpz_t n, bool verbose)
+bool mpz_quadratic_primality(mpz_t n, bool verbose, quadratic_stats_t *stats, quadratic_context_t *ctx,
+                             const number_form_t *form)
 {
     if (verbose)
     {
@@ -982,7 +1066,38 @@ bool mpz_quadratic_primality(mpz_t n, bool verbose)
     if (mpz_cmp_ui(n, 1ull << 61) < 0)
     {
         // the quadratic test will run in 64 bits calculations
-        return uint64_quadratic_primality(mpz_get_ui(n), verbose);
+        return uint64_quadratic_primality(mpz_get_ui(n), verbose, stats);
+    }
+
+    uint64_t t0 = stats ? quadratic_ns() : 0;
+    if (stats)
+    {
+        stats->bits = mpz_sizeinbase(n, 2);
+        stats->mod8 = mpz_get_ui(n) & 7;
+        stats->a = 0;
+        stats->reduction = "none";
+        stats->sieve_ns = 0;
+        stats->precompute_ns = 0;
+        stats->exponentiate_ns = 0;
+    }
+
+    // a previous run, or another process, may know this number
+    quadratic_cache_t *cache = quadratic_cache_attached();
+    if (cache)
+    {
+        int known = quadratic_cache_lookup(cache, n);
+        if (known >= 0)
+        {
+            if (verbose)
+            {
+                printf("Number found in the cache\n");
+            }
+            if (stats)
+            {
+                stats->reduction = "cache";
+            }
+            return known == 1;
+        }
     }
 
     if (mpz_tstbit(n, 0) == 0)
@@ -997,6 +1112,12 @@ bool mpz_quadratic_primality(mpz_t n, bool verbose)
     // detects small primes, small composites
     // detects smooth composites
     sieve_t sv = mpz_composite_sieve(n);
+    if (stats)
+    {
+        uint64_t t1 = quadratic_ns();
+        stats->sieve_ns = t1 - t0;
+        t0 = t1;
+    }
     switch (sv)
     {
     case COMPOSITE_FOR_SURE:
@@ -1016,42 +1137,59 @@ bool mpz_quadratic_primality(mpz_t n, bool verbose)
         break;
     }
 
-    mpz_t temp, bs, bt, e;
+    quadratic_context_t *own = ctx ? 0 : quadratic_context_create();
+    ctx = ctx ? ctx : own;
+    mpz_ptr temp = ctx->temp, bs = ctx->bs, bt = ctx->bt, e = ctx->e;
     bool r = true;
-    mpz_inits(temp, bs, bt, e, 0);
     uint64_t mod8 = mpz_mod_ui(temp, n, 8);
     mpz_set_ui(bs, 1);
     mpz_set_ui(bt, 2);
     mpz_add_ui(e, n, 1);
-    mod_precompute_t *pcpt = mpz_mod_precompute(n, verbose);
+    mod_precompute_t *pcpt = form ? mpz_mod_precompute_form(n, form, verbose) : mpz_mod_precompute(n, verbose);
+    if (stats)
+    {
+        uint64_t t1 = quadratic_ns();
+        stats->reduction = mpz_mod_reduction_name(pcpt);
+        stats->precompute_ns = t1 - t0;
+        t0 = t1;
+    }
     if (mod8 == 3 || mod8 == 7)
     {
         // Check (x+2)^(n+1) mod (n, x^2+1) == 5
-        mpz_exponentiate(bs, bt, e, pcpt, -1, 1);
+        mpz_exponentiate(bs, bt, e, pcpt, -1, 1, ctx);
         r = (mpz_cmp_ui(bs, 0) == 0 && mpz_cmp_ui(bt, 5) == 0); // ?? n prime ? n composite for sure ?
+        if (stats)
+        {
+            stats->a = 1;
+        }
     }
     else if (mod8 == 5)
     {
         // Check (x+2)^(n+1) mod (n, x^2+2) == 6
-        mpz_exponentiate(bs, bt, e, pcpt, -1, 2);
+        mpz_exponentiate(bs, bt, e, pcpt, -1, 2, ctx);
         r = (mpz_cmp_ui(bs, 0) == 0 && mpz_cmp_ui(bt, 6) == 0); // ?? n prime ? n composite for sure ?
+        if (stats)
+        {
+            stats->a = 2;
+        }
     }
-    else
+    else if (mpz_is_perfect_square(n))
     {
         // mod8 == 1
-        if (mpz_is_perfect_square(n))
+        if (verbose)
         {
-            if (verbose)
-            {
-                printf("Number is a perfect square\n");
-            }
-            return false; // n composite perfect square, and for any x, kronecker(x, n)==1
+            printf("Number is a perfect square\n");
         }
-
+        r = false; // n composite perfect square, and for any x, kronecker(x, n)==1
+    }
+    else
+    {
+        // mod8 == 1
         // search minimal a where Kronecker(a, n) == -1 (since n is odd, jacobi
         // symbol will do it)
         // This code assumes a will never overflow
         uint64_t a;
+        int j;
         for (a = 3;; a += 2)
         {
             if (verbose)
@@ -1062,36 +1200,55 @@ bool mpz_quadratic_primality(mpz_t n, bool verbose)
             if (!uint64_quadratic_primality(a))
                 continue;
 
-            int j = uint64_jacobi(a, mpz_mod_ui(temp, n, 4 * a));
-            if (j == 0)
+            j = uint64_jacobi(a, mpz_mod_ui(temp, n, 4 * a));
+            if (j != 1)
+                break;
+        }
+        if (j == 0)
+        {
+            if (verbose)
             {
-                if (verbose)
-                {
-                    printf("Number has a small factor\n");
-                }
-                return false; // composite for sure
+                printf("Number has a small factor\n");
             }
-            if (j == -1)
-                break;
+            r = false; // composite for sure
+        }
+        else
+        {
+            if (stats)
+            {
+                stats->a = a;
+            }
+            // Check (x+2)^(n+1) mod (n, x^2+a) == 4+a
+            mpz_exponentiate(bs, bt, e, pcpt, -1, a, ctx);
+            r = (mpz_cmp_ui(bs, 0) == 0 && mpz_cmp_ui(bt, a + 4) == 0); // ?? n prime ? n composite for sure ?
         }
-        // Check (x+2)^(n+1) mod (n, x^2+a) == 4+a
-        mpz_exponentiate(bs, bt, e, pcpt, -1, a);
-        r = (mpz_cmp_ui(bs, 0) == 0 && mpz_cmp_ui(bt, a + 4) == 0); // ?? n prime ? n composite for sure ?
 
         if (r)
         {
             // Check (x+2)^(n+1) mod (n, x^2-a) == 4-a
             mpz_set_ui(bs, 1);
             mpz_set_ui(bt, 2);
-            mpz_exponentiate(bs, bt, e, pcpt, 1, a);
+            mpz_exponentiate(bs, bt, e, pcpt, 1, a, ctx);
             mpz_sub_ui(temp, n, a);
             mpz_add_ui(temp, temp, 4);
             mpz_mod(temp, temp, n);
             r = (mpz_cmp_ui(bs, 0) == 0 && mpz_cmp(bt, temp) == 0); // ?? n prime ? n composite for sure ?
         }
     }
+    if (ctx->cancel && __atomic_load_n(ctx->cancel, __ATOMIC_RELAXED))
+    {
+        r = false; // abandoned
+    }
+    else if (cache)
+    {
+        quadratic_cache_store(cache, n, r);
+    }
+    if (stats)
+    {
+        stats->exponentiate_ns = quadratic_ns() - t0;
+    }
 
-    mpz_clears(temp, bs, bt, e, 0);
+    quadratic_context_destroy(own);
     mpz_mod_uncompute(pcpt);
 
     if (verbose && r == false)
@@ -1270,6 +1427,34 @@ void quadratic_primality_self_test(void)
 
     // clears temp structure
     mpz_mod_uncompute(p);
+
+    // verify 2^352-2^175-1 is not reduced as a*2^s-b, b is too large to converge
+    mpz_set_ui(ma, 1);
+    mpz_mul_2exp(ma, ma, 352);
+    mpz_set_ui(mb, 1);
+    mpz_mul_2exp(mb, mb, 175);
+    mpz_sub(ma, ma, mb);
+    mpz_sub_ui(ma, ma, 1);
+    p = mpz_mod_precompute(ma);
+    assert(p->gmn == false);
+    mpz_mod_uncompute(p);
+
+    // verify the reduction chosen from the form 5*2^200-3
+    number_form_t form = {5, 2, 200, -3};
+    mpz_set_ui(ma, 5);
+    mpz_mul_2exp(ma, ma, 200);
+    mpz_sub_ui(ma, ma, 3);
+    p = mpz_mod_precompute_form(ma, &form);
+    assert(p->gmn == true);
+    assert(p->montg == true);
+    assert(p->n2 == 200);
+    mpz_mod_uncompute(p);
+
+    // a form which does not describe the number is ignored
+    mpz_add_ui(ma, ma, 6);
+    p = mpz_mod_precompute_form(ma, &form);
+    assert(p->gmn == false);
+    mpz_mod_uncompute(p);
     p = 0;
     mpz_clear(x);
 
@@ -1312,6 +1497,7 @@ void quadratic_primality_self_test(void)
     printf("Small primes (mpz sanity check)\n");
     mpz_t ms, mt, me, mtmp;
     mpz_inits(ms, mt, me, mtmp, 0);
+    quadratic_context_t *ctx = quadratic_context_create();
 
     // quick tests mod 31
     mpz_set_ui(ma, 31);
@@ -1320,26 +1506,26 @@ void quadratic_primality_self_test(void)
     mpz_set_ui(ms, 2);
     mpz_set_ui(mt, 1);
     mpz_set_ui(me, 2);
-    mpz_exponentiate(ms, mt, me, p, 1, 3);
+    mpz_exponentiate(ms, mt, me, p, 1, 3, ctx);
     assert(mpz_cmp_ui(ms, 4) == 0);
     assert(mpz_cmp_ui(mt, 13) == 0);
     mpz_set_ui(ms, 2);
     mpz_set_ui(mt, 1);
     mpz_set_ui(me, 2);
-    mpz_exponentiate(ms, mt, me, p, -1, 3);
+    mpz_exponentiate(ms, mt, me, p, -1, 3, ctx);
     assert(mpz_cmp_ui(ms, 4) == 0);
     assert(mpz_cmp_ui(mt, 20) == 0);
 
     mpz_set_ui(ms, 1);
     mpz_set_ui(mt, 5);
     mpz_set_ui(me, 3);
-    mpz_exponentiate(ms, mt, me, p, 1, 3);
+    mpz_exponentiate(ms, mt, me, p, 1, 3, ctx);
     assert(mpz_cmp_ui(ms, 16) == 0);
     assert(mpz_cmp_ui(mt, 15) == 0);
     mpz_set_ui(ms, 1);
     mpz_set_ui(mt, 5);
     mpz_set_ui(me, 3);
-    mpz_exponentiate(ms, mt, me, p, -1, 3);
+    mpz_exponentiate(ms, mt, me, p, -1, 3, ctx);
     assert(mpz_cmp_ui(ms, 10) == 0);
     assert(mpz_cmp_ui(mt, 18) == 0);
     mpz_mod_uncompute(p);
@@ -1352,13 +1538,13 @@ void quadratic_primality_self_test(void)
     mpz_set_ui(ms, 1);
     mpz_set_ui(mt, 5);
     mpz_set_ui(me, 0xa);
-    mpz_exponentiate(ms, mt, me, p, 1, 3);
+    mpz_exponentiate(ms, mt, me, p, 1, 3, ctx);
     assert(mpz_cmp_ui(ms, 55152800) == 0);
     assert(mpz_cmp_ui(mt, 95666368) == 0);
     mpz_set_ui(ms, 1);
     mpz_set_ui(mt, 5);
     mpz_set_ui(me, 0xa);
-    mpz_exponentiate(ms, mt, me, p, -1, 3);
+    mpz_exponentiate(ms, mt, me, p, -1, 3, ctx);
     mpz_set_str(mtmp, "618970019642690137447654941", 10);
     assert(mpz_cmp(ms, mtmp) == 0);
     mpz_set_str(mtmp, "618970019642690137432671773", 10);
@@ -1374,20 +1560,21 @@ void quadratic_primality_self_test(void)
     mpz_set_ui(ms, 1);
     mpz_set_ui(mt, 5);
     mpz_set_ui(me, 0x8); // exponent sequence is doubling-only
-    mpz_exponentiate(ms, mt, me, p, 1, 3);
+    mpz_exponentiate(ms, mt, me, p, 1, 3, ctx);
     assert(mpz_cmp_ui(ms, 1214080) == 0);
     assert(mpz_cmp_ui(mt, 2115856) == 0);
 
     mpz_set_ui(ms, 1);
     mpz_set_ui(mt, 5);
     mpz_set_ui(me, 0x9); // exponent sequence is doubling-add
-    mpz_exponentiate(ms, mt, me, p, 1, 3);
+    mpz_exponentiate(ms, mt, me, p, 1, 3, ctx);
     //    gmp_printf("%Zd %Zd\n", ms, mt);
     assert(mpz_cmp_ui(ms, 8186256) == 0);
     assert(mpz_cmp_ui(mt, 14221520) == 0);
     mpz_mod_uncompute(p);
 
     mpz_clears(ms, mt, me, mtmp, 0);
+    quadratic_context_destroy(ctx);
 
     // ---------------------------------------------------------------------------------
     uint32_t smallq[] = {
@@ -1423,7 +1610,8 @@ void quadratic_primality_self_test(void)
     // ---------------------------------------------------------------------------------
     uint32_t smallp[] = {2,  3,  5,  7,  11, 13, 17, 19, 23, 29, 31, 37,  41,  43,
                          47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 0};
-    printf("Medium composites (mpz)\n");
+    printf("Medium composites (mpz, reused context)\n");
+    ctx = quadratic_context_create();
     for (int j = 0; smallp[j]; j++)
     {
         // Composites p * (2^127-1) must be catched
@@ -1431,17 +1619,29 @@ void quadratic_primality_self_test(void)
         mpz_mul_2exp(ma, ma, 127);
         mpz_sub_ui(ma, ma, 1);
         mpz_mul_ui(ma, ma, smallp[j]);
-        bool res = mpz_quadratic_primality(ma);
+        bool res = mpz_quadratic_primality(ma, false, 0, ctx);
         if (res)
         {
             printf("error at %d %d\n", (int)j, (int)smallp[j]);
             assert(res == false);
         }
+        // and the prime itself, with the same context
+        mpz_divexact_ui(ma, ma, smallp[j]);
+        assert(mpz_quadratic_primality(ma, false, 0, ctx) == true);
     }
+    quadratic_context_destroy(ctx);
 
     // ---------------------------------------------------------------------------------
     printf("Large primes (mpz)\n");
 
+    // 3*2^827-1 is prime, reduced as a*2^s-b with a = 3
+    mpz_set_ui(ma, 3);
+    mpz_mul_2exp(ma, ma, 827);
+    mpz_sub_ui(ma, ma, 1);
+    assert(mpz_quadratic_primality(ma) == true);
+    form = {3, 2, 827, -1};
+    assert(mpz_quadratic_primality(ma, false, 0, 0, &form) == true);
+
     // 11111...6442446...11111 (1001-digits) The smallest zeroless titanic palindromic prime
     // https://t5k.org/curios/page.php?number_id=3797
     char titanic[1002];
@@ -4,8 +4,25 @@
 // Cubic primality test
 //
 // mpz_quadratic_primality():
-//    true: composite for sure
-//    false: might be prime
+// uint64_quadratic_primality():
+//    true: might be prime
+//    false: composite for sure
+//
+// quadratic_stats_t
+//    optional details about the last test (residue class, reduction, a, timings)
+//
+// quadratic_context_t
+//    scratch numbers reused from one test to the next, one context per thread.
+//    mpz_quadratic_primality() uses a temporary context when none is given.
+//
+// number_form_t
+//    optional k * b^n + c structure of the number, when known from the input.
+//    It selects the modular reduction without searching the number bits.
+//    When ctx->cancel is set, the exponentiation loop stops as soon as
+//    *ctx->cancel becomes true and the number is reported composite.
+//
+// When a cache is attached (see quadratic_primality_cache.h), known numbers
+// are answered before the sieve, and new results are stored.
 //
 // quadratic_primality_self_test()
 //    simplified unit tests to detect a possible compiler/platform issue.
@@ -14,6 +31,36 @@
 
 #include "gmp.h"
 #include <stdbool.h>
+#include <stdint.h>
+
+#define QUADRATIC_VERSION "0.2"
+
+struct number_form_t;
+
+struct quadratic_stats_t
+{
+    uint64_t bits;            // log2(n)
+    uint64_t mod8;            // residue class n mod 8
+    uint64_t a;               // chosen a, 0 when decided before any exponentiation
+    const char *reduction;    // modular reduction mode
+    uint64_t sieve_ns;        // small factors detection
+    uint64_t precompute_ns;   // modular reduction setup
+    uint64_t exponentiate_ns; // linear recurrences
+};
+
+struct quadratic_context_t
+{
+    mpz_t temp, bs, bt, e; // test
+    mpz_t s2, t2, t0, tmp; // exponentiation
+    const bool *cancel;    // optional, set by another thread to abandon the test
+};
 
-bool mpz_quadratic_primality(mpz_t v, bool verbose = false);
+extern "C"
+{
+    struct quadratic_context_t *quadratic_context_create(void);
+    void quadratic_context_destroy(struct quadratic_context_t *ctx);
+}
+bool mpz_quadratic_primality(mpz_t v, bool verbose = false, struct quadratic_stats_t *stats = 0,
+                             struct quadratic_context_t *ctx = 0, const struct number_form_t *form = 0);
+bool uint64_quadratic_primality(uint64_t v, bool verbose = false, struct quadratic_stats_t *stats = 0);
 void quadratic_primality_self_test(void);
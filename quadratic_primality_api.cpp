@@ -0,0 +1,74 @@
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// C interface of libquadratic, see quadratic.h
+// -----------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bison.gmp_expr.h"
+#include "quadratic.h"
+
+int quadratic_test_mpz(quadratic_context_t *ctx, mpz_srcptr v)
+{
+    // the number is not modified by the test
+    return mpz_quadratic_primality((mpz_ptr)v, false, 0, ctx) ? 1 : 0;
+}
+
+int quadratic_test_uint64(uint64_t v)
+{
+    return uint64_quadratic_primality(v) ? 1 : 0;
+}
+
+int quadratic_test_expression(quadratic_context_t *ctx, const char *str)
+{
+    mpz_t v;
+    mpz_init(v);
+    // the parser wants a writable string
+    char *s = strdup(str);
+    if (!s)
+    {
+        mpz_clear(v);
+        return -1;
+    }
+    number_form_t form;
+    int has_form = mpz_expression_parse_checked(v, s, &form);
+    free(s);
+    if (has_form < 0)
+    {
+        // a typo is not a composite
+        mpz_clear(v);
+        return -1;
+    }
+    int r = mpz_quadratic_primality(v, false, 0, ctx, has_form ? &form : 0) ? 1 : 0;
+    mpz_clear(v);
+    return r;
+}
+
+size_t quadratic_test_batch_mpz(quadratic_context_t *ctx, const mpz_t *v, size_t count, uint8_t *verdicts)
+{
+    size_t primes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        verdicts[i] = mpz_quadratic_primality((mpz_ptr)v[i], false, 0, ctx) ? 1 : 0;
+        primes += verdicts[i];
+    }
+    return primes;
+}
+
+size_t quadratic_test_batch_uint64(const uint64_t *v, size_t count, uint8_t *verdicts)
+{
+    size_t primes = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        verdicts[i] = uint64_quadratic_primality(v[i]) ? 1 : 0;
+        primes += verdicts[i];
+    }
+    return primes;
+}
+
+const char *quadratic_version(void)
+{
+    return QUADRATIC_VERSION;
+}
@@ -0,0 +1,240 @@
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// work-stealing scheduler behind the asynchronous C++ interface
+// -----------------------------------------------------------------------
+
+#include <assert.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "quadratic_primality_async.h"
+
+quadratic_scheduler_t::quadratic_scheduler_t(unsigned thread_count) : next(0), pending(0), stopping(false)
+{
+    if (thread_count == 0)
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = n > 0 ? n : 1;
+    }
+    for (unsigned i = 0; i < thread_count; i++)
+    {
+        workers.emplace_back(new worker_t);
+    }
+    // start the threads once all deques exist, they steal from each other
+    for (unsigned i = 0; i < thread_count; i++)
+    {
+        workers[i]->thread = std::thread(&quadratic_scheduler_t::worker_loop, this, i);
+    }
+}
+
+quadratic_scheduler_t::~quadratic_scheduler_t()
+{
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &w : workers)
+    {
+        w->thread.join();
+    }
+}
+
+void quadratic_scheduler_t::push(task_t &&task)
+{
+    worker_t *w = workers[next++ % workers.size()].get();
+    {
+        std::lock_guard<std::mutex> guard(w->lock);
+        w->tasks.push_back(std::move(task));
+    }
+    pending++;
+    // the sleeping threads check pending under sleep_lock, no lost wakeup
+    std::lock_guard<std::mutex> guard(sleep_lock);
+    wake.notify_one();
+}
+
+bool quadratic_scheduler_t::pop(unsigned id, task_t &task)
+{
+    unsigned count = workers.size();
+    for (unsigned i = 0; i < count; i++)
+    {
+        worker_t *w = workers[(id + i) % count].get();
+        std::lock_guard<std::mutex> guard(w->lock);
+        if (!w->tasks.empty())
+        {
+            if (i == 0)
+            {
+                // own deque, oldest task first
+                task = std::move(w->tasks.front());
+                w->tasks.pop_front();
+            }
+            else
+            {
+                // steal from the other end, the owner is busy on the front
+                task = std::move(w->tasks.back());
+                w->tasks.pop_back();
+            }
+            pending--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void quadratic_scheduler_t::run(task_t &task, quadratic_context_t *ctx)
+{
+    quadratic_cancel_t *token = task.token.get();
+    ctx->cancel = token ? token->data() : 0;
+
+    if (!task.batch)
+    {
+        quadratic_verdict_t verdict = QUADRATIC_CANCELLED;
+        if (!token || !token->cancelled())
+        {
+            bool r = mpz_quadratic_primality(task.number.get_mpz_t(), false, 0, ctx);
+            verdict = r ? QUADRATIC_PRIME : QUADRATIC_COMPOSITE;
+        }
+        if (token && token->cancelled())
+        {
+            verdict = QUADRATIC_CANCELLED;
+        }
+        task.promise.set_value(verdict);
+    }
+    else
+    {
+        batch_t *b = task.batch.get();
+        for (size_t i = task.first; i < task.last; i++)
+        {
+            quadratic_verdict_t verdict = QUADRATIC_CANCELLED;
+            if (!token || !token->cancelled())
+            {
+                bool r = mpz_quadratic_primality(b->numbers[i].get_mpz_t(), false, 0, ctx);
+                verdict = r ? QUADRATIC_PRIME : QUADRATIC_COMPOSITE;
+            }
+            if (token && token->cancelled())
+            {
+                verdict = QUADRATIC_CANCELLED;
+            }
+            b->verdicts[i] = verdict;
+        }
+        // the last slice completes the batch
+        size_t done = task.last - task.first;
+        if (b->remaining.fetch_sub(done) == done)
+        {
+            b->promise.set_value(std::move(b->verdicts));
+        }
+    }
+    ctx->cancel = 0;
+}
+
+void quadratic_scheduler_t::worker_loop(unsigned id)
+{
+    quadratic_context_t *ctx = quadratic_context_create();
+    while (1)
+    {
+        task_t task;
+        if (pop(id, task))
+        {
+            run(task, ctx);
+            continue;
+        }
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        wake.wait(guard, [this] { return pending > 0 || stopping; });
+        if (stopping && pending == 0)
+        {
+            break;
+        }
+    }
+    quadratic_context_destroy(ctx);
+}
+
+std::future<quadratic_verdict_t> quadratic_scheduler_t::submit(mpz_class &&v,
+                                                               std::shared_ptr<quadratic_cancel_t> token)
+{
+    task_t task;
+    task.number = std::move(v);
+    task.token = std::move(token);
+    task.first = task.last = 0;
+    std::future<quadratic_verdict_t> f = task.promise.get_future();
+    push(std::move(task));
+    return f;
+}
+
+std::future<std::vector<quadratic_verdict_t>> quadratic_scheduler_t::submit_batch(
+    std::vector<mpz_class> &&v, std::shared_ptr<quadratic_cancel_t> token)
+{
+    std::shared_ptr<batch_t> b = std::make_shared<batch_t>();
+    size_t count = v.size();
+    b->numbers = std::move(v);
+    b->verdicts.resize(count, QUADRATIC_CANCELLED);
+    b->remaining = count;
+    std::future<std::vector<quadratic_verdict_t>> f = b->promise.get_future();
+    if (count == 0)
+    {
+        b->promise.set_value(std::move(b->verdicts));
+        return f;
+    }
+
+    // a few slices per thread, work stealing balances slices of uneven cost
+    size_t slices = workers.size() * 4;
+    size_t slice = (count + slices - 1) / slices;
+    for (size_t first = 0; first < count; first += slice)
+    {
+        task_t task;
+        task.batch = b;
+        task.first = first;
+        task.last = first + slice < count ? first + slice : count;
+        task.token = token;
+        push(std::move(task));
+    }
+    return f;
+}
+
+// ------------------------------------------------------------------------------
+// Simple foolguard unit tests
+// ------------------------------------------------------------------------------
+
+void quadratic_scheduler_self_test(void)
+{
+    printf("Scheduler ...\n");
+    quadratic_scheduler_t scheduler(4);
+
+    // single numbers, 2^127-1 is prime, 2^127+1 is divisible by 3
+    std::future<quadratic_verdict_t> f1 = scheduler.submit(mpz_class("170141183460469231731687303715884105727"));
+    std::future<quadratic_verdict_t> f2 = scheduler.submit(mpz_class("170141183460469231731687303715884105729"));
+    assert(f1.get() == QUADRATIC_PRIME);
+    assert(f2.get() == QUADRATIC_COMPOSITE);
+
+    // batch, same verdicts as direct calls, same order
+    std::vector<mpz_class> numbers, copies;
+    mpz_class p = 1;
+    p <<= 89;
+    for (unsigned i = 0; i < 1000; i++)
+    {
+        numbers.push_back(p + 2 * i + 1);
+        copies.push_back(p + 2 * i + 1);
+    }
+    std::vector<quadratic_verdict_t> verdicts = scheduler.submit_batch(std::move(numbers)).get();
+    assert(verdicts.size() == copies.size());
+    for (size_t i = 0; i < copies.size(); i++)
+    {
+        bool r = mpz_quadratic_primality(copies[i].get_mpz_t());
+        assert(verdicts[i] == (r ? QUADRATIC_PRIME : QUADRATIC_COMPOSITE));
+    }
+
+    // cancelled before the start
+    std::shared_ptr<quadratic_cancel_t> token = std::make_shared<quadratic_cancel_t>();
+    token->cancel();
+    assert(scheduler.submit(mpz_class("170141183460469231731687303715884105727"), token).get() == QUADRATIC_CANCELLED);
+
+    // cancelled while running, 2^9689-1 is prime, it never becomes composite
+    token = std::make_shared<quadratic_cancel_t>();
+    mpz_class m = 1;
+    m <<= 9689;
+    m -= 1;
+    std::future<quadratic_verdict_t> f3 = scheduler.submit(std::move(m), token);
+    usleep(1000);
+    token->cancel();
+    assert(f3.get() != QUADRATIC_COMPOSITE);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// asynchronous C++ interface of libquadratic
+//
+// quadratic_scheduler_t
+//    runs the tests on its own threads. Each thread owns a deque of tasks and
+//    a quadratic context, idle threads steal tasks from the other deques.
+//    Numbers are moved into the scheduler, never copied.
+//
+//    submit() returns the verdict of one number.
+//    submit_batch() splits the numbers in slices spread over the threads and
+//    returns the verdicts in the same order as the numbers.
+//
+// quadratic_cancel_t
+//    can be shared by many submissions. After cancel(), pending tests return
+//    QUADRATIC_CANCELLED and running tests stop at the next bit of the
+//    exponentiation.
+//
+// e.g.
+//    quadratic_scheduler_t scheduler;
+//    std::future<quadratic_verdict_t> f = scheduler.submit(mpz_class("170141183460469231731687303715884105727"));
+//    ... other work ...
+//    bool prime = f.get() == QUADRATIC_PRIME;
+// -----------------------------------------------------------------------
+
+#include <gmpxx.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "quadratic_primality.h"
+
+enum quadratic_verdict_t
+{
+    QUADRATIC_COMPOSITE = 0, // composite for sure
+    QUADRATIC_PRIME = 1,     // might be prime
+    QUADRATIC_CANCELLED = 2, // test abandoned
+};
+
+class quadratic_cancel_t
+{
+  public:
+    quadratic_cancel_t() : flag(false)
+    {
+    }
+    void cancel()
+    {
+        __atomic_store_n(&flag, true, __ATOMIC_RELAXED);
+    }
+    bool cancelled() const
+    {
+        return __atomic_load_n(&flag, __ATOMIC_RELAXED);
+    }
+    const bool *data() const
+    {
+        return &flag;
+    }
+
+  private:
+    bool flag;
+};
+
+class quadratic_scheduler_t
+{
+  public:
+    quadratic_scheduler_t(unsigned thread_count = 0); // 0 : one thread per core
+    ~quadratic_scheduler_t();                         // wait for the submitted tests
+
+    quadratic_scheduler_t(const quadratic_scheduler_t &) = delete;
+    quadratic_scheduler_t &operator=(const quadratic_scheduler_t &) = delete;
+
+    std::future<quadratic_verdict_t> submit(mpz_class &&v, std::shared_ptr<quadratic_cancel_t> token = nullptr);
+    std::future<std::vector<quadratic_verdict_t>> submit_batch(std::vector<mpz_class> &&v,
+                                                               std::shared_ptr<quadratic_cancel_t> token = nullptr);
+
+  private:
+    struct batch_t
+    {
+        std::vector<mpz_class> numbers;
+        std::vector<quadratic_verdict_t> verdicts;
+        std::atomic<size_t> remaining;
+        std::promise<std::vector<quadratic_verdict_t>> promise;
+    };
+
+    struct task_t
+    {
+        mpz_class number;                           // single number
+        std::promise<quadratic_verdict_t> promise;
+        std::shared_ptr<batch_t> batch;             // or a slice of a batch
+        size_t first, last;
+        std::shared_ptr<quadratic_cancel_t> token;
+    };
+
+    struct worker_t
+    {
+        std::mutex lock;
+        std::deque<task_t> tasks; // owner pops front, thieves pop back
+        std::thread thread;
+    };
+
+    void push(task_t &&task);
+    bool pop(unsigned id, task_t &task);
+    void run(task_t &task, quadratic_context_t *ctx);
+    void worker_loop(unsigned id);
+
+    std::vector<std::unique_ptr<worker_t>> workers;
+    std::atomic<unsigned> next;     // round robin submission
+    std::atomic<size_t> pending;    // tasks in all deques
+    std::mutex sleep_lock;
+    std::condition_variable wake;
+    bool stopping;
+};
+
+void quadratic_scheduler_self_test(void);
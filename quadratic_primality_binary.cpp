@@ -0,0 +1,313 @@
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// binary container for candidate numbers, mmap-ed reader and text converter
+// -----------------------------------------------------------------------
+
+#include <assert.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bison.gmp_expr.h"
+#include "quadratic_primality_alloc.h"
+#include "quadratic_primality_binary.h"
+
+struct quadratic_binary_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+};
+
+struct quadratic_binary_record_t
+{
+    uint64_t bits;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+// limbs can be used in place when they have the same layout as the file
+static inline bool quadratic_binary_zero_copy(const void *limbs)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return GMP_LIMB_BITS == 64 && ((uintptr_t)limbs & 7) == 0;
+#else
+    return false;
+#endif
+}
+
+struct quadratic_binary_t *quadratic_binary_open(const char *name)
+{
+    struct stat st;
+    int fd = open(name, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(name);
+        return 0;
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(quadratic_binary_header_t))
+    {
+        printf("File %s is not a binary candidate file\n", name);
+        close(fd);
+        return 0;
+    }
+    void *base = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+    {
+        perror("mmap");
+        close(fd);
+        return 0;
+    }
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    const quadratic_binary_header_t *h = (const quadratic_binary_header_t *)base;
+    if (h->magic != QUADRATIC_BINARY_MAGIC || h->version != QUADRATIC_BINARY_VERSION)
+    {
+        printf("File %s has an invalid header\n", name);
+        munmap(base, st.st_size);
+        close(fd);
+        return 0;
+    }
+
+    quadratic_binary_t *f = (quadratic_binary_t *)quadratic_allocate_function(sizeof(quadratic_binary_t));
+    f->base = (const uint8_t *)base;
+    f->size = st.st_size;
+    f->offset = sizeof(quadratic_binary_header_t);
+    f->count = h->count;
+    f->fd = fd;
+    mpz_init(f->owned);
+    return f;
+}
+
+// return the next number, or 0 at end of file.
+// The returned number is read-only and valid until the next call.
+mpz_ptr quadratic_binary_next(struct quadratic_binary_t *f, struct number_form_t *form, bool *has_form)
+{
+    if (f->offset + sizeof(quadratic_binary_record_t) > f->size)
+    {
+        return 0;
+    }
+    const quadratic_binary_record_t *r = (const quadratic_binary_record_t *)(f->base + f->offset);
+    size_t limbs = (r->bits + 63) / 64;
+    size_t len = sizeof(quadratic_binary_record_t) + limbs * 8;
+    if (r->flags & QUADRATIC_BINARY_FORM)
+    {
+        len += sizeof(number_form_t);
+    }
+    if (limbs > (f->size - f->offset) / 8 || f->offset + len > f->size)
+    {
+        printf("Truncated record at offset %lu\n", (unsigned long)f->offset);
+        return 0;
+    }
+    const uint8_t *p = f->base + f->offset + sizeof(quadratic_binary_record_t);
+    if (r->flags & QUADRATIC_BINARY_FORM)
+    {
+        if (form)
+        {
+            memcpy(form, p, sizeof(number_form_t));
+        }
+        p += sizeof(number_form_t);
+    }
+    if (has_form)
+    {
+        *has_form = (r->flags & QUADRATIC_BINARY_FORM) != 0;
+    }
+    f->offset += len;
+
+    // strip leading zero limbs, GMP requires normalized numbers
+    const uint64_t *w = (const uint64_t *)p;
+    while (limbs > 0 && w[limbs - 1] == 0)
+    {
+        limbs--;
+    }
+    if (quadratic_binary_zero_copy(p))
+    {
+        // no copy, GMP reads the limbs straight from the mapped file
+        return (mpz_ptr)mpz_roinit_n(f->view, (const mp_limb_t *)p, limbs);
+    }
+    mpz_import(f->owned, limbs, -1, 8, -1, 0, p);
+    return f->owned;
+}
+
+void quadratic_binary_close(struct quadratic_binary_t *f)
+{
+    if (f)
+    {
+        munmap((void *)f->base, f->size);
+        close(f->fd);
+        mpz_clear(f->owned);
+        quadratic_free_function(f, sizeof(quadratic_binary_t));
+    }
+}
+
+static bool quadratic_binary_write(FILE *out, mpz_t v, const number_form_t *form)
+{
+    quadratic_binary_record_t r;
+    r.bits = mpz_sgn(v) ? mpz_sizeinbase(v, 2) : 0;
+    r.flags = form ? QUADRATIC_BINARY_FORM : 0;
+    r.reserved = 0;
+    size_t limbs = (r.bits + 63) / 64;
+    uint64_t *buff = (uint64_t *)quadratic_allocate_function(limbs * 8 + 8);
+    size_t count = 0;
+    mpz_export(buff, &count, -1, 8, -1, 0, v);
+    bool ok = fwrite(&r, sizeof(r), 1, out) == 1;
+    if (ok && form)
+    {
+        ok = fwrite(form, sizeof(number_form_t), 1, out) == 1;
+    }
+    ok = ok && fwrite(buff, 8, limbs, out) == limbs;
+    quadratic_free_function(buff, limbs * 8 + 8);
+    return ok;
+}
+
+// convert a text file, one expression per line, to a binary candidate file.
+// return the number of records, or -1 on error
+long quadratic_binary_convert(const char *text_name, const char *binary_name)
+{
+    FILE *f = fopen(text_name, "rt");
+    if (!f)
+    {
+        perror(text_name);
+        return -1;
+    }
+    FILE *out = fopen(binary_name, "wb");
+    if (!out)
+    {
+        perror(binary_name);
+        fclose(f);
+        return -1;
+    }
+    quadratic_binary_header_t h;
+    h.magic = QUADRATIC_BINARY_MAGIC;
+    h.version = QUADRATIC_BINARY_VERSION;
+    h.count = 0;
+    fwrite(&h, sizeof(h), 1, out);
+
+    const int buff_len = 1000000; // max line length
+    char *buff = (char *)malloc(buff_len);
+    if (!buff)
+    {
+        printf("Unable to allocate %d bytes\n", buff_len);
+        exit(1);
+    }
+    mpz_t v;
+    mpz_init(v);
+    long line = 0;
+    buff[buff_len - 2] = 0;
+    while (fgets(buff, buff_len, f))
+    {
+        line++;
+        if (buff[buff_len - 2] != 0)
+        {
+            printf("Input line %ld too long\n", line);
+            exit(1);
+        }
+        // trim leading and trailing spaces
+        int len = strlen(buff);
+        while (len > 0 && isspace(buff[len - 1]))
+        {
+            len--;
+        }
+        buff[len] = 0;
+        char *pt = buff;
+        while (isspace(*pt))
+        {
+            pt++;
+        }
+        if (*pt && *pt != '#') // discard empty lines or comments
+        {
+            number_form_t form;
+            bool has_form = mpz_expression_parse_form(v, pt, &form);
+            if (!quadratic_binary_write(out, v, has_form ? &form : 0))
+            {
+                perror(binary_name);
+                exit(1);
+            }
+            h.count++;
+        }
+    }
+    mpz_clear(v);
+    free(buff);
+    fclose(f);
+
+    // update the record count
+    fseek(out, 0, SEEK_SET);
+    fwrite(&h, sizeof(h), 1, out);
+    fclose(out);
+    return (long)h.count;
+}
+
+void quadratic_binary_self_test(void)
+{
+    printf("Binary ...\n");
+    char dir[] = "/tmp/quadratic_binary_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return;
+    }
+    char text_name[sizeof(dir) + 32], binary_name[sizeof(dir) + 32];
+    snprintf(text_name, sizeof(text_name), "%s/numbers.txt", dir);
+    snprintf(binary_name, sizeof(binary_name), "%s/numbers.bin", dir);
+
+    // zero, one limb, multi-limb, a k*b^n+c form, and a last record to truncate
+    FILE *f = fopen(text_name, "w");
+    assert(f);
+    fprintf(f, "0\n# comment\n12345678901\n\n  340282366920938463463374607431768211507  \n3*2^1000-1\n7*10^50+3\n");
+    fclose(f);
+    assert(quadratic_binary_convert(text_name, binary_name) == 5);
+
+    mpz_t expected[5];
+    for (unsigned i = 0; i < 5; i++)
+    {
+        mpz_init(expected[i]);
+    }
+    mpz_set_ui(expected[0], 0);
+    mpz_set_str(expected[1], "12345678901", 10);
+    mpz_set_str(expected[2], "340282366920938463463374607431768211507", 10);
+    mpz_ui_pow_ui(expected[3], 2, 1000);
+    mpz_mul_ui(expected[3], expected[3], 3);
+    mpz_sub_ui(expected[3], expected[3], 1);
+    mpz_ui_pow_ui(expected[4], 10, 50);
+    mpz_mul_ui(expected[4], expected[4], 7);
+    mpz_add_ui(expected[4], expected[4], 3);
+
+    for (unsigned truncated = 0; truncated < 2; truncated++)
+    {
+        quadratic_binary_t *b = quadratic_binary_open(binary_name);
+        assert(b && b->count == 5);
+        unsigned records = truncated ? 4 : 5;
+        for (unsigned i = 0; i < records; i++)
+        {
+            number_form_t form;
+            bool has_form = false;
+            mpz_ptr v = quadratic_binary_next(b, &form, &has_form);
+            assert(v && mpz_cmp(v, expected[i]) == 0);
+            assert(has_form == (i >= 3));
+            if (i == 3)
+            {
+                assert(form.k == 3 && form.b == 2 && form.n == 1000 && form.c == -1);
+            }
+        }
+        // end of file, or the last record cut by one limb
+        assert(quadratic_binary_next(b, 0, 0) == 0);
+        quadratic_binary_close(b);
+        struct stat st;
+        assert(stat(binary_name, &st) == 0 && truncate(binary_name, st.st_size - 8) == 0);
+    }
+
+    for (unsigned i = 0; i < 5; i++)
+    {
+        mpz_clear(expected[i]);
+    }
+    unlink(binary_name);
+    unlink(text_name);
+    rmdir(dir);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// compact binary container for candidate numbers, avoids parsing large
+// decimal strings.
+//
+// file layout, all fields little-endian, all fields 8-byte aligned
+//
+//    header : "QPTB" magic, uint32 version, uint64 record count
+//    record : uint64 bit length, uint32 flags, uint32 reserved
+//             [ form descriptor : uint64 k, uint64 b, uint64 n, int64 c ]  when flags & QUADRATIC_BINARY_FORM
+//             limbs : (bit length + 63) / 64 uint64 words, least significant word first
+//
+// The form descriptor is optional and describes the number as k * b^n + c.
+// -----------------------------------------------------------------------
+
+#include "gmp.h"
+#include "quadratic_primality_precompute.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define QUADRATIC_BINARY_MAGIC 0x42545051 // "QPTB"
+#define QUADRATIC_BINARY_VERSION 1
+#define QUADRATIC_BINARY_FORM 1
+
+struct quadratic_binary_t
+{
+    const uint8_t *base; // mmap-ed file
+    size_t size;         // file size
+    size_t offset;       // next record
+    uint64_t count;      // record count from header
+    mpz_t owned;         // used when limbs cannot be mapped in place
+    mpz_t view;          // read-only view on mapped limbs
+    int fd;
+};
+
+struct quadratic_binary_t *quadratic_binary_open(const char *name);
+mpz_ptr quadratic_binary_next(struct quadratic_binary_t *f, struct number_form_t *form, bool *has_form);
+void quadratic_binary_close(struct quadratic_binary_t *f);
+long quadratic_binary_convert(const char *text_name, const char *binary_name);
+
+void quadratic_binary_self_test(void);
@@ -0,0 +1,416 @@
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// persistent result cache, mmap-ed hash tables shared between processes
+// -----------------------------------------------------------------------
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "quadratic_primality.h"
+#include "quadratic_primality_cache.h"
+
+#define CACHE_MAGIC "QPTCACHE"
+#define CACHE_FORMAT 1
+#define CACHE_HEADER_SIZE 4096 // slots start on a page boundary
+#define CACHE_FIRST_BITS 20    // 2^20 slots (16 MBytes) in the first file, twice more in each next file
+#define CACHE_GENERATIONS 16
+#define CACHE_PROBES 64 // linear probing limit, a table is full when no free slot is found
+
+struct cache_header_t
+{
+    char magic[8];
+    uint32_t format;
+    uint32_t bits; // log2 of the slot count
+    uint64_t count;
+    uint32_t full; // new results go to the next file
+    uint32_t reserved;
+};
+
+struct cache_slot_t
+{
+    uint64_t h0; // odd when used, 0 when free
+    uint64_t h1; // verdict in the lowest bit
+};
+
+struct cache_generation_t
+{
+    int fd;
+    size_t size;
+    cache_header_t *header;
+    cache_slot_t *slots;
+    uint64_t mask;
+};
+
+struct quadratic_cache_t
+{
+    char *dir;
+    uint64_t seed;          // from QUADRATIC_VERSION, results of other versions are not found
+    pthread_mutex_t lock;   // flock does not exclude the threads which share a descriptor
+    unsigned count;         // open generations, readers load it without the lock
+    cache_generation_t generations[CACHE_GENERATIONS];
+};
+
+static quadratic_cache_t *cache_attached = 0;
+
+// ------------------------------------------------------------------------------
+// 128-bit hash of the limbs, MurmurHash3 x64 128
+// ------------------------------------------------------------------------------
+
+static inline uint64_t cache_rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t cache_fmix(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdull;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ull;
+    k ^= k >> 33;
+    return k;
+}
+
+static void cache_hash(const quadratic_cache_t *cache, mpz_srcptr n, uint64_t *h0, uint64_t *h1)
+{
+    const uint64_t c1 = 0x87c37b91114253d5ull;
+    const uint64_t c2 = 0x4cf5ad432745937full;
+    uint64_t a = cache->seed, b = cache->seed;
+    size_t words = mpz_size(n);
+    size_t i = 0;
+    for (; i + 1 < words; i += 2)
+    {
+        uint64_t k1 = mpz_getlimbn(n, i);
+        uint64_t k2 = mpz_getlimbn(n, i + 1);
+        k1 *= c1;
+        k1 = cache_rotl(k1, 31);
+        k1 *= c2;
+        a ^= k1;
+        a = cache_rotl(a, 27);
+        a += b;
+        a = a * 5 + 0x52dce729;
+        k2 *= c2;
+        k2 = cache_rotl(k2, 33);
+        k2 *= c1;
+        b ^= k2;
+        b = cache_rotl(b, 31);
+        b += a;
+        b = b * 5 + 0x38495ab5;
+    }
+    if (i < words)
+    {
+        uint64_t k1 = mpz_getlimbn(n, i);
+        k1 *= c1;
+        k1 = cache_rotl(k1, 31);
+        k1 *= c2;
+        a ^= k1;
+    }
+    a ^= words * 8;
+    b ^= words * 8;
+    a += b;
+    b += a;
+    a = cache_fmix(a);
+    b = cache_fmix(b);
+    a += b;
+    b += a;
+    *h0 = a | 1;
+    *h1 = b & ~1ull;
+}
+
+// ------------------------------------------------------------------------------
+// files
+// ------------------------------------------------------------------------------
+
+static bool cache_open_generation(quadratic_cache_t *cache, unsigned g, bool create)
+{
+    char name[4096];
+    snprintf(name, sizeof(name), "%s/quadratic.cache.%u", cache->dir, g);
+    int fd = open(name, create ? O_RDWR | O_CREAT : O_RDWR, 0644);
+    if (fd < 0)
+    {
+        if (create)
+        {
+            perror(name);
+        }
+        return false;
+    }
+    uint32_t bits = CACHE_FIRST_BITS + g;
+    size_t size = CACHE_HEADER_SIZE + (sizeof(cache_slot_t) << bits);
+
+    // whoever finds the file empty initializes it, under the lock
+    flock(fd, LOCK_EX);
+    struct stat st;
+    cache_header_t h;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size == 0)
+    {
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, CACHE_MAGIC, sizeof(h.magic));
+        h.format = CACHE_FORMAT;
+        h.bits = bits;
+        ok = ftruncate(fd, size) == 0 && pwrite(fd, &h, sizeof(h), 0) == sizeof(h);
+    }
+    else if (ok)
+    {
+        ok = (size_t)st.st_size == size && pread(fd, &h, sizeof(h), 0) == sizeof(h) &&
+             !memcmp(h.magic, CACHE_MAGIC, sizeof(h.magic)) && h.format == CACHE_FORMAT && h.bits == bits;
+        if (!ok)
+        {
+            printf("File %s is not a cache file\n", name);
+        }
+    }
+    flock(fd, LOCK_UN);
+
+    void *base = ok ? mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    if (base == MAP_FAILED)
+    {
+        if (ok)
+        {
+            perror("mmap");
+        }
+        close(fd);
+        return false;
+    }
+    cache_generation_t *gen = &cache->generations[g];
+    gen->fd = fd;
+    gen->size = size;
+    gen->header = (cache_header_t *)base;
+    gen->slots = (cache_slot_t *)((char *)base + CACHE_HEADER_SIZE);
+    gen->mask = (1ull << bits) - 1;
+    __atomic_store_n(&cache->count, g + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// open the files added by other processes since the last call, under cache->lock.
+// With create, the last file is not full on return, unless all the files are.
+static void cache_refresh(quadratic_cache_t *cache, bool create)
+{
+    while (cache->count < CACHE_GENERATIONS &&
+           __atomic_load_n(&cache->generations[cache->count - 1].header->full, __ATOMIC_ACQUIRE))
+    {
+        if (!cache_open_generation(cache, cache->count, create))
+        {
+            break;
+        }
+    }
+}
+
+struct quadratic_cache_t *quadratic_cache_open(const char *dir)
+{
+    struct stat st;
+    if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
+    {
+        printf("Cache directory %s not found\n", dir);
+        return 0;
+    }
+    quadratic_cache_t *cache = (quadratic_cache_t *)calloc(1, sizeof(quadratic_cache_t));
+    if (!cache)
+    {
+        printf("Unable to allocate the cache\n");
+        exit(1);
+    }
+    cache->dir = strdup(dir);
+    pthread_mutex_init(&cache->lock, 0);
+    uint64_t seed = 0xcbf29ce484222325ull;
+    for (const char *pt = QUADRATIC_VERSION; *pt; pt++)
+    {
+        seed = (seed ^ (unsigned char)*pt) * 0x100000001b3ull;
+    }
+    cache->seed = seed;
+    if (!cache_open_generation(cache, 0, true))
+    {
+        quadratic_cache_close(cache);
+        return 0;
+    }
+    cache_refresh(cache, false);
+    return cache;
+}
+
+void quadratic_cache_close(struct quadratic_cache_t *cache)
+{
+    if (!cache)
+    {
+        return;
+    }
+    for (unsigned g = 0; g < cache->count; g++)
+    {
+        munmap(cache->generations[g].header, cache->generations[g].size);
+        close(cache->generations[g].fd);
+    }
+    pthread_mutex_destroy(&cache->lock);
+    free(cache->dir);
+    free(cache);
+}
+
+// ------------------------------------------------------------------------------
+// lookup and store
+// ------------------------------------------------------------------------------
+
+// a slot is written once, h1 before h0 : a reader which sees h0 also sees h1
+static int cache_probe(const cache_generation_t *gen, uint64_t h0, uint64_t h1)
+{
+    for (uint64_t i = 0; i < CACHE_PROBES; i++)
+    {
+        const cache_slot_t *s = &gen->slots[((h0 >> 1) + i) & gen->mask];
+        uint64_t s0 = __atomic_load_n(&s->h0, __ATOMIC_ACQUIRE);
+        if (s0 == 0)
+        {
+            return -1;
+        }
+        uint64_t s1 = s->h1;
+        if (s0 == h0 && (s1 & ~1ull) == h1)
+        {
+            return s1 & 1;
+        }
+    }
+    return -1;
+}
+
+static int cache_find(quadratic_cache_t *cache, uint64_t h0, uint64_t h1)
+{
+    unsigned count = __atomic_load_n(&cache->count, __ATOMIC_ACQUIRE);
+    for (unsigned g = count; g-- > 0;)
+    {
+        int r = cache_probe(&cache->generations[g], h0, h1);
+        if (r >= 0)
+        {
+            return r;
+        }
+    }
+    return -1;
+}
+
+int quadratic_cache_lookup(struct quadratic_cache_t *cache, mpz_srcptr n)
+{
+    uint64_t h0, h1;
+    cache_hash(cache, n, &h0, &h1);
+    int r = cache_find(cache, h0, h1);
+    unsigned count = __atomic_load_n(&cache->count, __ATOMIC_ACQUIRE);
+    if (r < 0 && count < CACHE_GENERATIONS &&
+        __atomic_load_n(&cache->generations[count - 1].header->full, __ATOMIC_ACQUIRE))
+    {
+        // another process may have started a new file
+        pthread_mutex_lock(&cache->lock);
+        cache_refresh(cache, false);
+        pthread_mutex_unlock(&cache->lock);
+        r = cache_find(cache, h0, h1);
+    }
+    return r;
+}
+
+void quadratic_cache_store(struct quadratic_cache_t *cache, mpz_srcptr n, bool is_prime)
+{
+    uint64_t h0, h1;
+    cache_hash(cache, n, &h0, &h1);
+    pthread_mutex_lock(&cache->lock);
+    bool stored = false;
+    // a few retries when other processes fill the last file, or when the next one cannot be created
+    for (unsigned attempt = 0; attempt < CACHE_GENERATIONS && !stored; attempt++)
+    {
+        cache_refresh(cache, true);
+        cache_generation_t *gen = &cache->generations[cache->count - 1];
+        flock(gen->fd, LOCK_EX);
+        if (gen->header->full)
+        {
+            stored = cache->count == CACHE_GENERATIONS; // all the files are full, the number is dropped
+        }
+        else if (cache_find(cache, h0, h1) >= 0)
+        {
+            stored = true;
+        }
+        else
+        {
+            for (uint64_t i = 0; i < CACHE_PROBES && !stored; i++)
+            {
+                cache_slot_t *s = &gen->slots[((h0 >> 1) + i) & gen->mask];
+                if (s->h0 == 0)
+                {
+                    s->h1 = h1 | is_prime;
+                    __atomic_store_n(&s->h0, h0, __ATOMIC_RELEASE);
+                    gen->header->count++;
+                    stored = true;
+                }
+            }
+            // no free slot close enough, the number goes to the next file
+            if (!stored || gen->header->count * 4 >= (gen->mask + 1) * 3)
+            {
+                __atomic_store_n(&gen->header->full, 1, __ATOMIC_RELEASE);
+            }
+        }
+        flock(gen->fd, LOCK_UN);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+void quadratic_cache_attach(struct quadratic_cache_t *cache)
+{
+    __atomic_store_n(&cache_attached, cache, __ATOMIC_RELEASE);
+}
+
+struct quadratic_cache_t *quadratic_cache_attached(void)
+{
+    return __atomic_load_n(&cache_attached, __ATOMIC_ACQUIRE);
+}
+
+// ------------------------------------------------------------------------------
+// Simple foolguard unit tests
+// ------------------------------------------------------------------------------
+
+void quadratic_cache_self_test(void)
+{
+    printf("Cache ...\n");
+    char dir[] = "/tmp/quadratic_cache_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return;
+    }
+    quadratic_cache_t *cache = quadratic_cache_open(dir);
+    assert(cache);
+
+    mpz_t n;
+    mpz_init(n);
+    for (unsigned i = 0; i < 1000; i++)
+    {
+        mpz_ui_pow_ui(n, 3, 100 + i);
+        assert(quadratic_cache_lookup(cache, n) == -1);
+        quadratic_cache_store(cache, n, i & 1);
+        assert(quadratic_cache_lookup(cache, n) == (int)(i & 1));
+    }
+
+    // the results survive, in another instance
+    quadratic_cache_close(cache);
+    cache = quadratic_cache_open(dir);
+    assert(cache);
+    for (unsigned i = 0; i < 1000; i++)
+    {
+        mpz_ui_pow_ui(n, 3, 100 + i);
+        assert(quadratic_cache_lookup(cache, n) == (int)(i & 1));
+    }
+    mpz_ui_pow_ui(n, 3, 99);
+    assert(quadratic_cache_lookup(cache, n) == -1);
+
+    // a cached verdict is returned before any test
+    mpz_ui_pow_ui(n, 5, 200);
+    quadratic_cache_store(cache, n, true);
+    quadratic_cache_attach(cache);
+    assert(mpz_quadratic_primality(n) == true);
+    quadratic_cache_attach(0);
+    assert(mpz_quadratic_primality(n) == false);
+
+    mpz_clear(n);
+    quadratic_cache_close(cache);
+    char name[sizeof(dir) + 32];
+    snprintf(name, sizeof(name), "%s/quadratic.cache.0", dir);
+    unlink(name);
+    rmdir(dir);
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// persistent result cache, shared by the threads and the processes which
+// open the same directory
+//
+//    quadratic --cache /var/cache/quadratic -f candidates.txt
+//
+// Files dir/quadratic.cache.0, .1, .2 ... are open-addressing hash tables,
+// mmap-ed and shared. Each slot holds a 128-bit hash of the number limbs and
+// of QUADRATIC_VERSION, with the verdict in the lowest bit. Slots are only
+// ever filled, never modified : readers do not lock, writers lock the file
+// (flock) only while they fill a slot. When a table is 3/4 full, the next
+// file, twice larger, receives the new results.
+//
+// Only the results of the full test are stored, the sieve and small numbers
+// are cheaper than a lookup. Cancelled tests are never stored.
+//
+// quadratic_cache_attach()
+//    makes mpz_quadratic_primality() look up the cache before the sieve,
+//    for all the threads of the process.
+// -----------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gmp.h"
+
+struct quadratic_cache_t;
+
+// 0 when the directory is not usable, with a message
+struct quadratic_cache_t *quadratic_cache_open(const char *dir);
+void quadratic_cache_close(struct quadratic_cache_t *cache);
+
+// -1 : unknown, 0 : composite for sure, 1 : might be prime
+int quadratic_cache_lookup(struct quadratic_cache_t *cache, mpz_srcptr n);
+void quadratic_cache_store(struct quadratic_cache_t *cache, mpz_srcptr n, bool is_prime);
+
+void quadratic_cache_attach(struct quadratic_cache_t *cache); // 0 detaches
+struct quadratic_cache_t *quadratic_cache_attached(void);
+
+void quadratic_cache_self_test(void);
@@ -0,0 +1,415 @@
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// range expression generator with incremental evaluation
+// -----------------------------------------------------------------------
+
+#include <assert.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <deque>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "bison.gmp_expr.h"
+#include "quadratic_primality_async.h"
+#include "quadratic_primality_generator.h"
+
+#define RANGE_BATCH 1024               // candidates per scheduler batch
+#define RANGE_BLOCK 65536              // sieve block, in indexes
+#define RANGE_SIEVE_MAX (1ull << 32)   // largest sieve bound
+#define RANGE_CHECK (1ull << 16)       // linear mode is verified against the parser every RANGE_CHECK indexes
+
+bool quadratic_range_parse(struct quadratic_range_t *range, const char *expression, const char *assignment)
+{
+    // e.g. k=1..1000000
+    const char *eq = strchr(assignment, '=');
+    size_t len = eq ? eq - assignment : 0;
+    if (len == 0 || len >= sizeof(range->variable))
+    {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++)
+    {
+        if (!isalpha(assignment[i]) && assignment[i] != '_')
+        {
+            return false;
+        }
+    }
+    memcpy(range->variable, assignment, len);
+    range->variable[len] = 0;
+
+    char *end;
+    range->first = strtoll(eq + 1, &end, 0);
+    if (end == eq + 1 || strncmp(end, "..", 2))
+    {
+        return false;
+    }
+    const char *pt = end + 2;
+    range->last = strtoll(pt, &end, 0);
+    if (end == pt || *end)
+    {
+        return false;
+    }
+    range->expression = expression;
+    range->step = 1;
+    range->sieve_bound = 0;
+    return range->first <= range->last;
+}
+
+// expression text with the variable replaced by a value
+static void range_substitute(std::string &out, const struct quadratic_range_t *range, int64_t value)
+{
+    char number[32];
+    snprintf(number, sizeof(number), value < 0 ? "(%" PRId64 ")" : "%" PRId64, value);
+    size_t len = strlen(range->variable);
+    out.clear();
+    const char *pt = range->expression;
+    while (*pt)
+    {
+        if (isalpha(*pt) || *pt == '_')
+        {
+            const char *start = pt;
+            while (isalnum(*pt) || *pt == '_')
+            {
+                pt++;
+            }
+            if ((size_t)(pt - start) == len && !strncmp(start, range->variable, len))
+            {
+                out += number;
+            }
+            else
+            {
+                out.append(start, pt - start);
+            }
+        }
+        else
+        {
+            out += *pt++;
+        }
+    }
+}
+
+static void range_evaluate(mpz_t v, const struct quadratic_range_t *range, int64_t value, std::string &buff)
+{
+    range_substitute(buff, range, value);
+    mpz_expression_parse(v, &buff[0]);
+}
+
+// ------------------------------------------------------------------------------
+// incremental sieve, candidate j is f0 + j * delta
+// ------------------------------------------------------------------------------
+
+struct range_sieve_t
+{
+    std::vector<uint32_t> p;   // small primes
+    std::vector<uint32_t> r;   // candidate residue at the start of the current block
+    std::vector<uint32_t> d;   // delta residue
+    std::vector<uint32_t> inv; // inverse of the delta residue, 0 when the delta is a multiple of p
+};
+
+static uint32_t range_invert(uint64_t a, uint64_t p)
+{
+    int64_t t = 0, new_t = 1, r = p, new_r = a;
+    while (new_r)
+    {
+        int64_t q = r / new_r, tmp;
+        tmp = t - q * new_t;
+        t = new_t;
+        new_t = tmp;
+        tmp = r - q * new_r;
+        r = new_r;
+        new_r = tmp;
+    }
+    return t < 0 ? t + p : t;
+}
+
+static void range_sieve_init(struct range_sieve_t *s, uint64_t bound, mpz_t f0, mpz_t delta)
+{
+    std::vector<bool> composite(bound + 1, false);
+    for (uint64_t i = 2; i <= bound; i++)
+    {
+        if (composite[i])
+        {
+            continue;
+        }
+        for (uint64_t j = i * i; j <= bound; j += i)
+        {
+            composite[j] = true;
+        }
+        s->p.push_back(i);
+        s->r.push_back(mpz_fdiv_ui(f0, i));
+        uint64_t d = mpz_fdiv_ui(delta, i);
+        s->d.push_back(d);
+        s->inv.push_back(d ? range_invert(d, i) : 0);
+    }
+}
+
+// mark the candidates of the next block with a small factor, and move the residues to the following block.
+// A delta multiple of p makes all or none of the candidates multiples of p.
+static void range_sieve_block(struct range_sieve_t *s, uint8_t *composite, uint64_t block)
+{
+    memset(composite, 0, block);
+    for (size_t i = 0; i < s->p.size(); i++)
+    {
+        uint64_t p = s->p[i];
+        uint64_t r = s->r[i];
+        uint64_t inv = s->inv[i];
+        if (inv == 0)
+        {
+            if (r == 0)
+            {
+                memset(composite, 1, block);
+            }
+            continue;
+        }
+        // r + j * d == 0 mod p
+        for (uint64_t j = (p - r) % p * inv % p; j < block; j += p)
+        {
+            composite[j] = 1;
+        }
+        s->r[i] = (r + block % p * s->d[i]) % p;
+    }
+}
+
+// ------------------------------------------------------------------------------
+// candidates to the scheduler, results back in range order
+// ------------------------------------------------------------------------------
+
+struct range_pending_t
+{
+    std::future<std::vector<quadratic_verdict_t>> verdicts;
+    std::vector<int64_t> values;
+};
+
+struct range_output_t
+{
+    const struct quadratic_range_t *range;
+    bool verbose;
+    quadratic_range_report_t report;
+    struct quadratic_range_stats_t *stats;
+    std::string buff;
+};
+
+static void range_collect(range_output_t *out, range_pending_t &pending)
+{
+    std::vector<quadratic_verdict_t> verdicts = pending.verdicts.get();
+    for (size_t i = 0; i < verdicts.size(); i++)
+    {
+        bool is_prime = verdicts[i] == QUADRATIC_PRIME;
+        out->stats->primes += is_prime;
+        out->stats->composites += !is_prime;
+        if (is_prime || out->verbose)
+        {
+            range_substitute(out->buff, out->range, pending.values[i]);
+            out->report(out->buff.c_str(), is_prime);
+        }
+    }
+}
+
+void quadratic_range_generate(const struct quadratic_range_t *range, unsigned thread_count, bool verbose,
+                              quadratic_range_report_t report, struct quadratic_range_stats_t *stats)
+{
+    stats->primes = 0;
+    stats->composites = 0;
+    stats->sieved = 0;
+    uint64_t count = (uint64_t)(range->last - range->first) / range->step + 1;
+
+    std::string buff;
+    mpz_t f0, f1, f2, delta, tmp;
+    mpz_inits(f0, f1, f2, delta, tmp, 0);
+
+    // linear in the variable : constant differences, and the last candidate agrees
+    bool linear = false;
+    if (count >= 3)
+    {
+        range_evaluate(f0, range, range->first, buff);
+        range_evaluate(f1, range, range->first + range->step, buff);
+        range_evaluate(f2, range, range->first + 2 * range->step, buff);
+        mpz_sub(delta, f1, f0);
+        mpz_sub(tmp, f2, f1);
+        if (mpz_cmp(tmp, delta) == 0)
+        {
+            range_evaluate(f2, range, range->first + (int64_t)(count - 1) * range->step, buff);
+            mpz_mul_ui(tmp, delta, count - 1);
+            mpz_add(tmp, tmp, f0);
+            linear = mpz_cmp(tmp, f2) == 0;
+        }
+    }
+
+    // f2 holds the last candidate, a linear sequence is monotonic
+    range_sieve_t sieve;
+    bool sieving = false;
+    if (range->sieve_bound)
+    {
+        uint64_t bound = range->sieve_bound < RANGE_SIEVE_MAX ? range->sieve_bound : RANGE_SIEVE_MAX - 1;
+        if (!linear)
+        {
+            printf("Sieve disabled, %s is not linear in %s\n", range->expression, range->variable);
+        }
+        else if (mpz_cmp_ui(f0, bound) <= 0 || mpz_cmp_ui(f2, bound) <= 0)
+        {
+            printf("Sieve disabled, candidates are not larger than the sieve bound\n");
+        }
+        else
+        {
+            range_sieve_init(&sieve, bound, f0, delta);
+            sieving = true;
+        }
+    }
+
+    quadratic_scheduler_t scheduler(thread_count);
+    std::deque<range_pending_t> pending;
+    range_output_t out = {range, verbose, report, stats, std::string()};
+    std::vector<mpz_class> batch;
+    std::vector<int64_t> batch_values;
+    std::vector<uint8_t> composite(RANGE_BLOCK, 0);
+    mpz_class v(f0);
+
+    for (uint64_t j = 0; j < count; j++)
+    {
+        int64_t value = range->first + (int64_t)j * range->step;
+        if (linear && j > 0)
+        {
+            mpz_add(v.get_mpz_t(), v.get_mpz_t(), delta);
+            if (j % RANGE_CHECK == 0)
+            {
+                // cheap insurance against expressions linear at a few points only
+                range_evaluate(tmp, range, value, buff);
+                if (mpz_cmp(tmp, v.get_mpz_t()) != 0)
+                {
+                    printf("Expression %s is not linear in %s, candidates are now parsed one by one\n",
+                           range->expression, range->variable);
+                    linear = false;
+                    sieving = false;
+                }
+            }
+        }
+        if (!linear)
+        {
+            range_evaluate(tmp, range, value, buff);
+            mpz_set(v.get_mpz_t(), tmp);
+        }
+
+        if (sieving)
+        {
+            uint64_t index = j % RANGE_BLOCK;
+            if (index == 0)
+            {
+                range_sieve_block(&sieve, &composite[0], RANGE_BLOCK);
+            }
+            if (composite[index])
+            {
+                stats->sieved++;
+                stats->composites++;
+                if (verbose)
+                {
+                    range_substitute(buff, range, value);
+                    report(buff.c_str(), false);
+                }
+                continue;
+            }
+        }
+
+        batch.push_back(v);
+        batch_values.push_back(value);
+        if (batch.size() == RANGE_BATCH || j == count - 1)
+        {
+            range_pending_t p;
+            p.verdicts = scheduler.submit_batch(std::move(batch));
+            p.values = std::move(batch_values);
+            pending.push_back(std::move(p));
+            batch.clear();
+            batch_values.clear();
+            // a few batches per thread in flight, memory stays bounded
+            while (pending.size() > 2 * thread_count + 2)
+            {
+                range_collect(&out, pending.front());
+                pending.pop_front();
+            }
+        }
+    }
+    if (!batch.empty())
+    {
+        // the last candidates were sieved out
+        range_pending_t p;
+        p.verdicts = scheduler.submit_batch(std::move(batch));
+        p.values = std::move(batch_values);
+        pending.push_back(std::move(p));
+    }
+    while (!pending.empty())
+    {
+        range_collect(&out, pending.front());
+        pending.pop_front();
+    }
+    mpz_clears(f0, f1, f2, delta, tmp, 0);
+}
+
+// ------------------------------------------------------------------------------
+// self test : the possible primes of k*b^n+c ranges against mpz_probab_prime_p()
+// ------------------------------------------------------------------------------
+
+static std::vector<std::string> range_test_primes;
+
+static void range_test_report(const char *input, bool is_prime)
+{
+    if (is_prime)
+    {
+        range_test_primes.push_back(input);
+    }
+}
+
+static void range_test(const char *expression, const char *assignment, int64_t step, uint64_t sieve_bound,
+                       unsigned long b, unsigned long n, long c)
+{
+    struct quadratic_range_t range;
+    struct quadratic_range_stats_t stats;
+    assert(quadratic_range_parse(&range, expression, assignment));
+    range.step = step;
+    range.sieve_bound = sieve_bound;
+    range_test_primes.clear();
+    quadratic_range_generate(&range, 4, false, range_test_report, &stats);
+    uint64_t count = (uint64_t)(range.last - range.first) / range.step + 1;
+    assert((uint64_t)(stats.primes + stats.composites) == count);
+    assert((size_t)stats.primes == range_test_primes.size());
+
+    // the primes in range order, k * b^n + c computed without the parser
+    mpz_t v, power, reported;
+    mpz_inits(v, power, reported, 0);
+    mpz_ui_pow_ui(power, b, n);
+    size_t found = 0;
+    for (int64_t k = range.first; k <= range.last; k += range.step)
+    {
+        mpz_mul_si(v, power, k);
+        if (c < 0)
+            mpz_sub_ui(v, v, -c);
+        else
+            mpz_add_ui(v, v, c);
+        if (mpz_probab_prime_p(v, 25) == 0)
+        {
+            continue;
+        }
+        assert(found < range_test_primes.size());
+        mpz_expression_parse(reported, &range_test_primes[found++][0]);
+        assert(mpz_cmp(reported, v) == 0);
+    }
+    assert(found > 0 && found == range_test_primes.size());
+    mpz_clears(v, power, reported, 0);
+}
+
+void quadratic_generator_self_test(void)
+{
+    printf("Generator ...\n");
+    // longer than RANGE_CHECK and RANGE_BLOCK, the incremental value is checked and the sieve moves to a next block
+    range_test("k*2^64+1", "k=1..70000", 1, 1000, 2, 64, 1);
+    range_test("k*2^64-1", "k=1..3001", 2, 1000, 2, 64, -1);
+    range_test("k*10^20-7", "k=1..2000", 1, 500, 10, 20, -7);
+    range_test("k*3^40+2", "k=1..2000", 1, 0, 3, 40, 2);
+    range_test("k*3^40+2", "k=1..2000", 1, 10000, 3, 40, 2);
+    range_test("k*5^30-4", "k=1..1000", 1, 0, 5, 30, -4);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// candidates generated from an expression and a range of one variable
+//
+//    -gen "k*2^3000+1" k=1..1000000 step 2 sieve 1000000
+//
+// When the expression is linear in the variable, like k*2^3000+1, the next
+// candidate is the previous one plus a constant delta (2^3000 * step), the
+// expression is parsed only a few times. Other expressions are parsed once
+// per candidate.
+//
+// sieve B : in linear mode, candidates with a prime factor below B are
+// removed before testing. The residues of the first candidate and of the
+// delta modulo each small prime give the indexes of the multiples directly,
+// no candidate is divided.
+//
+// Candidates are tested in batches by a quadratic_scheduler_t, results are
+// reported in range order.
+// -----------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct quadratic_range_t
+{
+    const char *expression; // e.g. k*2^3000+1
+    char variable[32];      // e.g. k
+    int64_t first;          // first value of the variable
+    int64_t last;           // last value of the variable, included
+    int64_t step;           // > 0
+    uint64_t sieve_bound;   // 0 : no sieve
+};
+
+struct quadratic_range_stats_t
+{
+    long primes;
+    long composites; // including sieved candidates
+    long sieved;
+};
+
+// called with the substituted expression for each possible prime, and for
+// each composite in verbose mode
+typedef void (*quadratic_range_report_t)(const char *input, bool is_prime);
+
+bool quadratic_range_parse(struct quadratic_range_t *range, const char *expression, const char *assignment);
+void quadratic_range_generate(const struct quadratic_range_t *range, unsigned thread_count, bool verbose,
+                              quadratic_range_report_t report, struct quadratic_range_stats_t *stats);
+
+void quadratic_generator_self_test(void);
@@ -0,0 +1,286 @@
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// completion journal of a file of expressions
+// -----------------------------------------------------------------------
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "quadratic_primality_journal.h"
+
+struct quadratic_journal_header_t
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t input_size;
+    int64_t input_mtime;
+};
+
+struct quadratic_journal_record_t
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t verdict;
+};
+
+struct quadratic_journal_t
+{
+    std::string name;
+    std::mutex lock; // records can come from any thread
+    int fd;
+    unsigned sync_period;
+    unsigned unsynced;
+    std::vector<quadratic_journal_record_t> pending; // not yet written
+    std::unordered_map<uint64_t, quadratic_journal_record_t> done;
+    uint64_t resume;
+    long primes, composites;
+};
+
+static bool quadratic_journal_write(quadratic_journal_t *j, const void *data, size_t len)
+{
+    const char *pt = (const char *)data;
+    while (len)
+    {
+        ssize_t r = write(j->fd, pt, len);
+        if (r < 0)
+        {
+            perror(j->name.c_str());
+            return false;
+        }
+        pt += r;
+        len -= r;
+    }
+    return true;
+}
+
+// load the records of a previous run, a torn last record is ignored
+static void quadratic_journal_load(quadratic_journal_t *j, const quadratic_journal_header_t *expected)
+{
+    quadratic_journal_header_t h;
+    if (read(j->fd, &h, sizeof(h)) != sizeof(h) || memcmp(&h, expected, sizeof(h)))
+    {
+        return;
+    }
+    quadratic_journal_record_t r;
+    off_t end = sizeof(h);
+    while (read(j->fd, &r, sizeof(r)) == sizeof(r))
+    {
+        if (j->done.emplace(r.offset, r).second)
+        {
+            j->primes += r.verdict == QUADRATIC_JOURNAL_PRIME;
+            j->composites += r.verdict == QUADRATIC_JOURNAL_COMPOSITE;
+        }
+        end += sizeof(r);
+    }
+    if (ftruncate(j->fd, end) < 0 || lseek(j->fd, end, SEEK_SET) != end)
+    {
+        perror(j->name.c_str());
+        j->done.clear();
+        j->primes = j->composites = 0;
+        return;
+    }
+    // first line not done
+    uint64_t offset = 0;
+    auto it = j->done.find(offset);
+    while (it != j->done.end())
+    {
+        offset += it->second.length;
+        it = j->done.find(offset);
+    }
+    j->resume = offset;
+}
+
+struct quadratic_journal_t *quadratic_journal_open(const char *input, unsigned sync_period)
+{
+    struct stat st;
+    if (stat(input, &st) < 0)
+    {
+        perror(input);
+        return 0;
+    }
+    quadratic_journal_header_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = QUADRATIC_JOURNAL_MAGIC;
+    h.version = QUADRATIC_JOURNAL_VERSION;
+    h.input_size = st.st_size;
+    h.input_mtime = st.st_mtime;
+
+    quadratic_journal_t *j = new quadratic_journal_t;
+    j->name = std::string(input) + ".journal";
+    j->sync_period = sync_period ? sync_period : 1;
+    j->unsynced = 0;
+    j->resume = 0;
+    j->primes = j->composites = 0;
+    j->fd = open(j->name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (j->fd < 0)
+    {
+        perror(j->name.c_str());
+        delete j;
+        return 0;
+    }
+    quadratic_journal_load(j, &h);
+    if (j->done.empty())
+    {
+        // new journal, or one for another version of the input
+        if (ftruncate(j->fd, 0) < 0 || lseek(j->fd, 0, SEEK_SET) != 0 || !quadratic_journal_write(j, &h, sizeof(h)) ||
+            fsync(j->fd) < 0)
+        {
+            perror(j->name.c_str());
+            close(j->fd);
+            delete j;
+            return 0;
+        }
+    }
+    return j;
+}
+
+static void quadratic_journal_flush(quadratic_journal_t *j)
+{
+    if (!j->pending.empty())
+    {
+        quadratic_journal_write(j, &j->pending[0], j->pending.size() * sizeof(quadratic_journal_record_t));
+        j->pending.clear();
+    }
+    if (j->unsynced)
+    {
+        fsync(j->fd);
+        j->unsynced = 0;
+    }
+}
+
+void quadratic_journal_close(struct quadratic_journal_t *j)
+{
+    if (!j)
+    {
+        return;
+    }
+    quadratic_journal_flush(j);
+    close(j->fd);
+    delete j;
+}
+
+uint64_t quadratic_journal_resume_offset(const struct quadratic_journal_t *j)
+{
+    return j->resume;
+}
+
+void quadratic_journal_counts(const struct quadratic_journal_t *j, long *primes, long *composites)
+{
+    *primes = j->primes;
+    *composites = j->composites;
+}
+
+int quadratic_journal_lookup(const struct quadratic_journal_t *j, uint64_t offset)
+{
+    auto it = j->done.find(offset);
+    return it == j->done.end() ? -1 : (int)it->second.verdict;
+}
+
+void quadratic_journal_record(struct quadratic_journal_t *j, uint64_t offset, uint32_t length, uint32_t verdict)
+{
+    quadratic_journal_record_t r;
+    r.offset = offset;
+    r.length = length;
+    r.verdict = verdict;
+    std::lock_guard<std::mutex> guard(j->lock);
+    j->pending.push_back(r);
+    // one write and one fsync per batch of records
+    if (++j->unsynced >= j->sync_period)
+    {
+        quadratic_journal_flush(j);
+    }
+}
+
+void quadratic_journal_self_test(void)
+{
+    printf("Journal ...\n");
+    char dir[] = "/tmp/quadratic_journal_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return;
+    }
+    char input[sizeof(dir) + 32], name[sizeof(dir) + 32];
+    snprintf(input, sizeof(input), "%s/lines.txt", dir);
+    snprintf(name, sizeof(name), "%s/lines.txt.journal", dir);
+
+    // 10 lines of different lengths
+    uint64_t offset[11] = {0};
+    FILE *f = fopen(input, "w");
+    assert(f);
+    for (unsigned i = 0; i < 10; i++)
+    {
+        offset[i + 1] = offset[i] + fprintf(f, "%u*2^%u+1\n", i + 1, 100 * i);
+    }
+    fclose(f);
+
+    // lines 0 1 2 4 6 7 done, line 7 is the last record and is torn
+    const unsigned done[] = {2, 0, 1, 6, 4, 7};
+    quadratic_journal_t *j = quadratic_journal_open(input, 1);
+    assert(j && quadratic_journal_resume_offset(j) == 0);
+    for (unsigned i : done)
+    {
+        quadratic_journal_record(j, offset[i], offset[i + 1] - offset[i], i & 1);
+    }
+    quadratic_journal_close(j);
+    const off_t records = sizeof(quadratic_journal_header_t) + 5 * sizeof(quadratic_journal_record_t);
+    assert(truncate(name, records + sizeof(quadratic_journal_record_t) / 2) == 0);
+
+    // resume : the torn record is dropped, only the missing lines are tested again
+    j = quadratic_journal_open(input, 4);
+    assert(j && quadratic_journal_resume_offset(j) == offset[3]);
+    long primes, composites;
+    quadratic_journal_counts(j, &primes, &composites);
+    assert(primes == 1 && composites == 4);
+    struct stat st;
+    assert(stat(name, &st) == 0 && st.st_size == records);
+    std::vector<unsigned> tested;
+    for (unsigned i = 0; i < 10; i++)
+    {
+        if (offset[i] < quadratic_journal_resume_offset(j))
+        {
+            continue;
+        }
+        int verdict = quadratic_journal_lookup(j, offset[i]);
+        if (verdict >= 0)
+        {
+            assert(verdict == (int)(i & 1));
+            continue;
+        }
+        tested.push_back(i);
+        quadratic_journal_record(j, offset[i], offset[i + 1] - offset[i], i & 1);
+    }
+    assert((tested == std::vector<unsigned>{3, 5, 7, 8, 9}));
+    quadratic_journal_close(j);
+
+    // all lines done
+    j = quadratic_journal_open(input, 1);
+    assert(j && quadratic_journal_resume_offset(j) == offset[10]);
+    quadratic_journal_counts(j, &primes, &composites);
+    assert(primes == 5 && composites == 5);
+    quadratic_journal_close(j);
+
+    // another version of the input discards the journal
+    f = fopen(input, "a");
+    assert(f);
+    fprintf(f, "7\n");
+    fclose(f);
+    j = quadratic_journal_open(input, 1);
+    assert(j && quadratic_journal_resume_offset(j) == 0 && quadratic_journal_lookup(j, 0) == -1);
+    quadratic_journal_close(j);
+
+    unlink(name);
+    unlink(input);
+    rmdir(dir);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// completion journal of a file of expressions, to resume an interrupted run
+//
+//    quadratic --journal 1000 -f candidates.txt
+//
+// candidates.txt.journal records, for each line done, its byte offset, its
+// length and its verdict. Records are written in batches, the journal is
+// fsync-ed every N records. Lines can complete in any order, records can be
+// added from any thread.
+//
+// On restart, the lines done from the beginning of the file are skipped by
+// a seek to the first line not done, later lines done are skipped without
+// being parsed. A journal written for another version of the input file
+// (size or modification time) is discarded.
+//
+//    header : "QPTJ" magic, uint32 version, uint64 input size, int64 input mtime
+//    records : uint64 offset, uint32 length, uint32 verdict
+// -----------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define QUADRATIC_JOURNAL_MAGIC 0x4a545051 // "QPTJ"
+#define QUADRATIC_JOURNAL_VERSION 1
+
+#define QUADRATIC_JOURNAL_COMPOSITE 0
+#define QUADRATIC_JOURNAL_PRIME 1
+#define QUADRATIC_JOURNAL_EMPTY 2 // empty line or comment
+
+struct quadratic_journal_t;
+
+// 0 when the journal cannot be written, with a message
+struct quadratic_journal_t *quadratic_journal_open(const char *input, unsigned sync_period);
+void quadratic_journal_close(struct quadratic_journal_t *j); // flush and fsync
+
+// where to start reading the input, all the lines before are done
+uint64_t quadratic_journal_resume_offset(const struct quadratic_journal_t *j);
+// verdicts of the lines found in the journal when opened
+void quadratic_journal_counts(const struct quadratic_journal_t *j, long *primes, long *composites);
+
+// -1 : not done, otherwise QUADRATIC_JOURNAL_*
+int quadratic_journal_lookup(const struct quadratic_journal_t *j, uint64_t offset);
+void quadratic_journal_record(struct quadratic_journal_t *j, uint64_t offset, uint32_t length, uint32_t verdict);
+
+void quadratic_journal_self_test(void);
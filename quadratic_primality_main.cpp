@@ -8,17 +8,210 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "bison.gmp_expr.h"
 #include "quadratic_primality.h"
 #include "quadratic_primality_alloc.h"
+#include "quadratic_primality_async.h"
+#include "quadratic_primality_binary.h"
+#include "quadratic_primality_cache.h"
+#include "quadratic_primality_generator.h"
+#include "quadratic_primality_journal.h"
+#include "quadratic_primality_pipeline.h"
+#include "quadratic_primality_server.h"
+#include "quadratic_primality_worker.h"
 
-static void quadratic_primality_file(char *name, bool verbose)
+static bool json_output = false; // one JSON object per line instead of free text
+static unsigned journal_period = 0; // -f runs keep a journal, fsync-ed every journal_period lines
+static bool pipeline_mode = false;  // -f and -fb through trial division, base 2 sprp, then the quadratic test
+
+static uint64_t main_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void json_string(const char *str)
+{
+    putchar('"');
+    for (const char *pt = str; *pt; pt++)
+    {
+        unsigned char c = *pt;
+        if (c == '"' || c == '\\')
+        {
+            putchar('\\');
+            putchar(c);
+        }
+        else if (c < 0x20)
+        {
+            printf("\\u%04x", c);
+        }
+        else
+        {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+// JSON Lines output, stdout is fully buffered in this mode
+static void json_result(const char *input, bool is_prime, quadratic_stats_t *st, uint64_t parse_ns)
+{
+    printf("{\"input\":");
+    json_string(input);
+    printf(",\"bits\":%lu,\"mod8\":%lu,\"reduction\":\"%s\",\"a\":%lu,\"verdict\":\"%s\"", (unsigned long)st->bits,
+           (unsigned long)st->mod8, st->reduction, (unsigned long)st->a,
+           is_prime ? "might be prime" : "composite for sure");
+    printf(",\"parse_ns\":%lu,\"sieve_ns\":%lu,\"precompute_ns\":%lu,\"exponentiate_ns\":%lu}\n",
+           (unsigned long)parse_ns, (unsigned long)st->sieve_ns, (unsigned long)st->precompute_ns,
+           (unsigned long)st->exponentiate_ns);
+}
+
+static void json_file_done(const char *name, long prime_count, long composite_count)
+{
+    printf("{\"file\":");
+    json_string(name);
+    printf(",\"primes\":%ld,\"composites\":%ld}\n", prime_count, composite_count);
+    fflush(stdout);
+}
+
+static void range_report(const char *input, bool is_prime)
+{
+    if (json_output)
+    {
+        printf("{\"input\":");
+        json_string(input);
+        printf(",\"verdict\":\"%s\"}\n", is_prime ? "might be prime" : "composite for sure");
+        return;
+    }
+    printf("%s %s\n", input, is_prime ? "might be prime" : "composite for sure");
+    fflush(stdout);
+}
+
+static void quadratic_primality_range(int argc, char **argv, int &i, unsigned thread_count, bool verbose)
+{
+    // -gen expression k=first..last [step s] [sieve b]
+    quadratic_range_t range;
+    if (i + 2 >= argc || !quadratic_range_parse(&range, argv[i + 1], argv[i + 2]))
+    {
+        printf("Usage : -gen expression k=first..last [step s] [sieve b]\n");
+        exit(1);
+    }
+    char *assignment = argv[i + 2];
+    i += 2;
+    while (i + 2 < argc)
+    {
+        if (!strcmp(argv[i + 1], "step"))
+        {
+            range.step = atoll(argv[i + 2]);
+        }
+        else if (!strcmp(argv[i + 1], "sieve"))
+        {
+            range.sieve_bound = strtoull(argv[i + 2], 0, 0);
+        }
+        else
+        {
+            break;
+        }
+        i += 2;
+    }
+    if (range.step < 1)
+    {
+        printf("Invalid step %ld\n", (long)range.step);
+        exit(1);
+    }
+
+    quadratic_range_stats_t st;
+    quadratic_range_generate(&range, thread_count, verbose, range_report, &st);
+    if (json_output)
+    {
+        printf("{\"expression\":");
+        json_string(range.expression);
+        printf(",\"range\":");
+        json_string(assignment);
+        printf(",\"primes\":%ld,\"composites\":%ld,\"sieved\":%ld}\n", st.primes, st.composites, st.sieved);
+        fflush(stdout);
+        return;
+    }
+    printf("Range %s %s done, %ld primes, %ld composites (%ld sieved)\n", range.expression, assignment, st.primes,
+           st.composites, st.sieved);
+}
+
+// --pipeline : the file reader pushes the numbers, this thread reports the results in file order
+static std::thread pipeline_consumer(quadratic_pipeline_t *pipeline, bool verbose, quadratic_journal_t *journal,
+                                     long *prime_count, long *composite_count)
+{
+    return std::thread([=] {
+        quadratic_pipeline_item_t item;
+        while (pipeline->pop(item))
+        {
+            if (json_output)
+            {
+                json_result(item.input.c_str(), item.is_prime, &item.stats, item.parse_ns);
+            }
+            else if (verbose)
+            {
+                printf("%s ... %s\n", item.input.c_str(), item.is_prime ? "might be prime" : "composite for sure");
+            }
+            *prime_count += (item.is_prime == true);
+            *composite_count += (item.is_prime == false);
+            if (journal)
+            {
+                quadratic_journal_record(journal, item.offset, item.length,
+                                         item.is_prime ? QUADRATIC_JOURNAL_PRIME : QUADRATIC_JOURNAL_COMPOSITE);
+            }
+        }
+    });
+}
+
+static void file_done(const char *name, long prime_count, long composite_count, const quadratic_pipeline_t *pipeline)
+{
+    if (json_output)
+    {
+        json_file_done(name, prime_count, composite_count);
+        return;
+    }
+    if (pipeline)
+    {
+        printf("File %s done, %ld primes, %ld composites (%ld by trial division, %ld by base 2 sprp)\n", name,
+               prime_count, composite_count, pipeline->decided[QUADRATIC_STAGE_TRIAL],
+               pipeline->decided[QUADRATIC_STAGE_SPRP]);
+        return;
+    }
+    printf("File %s done, %ld primes, %ld composites\n", name, prime_count, composite_count);
+}
+
+static void quadratic_primality_file(char *name, bool verbose, unsigned thread_count)
 {
     long prime_count = 0;
     long composite_count = 0;
     long line = 0;
     FILE *f = fopen(name, "rt");
+    quadratic_journal_t *journal = 0;
+    uint64_t offset = 0;
+    if (f && journal_period)
+    {
+        journal = quadratic_journal_open(name, journal_period);
+        if (!journal)
+        {
+            exit(1);
+        }
+        // lines done by a previous run
+        quadratic_journal_counts(journal, &prime_count, &composite_count);
+        offset = quadratic_journal_resume_offset(journal);
+        if (offset && !json_output)
+        {
+            printf("File %s resumed at offset %lu, %ld primes, %ld composites already done\n", name,
+                   (unsigned long)offset, prime_count, composite_count);
+        }
+        if (fseeko(f, offset, SEEK_SET) < 0)
+        {
+            perror(name);
+            exit(1);
+        }
+    }
     if (f)
     {
         const int buff_len = 1000000; // max line length
@@ -30,6 +223,13 @@ static void quadratic_primality_file(char *name, bool verbose)
         }
         mpz_t v;
         mpz_init(v);
+        quadratic_pipeline_t *pipeline = 0;
+        std::thread consumer;
+        if (pipeline_mode)
+        {
+            pipeline = new quadratic_pipeline_t(thread_count);
+            consumer = pipeline_consumer(pipeline, verbose, journal, &prime_count, &composite_count);
+        }
 
         // get a line
         buff[buff_len - 2] = 0;
@@ -42,8 +242,14 @@ static void quadratic_primality_file(char *name, bool verbose)
                         printf("Input line %ld too long\n", line);
                         exit(1);
                 }
-            // trim trailing spaces
             int len = strlen(buff);
+            uint64_t line_offset = offset;
+            offset += len;
+            if (journal && quadratic_journal_lookup(journal, line_offset) >= 0)
+            {
+                continue; // done by a previous run, already counted
+            }
+            // trim trailing spaces
             while (len > 0 && isspace(buff[len - 1]))
             {
                 len--;
@@ -55,28 +261,128 @@ static void quadratic_primality_file(char *name, bool verbose)
             {
                 pt++;
             }
-            if (*pt && *pt != '#') // discard empty lines or comments
+            if (*pt && *pt != '#' && pipeline)
             {
-                if (verbose)
+                quadratic_pipeline_item_t item;
+                uint64_t t0 = main_ns();
+                item.has_form = mpz_expression_parse_form(item.n.get_mpz_t(), pt, &item.form);
+                item.parse_ns = main_ns() - t0;
+                item.input = pt;
+                item.offset = line_offset;
+                item.length = offset - line_offset;
+                pipeline->push(std::move(item));
+            }
+            else if (*pt && *pt != '#') // discard empty lines or comments
+            {
+                if (verbose && !json_output)
                 {
                     printf("%s ...", pt);
                     fflush(stdout);
                 }
-                mpz_expression_parse(v, pt);
-                bool is_prime = mpz_quadratic_primality(v);
-                if (verbose)
+                quadratic_stats_t st;
+                number_form_t form;
+                uint64_t t0 = main_ns();
+                bool has_form = mpz_expression_parse_form(v, pt, &form);
+                uint64_t parse_ns = main_ns() - t0;
+                bool is_prime = mpz_quadratic_primality(v, false, json_output ? &st : 0, 0, has_form ? &form : 0);
+                if (json_output)
+                {
+                    json_result(pt, is_prime, &st, parse_ns);
+                }
+                else if (verbose)
                 {
                     printf(" %s\n", is_prime ? "might be prime" : "composite for sure");
                 }
                 prime_count += (is_prime == true);
                 composite_count += (is_prime == false);
+                if (journal)
+                {
+                    quadratic_journal_record(journal, line_offset, offset - line_offset,
+                                             is_prime ? QUADRATIC_JOURNAL_PRIME : QUADRATIC_JOURNAL_COMPOSITE);
+                }
+            }
+            else if (journal)
+            {
+                quadratic_journal_record(journal, line_offset, offset - line_offset, QUADRATIC_JOURNAL_EMPTY);
             }
         }
+        if (pipeline)
+        {
+            pipeline->close();
+            consumer.join();
+            file_done(name, prime_count, composite_count, pipeline);
+            delete pipeline;
+        }
+        quadratic_journal_close(journal);
         mpz_clear(v);
 	free(buff);
 	fclose(f);
+        if (pipeline_mode)
+        {
+            return;
+        }
     }
-    printf("File %s done, %ld primes, %ld composites\n", name, prime_count, composite_count);
+    file_done(name, prime_count, composite_count, 0);
+}
+
+static void quadratic_primality_binary_file(char *name, bool verbose, unsigned thread_count)
+{
+    long prime_count = 0;
+    long composite_count = 0;
+    long record = 0;
+    quadratic_binary_t *f = quadratic_binary_open(name);
+    if (f && pipeline_mode)
+    {
+        quadratic_pipeline_t pipeline(thread_count);
+        std::thread consumer = pipeline_consumer(&pipeline, verbose, 0, &prime_count, &composite_count);
+        mpz_ptr v;
+        quadratic_pipeline_item_t item;
+        while ((v = quadratic_binary_next(f, &item.form, &item.has_form)) != 0)
+        {
+            char input[32];
+            snprintf(input, sizeof(input), "#%ld", ++record);
+            item.n = mpz_class(v);
+            item.input = input;
+            item.parse_ns = 0;
+            pipeline.push(std::move(item));
+        }
+        pipeline.close();
+        consumer.join();
+        quadratic_binary_close(f);
+        file_done(name, prime_count, composite_count, &pipeline);
+        return;
+    }
+    if (f)
+    {
+        mpz_ptr v;
+        number_form_t form;
+        bool has_form;
+        while ((v = quadratic_binary_next(f, &form, &has_form)) != 0)
+        {
+            record++;
+            if (verbose && !json_output)
+            {
+                printf("record %ld (%lu bits) ...", record, (unsigned long)mpz_sizeinbase(v, 2));
+                fflush(stdout);
+            }
+            quadratic_stats_t st;
+            bool is_prime = mpz_quadratic_primality(v, false, json_output ? &st : 0, 0, has_form ? &form : 0);
+            if (json_output)
+            {
+                char input[32];
+                snprintf(input, sizeof(input), "#%ld", record);
+                json_result(input, is_prime, &st, 0);
+            }
+            else if (verbose)
+            {
+                printf(" %s\n", is_prime ? "might be prime" : "composite for sure");
+            }
+            prime_count += (is_prime == true);
+            composite_count += (is_prime == false);
+        }
+        quadratic_binary_close(f);
+    }
+    file_done(name, prime_count, composite_count, 0);
 }
 
 int main(int argc, char **argv)
@@ -85,12 +391,22 @@ int main(int argc, char **argv)
     mp_set_memory_functions(quadratic_allocate_function, quadratic_reallocate_function, quadratic_free_function);
 
     bool verbose = false;
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
     for (int i = 1; i < argc; i++)
     {
         if (!strcmp(argv[i], "-st"))
         {
             // internal sanity self tests
             quadratic_primality_self_test();
+            mpz_expression_self_test();
+            quadratic_scheduler_self_test();
+            quadratic_cache_self_test();
+            quadratic_pipeline_self_test();
+            quadratic_generator_self_test();
+            quadratic_journal_self_test();
+            quadratic_binary_self_test();
+            quadratic_server_self_test();
+            quadratic_worker_self_test();
             printf("Self tests completed\n");
             exit(0);
         }
@@ -100,16 +416,37 @@ int main(int argc, char **argv)
             printf(" --help ............... : this\n");
             printf(" --version ............ : print the software version\n");
             printf(" -v ................... : enable verbose mode (should be before expressions)\n");
+            printf(" --json ............... : one JSON object per number, with timings (should be before "
+                   "expressions)\n");
             printf(" -st .................. : run self-test and exit\n");
             printf(" -f filename .......... : test multiple expressions in a file, one per line, count primes and "
                    "composites\n");
+            printf(" -fb filename ......... : test multiple numbers in a binary candidate file, count primes and "
+                   "composites\n");
+            printf(" --journal n .......... : -f keeps a journal of the lines done in filename.journal, fsync-ed every n "
+                   "lines,\n"
+                   "                          an interrupted run restarts where it stopped (should be before -f)\n");
+            printf(" -tb text binary ...... : convert a text file of expressions to a binary candidate file\n");
+            printf(" -gen expr k=a..b ..... : test expr for k = a, a+step ... b, with optional step s and sieve b,\n"
+                   "                          e.g. -gen \"k*2^3000+1\" k=1..1000000 step 2 sieve 1000000\n");
+            printf(" --pipeline ........... : -f and -fb run trial division and a base 2 sprp test before the quadratic "
+                   "test,\n"
+                   "                          composites stopped early never reach the quadratic test (should be "
+                   "before -f)\n");
+            printf(" -t count ............. : number of worker threads (should be before --serve, --worker, -gen, and -f "
+                   "and -fb with --pipeline)\n");
+            printf(" --serve path ......... : run as a daemon on a unix domain socket, see quadratic_primality_server.h\n");
+            printf(" --worker host port ... : test the jobs of a distributed server \"lnrc -server -j filename\", see "
+                   "quadratic_primality_worker.h\n");
+            printf(" --cache dir .......... : keep the verdicts in dir, shared with other runs (should be before "
+                   "expressions)\n");
             printf(" expressions .......... : space-separated numerical expressions to be tested like 2*3^12+1\n");
             printf("\n");
             exit(0);
         }
         else if (!strcmp(argv[i], "--version"))
         {
-            printf("Version 0.2\n");
+            printf("Version %s\n", QUADRATIC_VERSION);
             exit(0);
         }
         else if (!strcmp(argv[i], "-v"))
@@ -117,11 +454,75 @@ int main(int argc, char **argv)
             verbose = true;
             continue;
         }
+        else if (!strcmp(argv[i], "--json"))
+        {
+            // large output buffer, do not throttle high-rate small numbers
+            json_output = true;
+            setvbuf(stdout, 0, _IOFBF, 1 << 20);
+            continue;
+        }
+        else if (!strcmp(argv[i], "--pipeline"))
+        {
+            pipeline_mode = true;
+            continue;
+        }
+        else if (!strcmp(argv[i], "--journal"))
+        {
+            journal_period = atol(argv[++i]);
+            journal_period = journal_period < 1 ? 1 : journal_period;
+            continue;
+        }
         else if (!strcmp(argv[i], "-f"))
         {
-            quadratic_primality_file(argv[++i], verbose);
+            quadratic_primality_file(argv[++i], verbose, thread_count);
             verbose = true;
         }
+        else if (!strcmp(argv[i], "-fb"))
+        {
+            quadratic_primality_binary_file(argv[++i], verbose, thread_count);
+            verbose = true;
+        }
+        else if (!strcmp(argv[i], "-gen"))
+        {
+            quadratic_primality_range(argc, argv, i, thread_count, verbose);
+        }
+        else if (!strcmp(argv[i], "-t"))
+        {
+            thread_count = atol(argv[++i]);
+            thread_count = thread_count < 1 ? 1 : thread_count;
+            continue;
+        }
+        else if (!strcmp(argv[i], "--cache"))
+        {
+            quadratic_cache_t *cache = quadratic_cache_open(argv[++i]);
+            if (!cache)
+            {
+                exit(1);
+            }
+            quadratic_cache_attach(cache);
+            continue;
+        }
+        else if (!strcmp(argv[i], "--serve"))
+        {
+            exit(quadratic_serve(argv[++i], thread_count, verbose) < 0 ? 1 : 0);
+        }
+        else if (!strcmp(argv[i], "--worker"))
+        {
+            const char *host = argv[++i];
+            unsigned short port = atol(argv[++i]);
+            exit(quadratic_worker(host, port, thread_count, verbose) < 0 ? 1 : 0);
+        }
+        else if (!strcmp(argv[i], "-tb"))
+        {
+            char *text_name = argv[++i];
+            char *binary_name = argv[++i];
+            long count = quadratic_binary_convert(text_name, binary_name);
+            if (count < 0)
+            {
+                exit(1);
+            }
+            printf("File %s converted, %ld numbers\n", binary_name, count);
+        }
         else
         {
             // command line argument must be a number, or an expression
@@ -131,11 +532,23 @@ int main(int argc, char **argv)
 
             // Read an expression from the command line
             // Supported operators are +/-*^() with usual precedence.
-            mpz_expression_parse(n, argv[i]);
+            number_form_t form;
+            uint64_t t0 = main_ns();
+            bool has_form = mpz_expression_parse_form(n, argv[i], &form);
+            uint64_t parse_ns = main_ns() - t0;
             // gmp_printf("Test n=%Zd.\n",n);
 
+            if (json_output)
+            {
+                quadratic_stats_t st;
+                bool is_prime = mpz_quadratic_primality(n, verbose, &st, 0, has_form ? &form : 0);
+                json_result(argv[i], is_prime, &st, parse_ns);
+                mpz_clear(n);
+                continue;
+            }
+
             clock_gettime(CLOCK_REALTIME, &ts1);
-            bool is_prime = mpz_quadratic_primality(n, verbose);
+            bool is_prime = mpz_quadratic_primality(n, verbose, 0, 0, has_form ? &form : 0);
             clock_gettime(CLOCK_REALTIME, &ts2);
 
             // Display the input number, the number of steps, and the time it took to run it, in milliseconds.
@@ -151,5 +564,6 @@ int main(int argc, char **argv)
         }
     }
 
+    fflush(stdout);
     return 0;
 }
@@ -0,0 +1,348 @@
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// tiered filtering of bulk candidates : trial division, base 2 sprp, quadratic test
+// -----------------------------------------------------------------------
+
+#include <assert.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "quadratic_primality_pipeline.h"
+
+#define PIPELINE_TRIAL_BOUND (1u << 22) // largest trial divisor
+#define PIPELINE_TRIAL_MIN 1000         // primes tried, at least
+
+static uint64_t pipeline_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// ------------------------------------------------------------------------------
+// bounded queue between 2 stages
+// ------------------------------------------------------------------------------
+
+void quadratic_pipeline_t::queue_t::init(size_t c, unsigned p)
+{
+    capacity = c;
+    producers = p;
+}
+
+void quadratic_pipeline_t::queue_t::push(quadratic_pipeline_item_t &&item)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    not_full.wait(guard, [this] { return items.size() < capacity; });
+    items.push_back(std::move(item));
+    not_empty.notify_one();
+}
+
+bool quadratic_pipeline_t::queue_t::pop(quadratic_pipeline_item_t &item)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    not_empty.wait(guard, [this] { return !items.empty() || producers == 0; });
+    if (items.empty())
+    {
+        return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    not_full.notify_one();
+    return true;
+}
+
+void quadratic_pipeline_t::queue_t::producer_done()
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if (--producers == 0)
+    {
+        not_empty.notify_all();
+    }
+}
+
+// ------------------------------------------------------------------------------
+// stages
+// ------------------------------------------------------------------------------
+
+quadratic_pipeline_t::quadratic_pipeline_t(unsigned thread_count) : pushed(0), popped(0), closed(false)
+{
+    if (thread_count == 0)
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = n > 0 ? n : 1;
+    }
+    for (unsigned i = 0; i < 4; i++)
+    {
+        decided[i] = 0;
+    }
+
+    // primes grouped by products which fit in 64 bits, one mpz_fdiv_ui() per group
+    std::vector<bool> composite(PIPELINE_TRIAL_BOUND + 1, false);
+    for (uint64_t i = 2; i <= PIPELINE_TRIAL_BOUND; i++)
+    {
+        if (composite[i])
+        {
+            continue;
+        }
+        for (uint64_t j = i * i; j <= PIPELINE_TRIAL_BOUND; j += i)
+        {
+            composite[j] = true;
+        }
+        primes.push_back(i);
+    }
+    for (uint32_t i = 0; i < primes.size();)
+    {
+        trial_group_t g;
+        g.product = primes[i];
+        g.first = i++;
+        while (i < primes.size() && g.product <= UINT64_MAX / primes[i])
+        {
+            g.product *= primes[i++];
+        }
+        g.last = i;
+        groups.push_back(g);
+    }
+
+    // stage 1 is cheap, the survivors of stage 2 are rare
+    unsigned trial_threads = 1 + thread_count / 8;
+    window = 16 * thread_count + 64;
+    trial_queue.init(4 * thread_count, 1);
+    sprp_queue.init(4 * thread_count, trial_threads);
+    quadratic_queue.init(4 * thread_count, trial_threads + thread_count);
+    for (unsigned i = 0; i < trial_threads; i++)
+    {
+        threads.emplace_back(&quadratic_pipeline_t::trial_loop, this);
+    }
+    for (unsigned i = 0; i < thread_count; i++)
+    {
+        threads.emplace_back(&quadratic_pipeline_t::sprp_loop, this);
+        threads.emplace_back(&quadratic_pipeline_t::quadratic_loop, this);
+    }
+}
+
+quadratic_pipeline_t::~quadratic_pipeline_t()
+{
+    close();
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+}
+
+void quadratic_pipeline_t::done(quadratic_pipeline_item_t &&item, int stage, bool is_prime)
+{
+    item.stage = stage;
+    item.is_prime = is_prime;
+    std::lock_guard<std::mutex> guard(done_lock);
+    uint64_t index = item.index;
+    completed.emplace(index, std::move(item));
+    if (index == popped)
+    {
+        done_ready.notify_all();
+    }
+}
+
+// stats of a number decided before the quadratic test
+static void pipeline_stats(quadratic_pipeline_item_t &item)
+{
+    item.stats.bits = mpz_sizeinbase(item.n.get_mpz_t(), 2);
+    item.stats.mod8 = mpz_get_ui(item.n.get_mpz_t()) & 7;
+    item.stats.a = 0;
+    item.stats.reduction = "none";
+    item.stats.sieve_ns = 0;
+    item.stats.precompute_ns = 0;
+    item.stats.exponentiate_ns = 0;
+}
+
+// true when a small factor is found, the number is larger than the primes
+bool quadratic_pipeline_t::trial_division(const mpz_class &n)
+{
+    // about the cost of a small part of the modular exponentiation of stage 2
+    size_t bits = mpz_sizeinbase(n.get_mpz_t(), 2);
+    size_t limit = bits * mpz_size(n.get_mpz_t());
+    limit = limit < PIPELINE_TRIAL_MIN ? PIPELINE_TRIAL_MIN : limit;
+    for (size_t i = 0; i < groups.size() && groups[i].first < limit; i++)
+    {
+        uint64_t r = mpz_fdiv_ui(n.get_mpz_t(), groups[i].product);
+        for (uint32_t j = groups[i].first; j < groups[i].last; j++)
+        {
+            if (r % primes[j] == 0)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void quadratic_pipeline_t::trial_loop()
+{
+    quadratic_pipeline_item_t item;
+    while (trial_queue.pop(item))
+    {
+        if (mpz_sizeinbase(item.n.get_mpz_t(), 2) <= 64)
+        {
+            quadratic_queue.push(std::move(item));
+            continue;
+        }
+        uint64_t t0 = pipeline_ns();
+        bool has_factor = trial_division(item.n);
+        pipeline_stats(item);
+        item.stats.sieve_ns = pipeline_ns() - t0;
+        if (has_factor)
+        {
+            done(std::move(item), QUADRATIC_STAGE_TRIAL, false);
+        }
+        else
+        {
+            sprp_queue.push(std::move(item));
+        }
+    }
+    sprp_queue.producer_done();
+    quadratic_queue.producer_done();
+}
+
+void quadratic_pipeline_t::sprp_loop()
+{
+    mpz_t d, x, nm1;
+    mpz_inits(d, x, nm1, 0);
+    quadratic_pipeline_item_t item;
+    while (sprp_queue.pop(item))
+    {
+        // n - 1 = d * 2^s, 2^d == 1 or 2^(d*2^i) == -1 for some i < s
+        uint64_t t0 = pipeline_ns();
+        mpz_srcptr n = item.n.get_mpz_t();
+        mpz_sub_ui(nm1, n, 1);
+        mp_bitcnt_t s = mpz_scan1(nm1, 0);
+        mpz_fdiv_q_2exp(d, nm1, s);
+        mpz_set_ui(x, 2);
+        mpz_powm(x, x, d, n);
+        bool probable = mpz_cmp_ui(x, 1) == 0 || mpz_cmp(x, nm1) == 0;
+        for (mp_bitcnt_t i = 1; i < s && !probable; i++)
+        {
+            mpz_mul(x, x, x);
+            mpz_mod(x, x, n);
+            if (mpz_cmp_ui(x, 1) == 0)
+            {
+                break;
+            }
+            probable = mpz_cmp(x, nm1) == 0;
+        }
+        item.stats.exponentiate_ns = pipeline_ns() - t0;
+        if (probable)
+        {
+            quadratic_queue.push(std::move(item));
+        }
+        else
+        {
+            done(std::move(item), QUADRATIC_STAGE_SPRP, false);
+        }
+    }
+    mpz_clears(d, x, nm1, 0);
+    quadratic_queue.producer_done();
+}
+
+void quadratic_pipeline_t::quadratic_loop()
+{
+    quadratic_context_t *ctx = quadratic_context_create();
+    quadratic_pipeline_item_t item;
+    while (quadratic_queue.pop(item))
+    {
+        bool is_prime = mpz_quadratic_primality(item.n.get_mpz_t(), false, &item.stats, ctx,
+                                                item.has_form ? &item.form : 0);
+        done(std::move(item), QUADRATIC_STAGE_QUADRATIC, is_prime);
+    }
+    quadratic_context_destroy(ctx);
+}
+
+// ------------------------------------------------------------------------------
+// input and output
+// ------------------------------------------------------------------------------
+
+void quadratic_pipeline_t::push(quadratic_pipeline_item_t &&item)
+{
+    {
+        std::unique_lock<std::mutex> guard(done_lock);
+        window_free.wait(guard, [this] { return pushed - popped < window; });
+        item.index = pushed++;
+    }
+    trial_queue.push(std::move(item));
+}
+
+void quadratic_pipeline_t::close()
+{
+    {
+        std::lock_guard<std::mutex> guard(done_lock);
+        if (closed)
+        {
+            return;
+        }
+        closed = true;
+        done_ready.notify_all();
+    }
+    trial_queue.producer_done();
+}
+
+bool quadratic_pipeline_t::pop(quadratic_pipeline_item_t &item)
+{
+    std::unique_lock<std::mutex> guard(done_lock);
+    done_ready.wait(guard, [this] { return completed.count(popped) || (closed && popped == pushed); });
+    auto it = completed.find(popped);
+    if (it == completed.end())
+    {
+        return false;
+    }
+    item = std::move(it->second);
+    completed.erase(it);
+    popped++;
+    decided[item.stage]++;
+    window_free.notify_one();
+    return true;
+}
+
+// ------------------------------------------------------------------------------
+// Simple foolguard unit tests
+// ------------------------------------------------------------------------------
+
+void quadratic_pipeline_self_test(void)
+{
+    printf("Pipeline ...\n");
+    quadratic_pipeline_t pipeline(2);
+
+    // every stage decides a part of the numbers, with the verdicts of the quadratic test
+    mpz_class p = 1;
+    p <<= 521;
+    std::vector<mpz_class> numbers;
+    numbers.push_back(p - 1); // prime
+    numbers.push_back(mpz_class(10007) * mpz_class(10009) * (p - 1)); // factors only found by stage 1
+    numbers.push_back(mpz_class(7919));                                   // small prime
+    for (unsigned i = 0; i < 200; i++)
+    {
+        numbers.push_back(p + 2 * i + 1); // most are decided by stage 1 or 2
+    }
+    std::thread producer([&] {
+        for (size_t i = 0; i < numbers.size(); i++)
+        {
+            quadratic_pipeline_item_t item;
+            item.n = numbers[i];
+            item.has_form = false;
+            pipeline.push(std::move(item));
+        }
+        pipeline.close();
+    });
+    quadratic_pipeline_item_t item;
+    size_t count = 0;
+    while (pipeline.pop(item))
+    {
+        assert(item.n == numbers[count]);
+        assert(item.is_prime == mpz_quadratic_primality(numbers[count].get_mpz_t()));
+        count++;
+    }
+    producer.join();
+    assert(count == numbers.size());
+    assert(pipeline.decided[QUADRATIC_STAGE_TRIAL] > 0);
+    assert(pipeline.decided[QUADRATIC_STAGE_SPRP] > 0);
+    assert(pipeline.decided[QUADRATIC_STAGE_QUADRATIC] > 0);
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// tiered filtering of bulk candidates
+//
+//    stage 1 : trial division by the small primes, deeper for larger numbers,
+//              at a small fraction of the cost of stage 2
+//    stage 2 : strong probable prime test to base 2, a single mpz_powm(), about
+//              one modular squaring per bit
+//    stage 3 : quadratic test, on the survivors only
+//
+// Each stage has its own threads, stages are connected by bounded queues.
+// Items come out of pop() in the order they were pushed.
+//
+// A number rejected by stage 1 or 2 is composite for sure. "might be prime"
+// is always the verdict of the quadratic test. Composites which fail stage 1
+// or 2 never reach the quadratic test : this mode cannot find composites
+// which pass the quadratic test, do not use it to search for counterexamples.
+//
+// Numbers below 2^64 go directly to stage 3.
+// -----------------------------------------------------------------------
+
+#include <gmpxx.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "quadratic_primality.h"
+#include "quadratic_primality_precompute.h"
+
+#define QUADRATIC_STAGE_TRIAL 1
+#define QUADRATIC_STAGE_SPRP 2
+#define QUADRATIC_STAGE_QUADRATIC 3
+
+struct quadratic_pipeline_item_t
+{
+    mpz_class n;
+    bool has_form;
+    number_form_t form;
+    std::string input; // e.g. the expression, for the report
+    uint64_t offset;   // position in the input file
+    uint64_t length;
+    uint64_t parse_ns;
+    uint64_t index; // set by push()
+    int stage;      // stage which decided
+    bool is_prime;
+    quadratic_stats_t stats;
+};
+
+class quadratic_pipeline_t
+{
+  public:
+    quadratic_pipeline_t(unsigned thread_count = 0); // 0 : one thread per core and per stage
+    ~quadratic_pipeline_t();
+
+    quadratic_pipeline_t(const quadratic_pipeline_t &) = delete;
+    quadratic_pipeline_t &operator=(const quadratic_pipeline_t &) = delete;
+
+    // blocks while too many items are in the pipeline, pop() from another thread
+    void push(quadratic_pipeline_item_t &&item);
+    // no more items
+    void close();
+    // next item in push order, false after the last item
+    bool pop(quadratic_pipeline_item_t &item);
+
+    long decided[4]; // items decided by each stage, valid after the last pop()
+
+  private:
+    class queue_t
+    {
+      public:
+        void init(size_t capacity, unsigned producers);
+        void push(quadratic_pipeline_item_t &&item);
+        bool pop(quadratic_pipeline_item_t &item);
+        void producer_done(); // the last producer closes the queue
+
+      private:
+        std::mutex lock;
+        std::condition_variable not_empty, not_full;
+        std::deque<quadratic_pipeline_item_t> items;
+        size_t capacity;
+        unsigned producers;
+    };
+
+    struct trial_group_t
+    {
+        uint64_t product; // of the primes first .. last-1
+        uint32_t first, last;
+    };
+
+    void trial_loop();
+    void sprp_loop();
+    void quadratic_loop();
+    bool trial_division(const mpz_class &n);
+    void done(quadratic_pipeline_item_t &&item, int stage, bool is_prime);
+
+    std::vector<uint32_t> primes;
+    std::vector<trial_group_t> groups;
+
+    queue_t trial_queue, sprp_queue, quadratic_queue;
+    std::vector<std::thread> threads;
+
+    // completed items, in order
+    std::mutex done_lock;
+    std::condition_variable done_ready, window_free;
+    std::map<uint64_t, quadratic_pipeline_item_t> completed;
+    uint64_t pushed, popped;
+    size_t window; // items pushed and not popped
+    bool closed;
+};
+
+void quadratic_pipeline_self_test(void);
@@ -11,9 +11,8 @@
 
 typedef unsigned __int128 uint128_t;
 
-struct mod_precompute_t *mpz_mod_precompute(mpz_t n, bool verbose)
+static struct mod_precompute_t *mod_precompute_alloc(mpz_t n)
 {
-    mpz_t tmp;
     mod_precompute_t *p = (mod_precompute_t *)quadratic_allocate_function(sizeof(mod_precompute_t));
 
     p->special_case = false;
@@ -22,13 +21,70 @@ struct mod_precompute_t *mpz_mod_precompute(mpz_t n, bool verbose)
     p->power2pe = false;
     p->power2me = false;
     p->gmn = false;
-    mpz_init(tmp);
     mpz_inits(p->a, p->b, p->m, p->inv, p->x_lo, p->x_hi, 0);
     p->n = mpz_sizeinbase(n, 2);
     p->n2 = 0;
     p->n32 = 0;
     p->e = 0;
     mpz_set(p->m, n);
+    return p;
+}
+
+static void mod_precompute_barrett(struct mod_precompute_t *p, mpz_t n, mpz_t tmp)
+{
+    // precompute a variant of Barrett reduction
+    // b = 2^(3n/2) / n
+    // a = 2^(3n/2) % n
+    p->n2 = p->n >> 1;
+    p->n32 = p->n + p->n2;
+    mpz_set_ui(tmp, 1);
+    mpz_mul_2exp(tmp, tmp, p->n32);
+    mpz_divmod(p->b, p->a, tmp, n);
+}
+
+static void mod_precompute_proth(struct mod_precompute_t *p, mpz_t n, mpz_t tmp)
+{
+    // the least significant half of the number is 0x0001....1
+    // precompute the most significant part of the number
+    mpz_div_2exp(p->b, n, p->n2);
+    p->n32 = p->n + (p->n >> 1);
+    mpz_set_ui(tmp, 1);
+    mpz_mul_2exp(tmp, tmp, p->n32);
+    mpz_mod(p->a, tmp, n);
+    p->proth = true;
+    p->montg = true;
+    p->special_case = true;
+}
+
+static void mod_precompute_report(struct mod_precompute_t *p)
+{
+    if (p->power2pe)
+    {
+        printf("Modular reduction optimized for numbers 2^s + e\n");
+    }
+    if (p->power2me)
+    {
+        printf("Modular reduction optimized for numbers 2^s - e\n");
+    }
+    if (p->proth)
+    {
+        printf("Modular reduction optimized for numbers e*2^s + 1\n");
+    }
+    if (p->gmn)
+    {
+        printf("Modular reduction optimized for numbers a*2^s - b\n");
+    }
+    if (!p->special_case)
+    {
+        printf("Modular reduction not optimized\n");
+    }
+}
+
+struct mod_precompute_t *mpz_mod_precompute(mpz_t n, bool verbose)
+{
+    mpz_t tmp;
+    mod_precompute_t *p = mod_precompute_alloc(n);
+    mpz_init(tmp);
 
     // check a power of 2 minus e
     mpz_set_ui(tmp, 1);
@@ -66,16 +122,7 @@ struct mod_precompute_t *mpz_mod_precompute(mpz_t n, bool verbose)
             {
                 p->n2 += 1;
             }
-            // the least significant half of the number is 0x0001....1
-            // precompute the most significant part of the number
-            mpz_div_2exp(p->b, n, p->n2);
-            p->n32 = p->n + (p->n >> 1);
-            mpz_set_ui(tmp, 1);
-            mpz_mul_2exp(tmp, tmp, p->n32);
-            mpz_mod(p->a, tmp, n);
-            p->proth = true;
-            p->montg = true;
-            p->special_case = true;
+            mod_precompute_proth(p, n, tmp);
         }
     }
 
@@ -103,12 +150,14 @@ struct mod_precompute_t *mpz_mod_precompute(mpz_t n, bool verbose)
                 s += 1;
             }
             mpz_gcd(tmp, p->a, n);
-            if (mpz_cmp_ui(tmp, 1) == 0)
+            // the 2 folding steps of the reduction converge only when a * b^2 is much smaller than 2^s
+            if (mpz_cmp_ui(tmp, 1) == 0 && mpz_sizeinbase(p->a, 2) + 2 * mpz_sizeinbase(p->b, 2) + 8 < s)
             {
                 mpz_mul(tmp, p->a, p->a);
                 mpz_invert(p->inv, tmp, n);
                 p->n2 = s;
                 p->gmn = true;
+                p->montg = true; // each reduction multiplies by a^2
                 p->special_case = true;
             }
         }
@@ -116,40 +165,112 @@ struct mod_precompute_t *mpz_mod_precompute(mpz_t n, bool verbose)
 
     if (!p->special_case)
     {
-        // precompute a variant of Barrett reduction
-        // b = 2^(3n/2) / n
-        // a = 2^(3n/2) % n
-        p->n2 = p->n >> 1;
-        p->n32 = p->n + p->n2;
-        mpz_set_ui(tmp, 1);
-        mpz_mul_2exp(tmp, tmp, p->n32);
-        mpz_divmod(p->b, p->a, tmp, n);
+        mod_precompute_barrett(p, n, tmp);
     }
 
     mpz_clears(tmp, 0);
     if (verbose)
     {
-        if (p->power2pe)
-        {
-            printf("Modular reduction optimized for numbers 2^s + e\n");
-        }
-        if (p->power2me)
-        {
-            printf("Modular reduction optimized for numbers 2^s - e\n");
-        }
-        if (p->proth)
-        {
-            printf("Modular reduction optimized for numbers e*2^s + 1\n");
-        }
-        if (p->gmn)
-        {
-            printf("Modular reduction optimized for numbers a*2^s - b\n");
-        }
-        if (!p->special_case)
+        mod_precompute_report(p);
+    }
+    return p;
+}
+
+// check n == k * 2^s + c, reading only the top limbs and the low limb
+static bool mod_form_matches(mpz_t n, uint64_t k, uint64_t s, int64_t c)
+{
+    mpz_t hi;
+    mpz_init(hi);
+    mpz_div_2exp(hi, n, s);
+    bool r;
+    if (c >= 0)
+    {
+        // high part k, then zeroes, then c
+        r = mpz_cmp_ui(hi, k) == 0 && mpz_getlimbn(n, 0) == (mp_limb_t)c && mpz_scan1(n, 64) >= s;
+    }
+    else
+    {
+        // high part k-1, then ones, then 2^64 - |c|
+        r = mpz_cmp_ui(hi, k - 1) == 0 && mpz_getlimbn(n, 0) == (mp_limb_t)c && mpz_scan0(n, 64) >= s;
+    }
+    mpz_clear(hi);
+    return r;
+}
+
+// same as mpz_mod_precompute() when the number is known to be k * b^n + c.
+// The reduction is chosen from the form, without searching the bits of the
+// number. Other forms, or a form which does not match the number, fall back
+// to mpz_mod_precompute().
+struct mod_precompute_t *mpz_mod_precompute_form(mpz_t n, const struct number_form_t *form, bool verbose)
+{
+    uint64_t k = form->k;
+    uint64_t s = form->n;
+    int64_t c = form->c;
+    // small exponents keep the generic path, like mpz_mod_precompute() does
+    if (form->b != 2 || k == 0 || c == INT64_MIN || s < 128)
+    {
+        return mpz_mod_precompute(n, verbose);
+    }
+    // make k odd
+    while ((k & 1) == 0)
+    {
+        k >>= 1;
+        s += 1;
+    }
+    if (!mod_form_matches(n, k, s, c))
+    {
+        return mpz_mod_precompute(n, verbose);
+    }
+
+    mpz_t tmp;
+    mod_precompute_t *p = mod_precompute_alloc(n);
+    mpz_init(tmp);
+    if (k == 1 && c < 0 && p->n > 128)
+    {
+        // 2^s - e
+        p->e = -c;
+        p->power2me = true;
+        p->special_case = true;
+    }
+    else if (k == 1 && c > 0 && p->n > 128)
+    {
+        // 2^s + e
+        p->e = c;
+        p->power2pe = true;
+        p->special_case = true;
+    }
+    else if (c == 1 && 2 * s >= p->n + 1)
+    {
+        // k * 2^s + 1
+        p->n2 = s;
+        mod_precompute_proth(p, n, tmp);
+    }
+    else if (c < 0 && (uint64_t)(64 - __builtin_clzll(k)) + 2 * (uint64_t)(64 - __builtin_clzll(-c)) + 8 < s)
+    {
+        // k * 2^s - e, same convergence condition as mpz_mod_precompute()
+        mpz_set_ui(p->a, k);
+        mpz_set_ui(p->b, -c);
+        mpz_gcd(tmp, p->a, n);
+        if (mpz_cmp_ui(tmp, 1) == 0)
         {
-            printf("Modular reduction not optimized\n");
+            mpz_mul(tmp, p->a, p->a);
+            mpz_invert(p->inv, tmp, n);
+            p->n2 = s;
+            p->gmn = true;
+            p->montg = true; // each reduction multiplies by a^2
+            p->special_case = true;
         }
     }
+    if (!p->special_case)
+    {
+        mod_precompute_barrett(p, n, tmp);
+    }
+
+    mpz_clears(tmp, 0);
+    if (verbose)
+    {
+        mod_precompute_report(p);
+    }
     return p;
 }
 
@@ -163,6 +284,27 @@ void mpz_mod_uncompute(mod_precompute_t *p)
     }
 }
 
+const char *mpz_mod_reduction_name(struct mod_precompute_t *p)
+{
+    if (p->power2pe)
+    {
+        return "2^s+e";
+    }
+    if (p->power2me)
+    {
+        return "2^s-e";
+    }
+    if (p->proth)
+    {
+        return "e*2^s+1";
+    }
+    if (p->gmn)
+    {
+        return "a*2^s-b";
+    }
+    return "barrett";
+}
+
 // input
 //     r   : a number to reduce, can be much larger than modulus^2 by magnitude orders
 //     tmp : scratch area
@@ -30,8 +30,19 @@ struct mod_precompute_t
     uint64_t e;        // small number part of the modulus
 };
 
+// number k * b^n + c, as written in the input
+struct number_form_t
+{
+    uint64_t k; // multiplier
+    uint64_t b; // base
+    uint64_t n; // exponent
+    int64_t c;  // small signed constant
+};
+
 struct mod_precompute_t *mpz_mod_precompute(mpz_t n, bool verbose = false);
+struct mod_precompute_t *mpz_mod_precompute_form(mpz_t n, const struct number_form_t *form, bool verbose = false);
 void mpz_mod_uncompute(mod_precompute_t *p);
+const char *mpz_mod_reduction_name(struct mod_precompute_t *p);
 void mpz_mod_fast_reduce(mpz_t r, mpz_t tmp, struct mod_precompute_t *p);
 void mpz_mod_positive_reduce(mpz_t r, mpz_t tmp, struct mod_precompute_t *p);
 void mpz_mod_div2(mpz_t r, struct mod_precompute_t *p);
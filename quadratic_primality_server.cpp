@@ -0,0 +1,480 @@
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// long-lived daemon on a unix domain socket, with a pool of worker threads
+// -----------------------------------------------------------------------
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "bison.gmp_expr.h"
+#include "quadratic_primality.h"
+#include "quadratic_primality_alloc.h"
+#include "quadratic_primality_server.h"
+
+#define MAX_REQUEST_LENGTH (1u << 28) // max payload, approx 2^31 bits numbers
+#define MAX_PENDING_JOBS 4096         // readers wait when workers lag behind
+#define MAX_BATCH 64                  // jobs taken by a worker at once
+
+typedef struct connection_s
+{
+    int s;
+    unsigned refcount; // reader + pending jobs
+    pthread_mutex_t write_lock;
+} connection_t;
+
+typedef struct job_s
+{
+    struct job_s *next;
+    connection_t *conn;
+    uint64_t id;
+    uint8_t type;
+    uint8_t verdict;
+    uint32_t len;
+    uint8_t *payload;
+} job_t;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_not_full = PTHREAD_COND_INITIALIZER;
+static job_t *queue_head = 0;
+static job_t *queue_tail = 0;
+static unsigned queue_count = 0;
+
+static bool server_verbose = false;
+
+static int read_full(int s, void *buff, size_t len)
+{
+    uint8_t *p = (uint8_t *)buff;
+    size_t l = 0;
+    while (l < len)
+    {
+        ssize_t r = read(s, p + l, len - l);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r <= 0)
+        {
+            return -1;
+        }
+        l += r;
+    }
+    return 0;
+}
+
+static int write_full(int s, const void *buff, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buff;
+    size_t l = 0;
+    while (l < len)
+    {
+        ssize_t r = write(s, p + l, len - l);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r <= 0)
+        {
+            return -1;
+        }
+        l += r;
+    }
+    return 0;
+}
+
+static void connection_release(connection_t *conn)
+{
+    pthread_mutex_lock(&queue_lock);
+    bool last = (--conn->refcount == 0);
+    pthread_mutex_unlock(&queue_lock);
+    if (last)
+    {
+        if (server_verbose)
+        {
+            printf("Closed connection %d\n", conn->s);
+            fflush(stdout);
+        }
+        close(conn->s);
+        pthread_mutex_destroy(&conn->write_lock);
+        free(conn);
+    }
+}
+
+static void queue_push(job_t *job)
+{
+    pthread_mutex_lock(&queue_lock);
+    while (queue_count >= MAX_PENDING_JOBS)
+    {
+        pthread_cond_wait(&queue_not_full, &queue_lock);
+    }
+    job->next = 0;
+    if (queue_tail)
+    {
+        queue_tail->next = job;
+    }
+    else
+    {
+        queue_head = job;
+    }
+    queue_tail = job;
+    queue_count++;
+    job->conn->refcount++;
+    pthread_cond_signal(&queue_not_empty);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+// take up to max jobs, small numbers are processed in batches
+static unsigned queue_pop(job_t **jobs, unsigned max)
+{
+    unsigned count = 0;
+    pthread_mutex_lock(&queue_lock);
+    while (queue_count == 0)
+    {
+        pthread_cond_wait(&queue_not_empty, &queue_lock);
+    }
+    while (queue_head && count < max)
+    {
+        jobs[count++] = queue_head;
+        queue_head = queue_head->next;
+        queue_count--;
+        // do not batch large numbers, other workers can take them
+        if (jobs[count - 1]->len > 64)
+        {
+            break;
+        }
+    }
+    if (!queue_head)
+    {
+        queue_tail = 0;
+    }
+    pthread_cond_broadcast(&queue_not_full);
+    pthread_mutex_unlock(&queue_lock);
+    return count;
+}
+
+uint8_t quadratic_request_run(uint8_t type, const uint8_t *payload, uint32_t len, mpz_t v,
+                              struct quadratic_context_t *ctx)
+{
+    number_form_t form;
+    int has_form = 0;
+    if (type == QUADRATIC_REQUEST_EXPRESSION)
+    {
+        // the payload is not zero-terminated
+        char *str = (char *)malloc(len + 1);
+        if (!str)
+        {
+            return QUADRATIC_VERDICT_INVALID;
+        }
+        memcpy(str, payload, len);
+        str[len] = 0;
+        // untrusted, the parse stops at the first error
+        has_form = mpz_expression_parse_checked(v, str, &form);
+        free(str);
+        if (has_form < 0)
+        {
+            return QUADRATIC_VERDICT_INVALID;
+        }
+    }
+    else if (type == QUADRATIC_REQUEST_LIMBS && (len & 7) == 0)
+    {
+        mpz_import(v, len / 8, -1, 8, -1, 0, payload);
+    }
+    else
+    {
+        return QUADRATIC_VERDICT_INVALID;
+    }
+    bool is_prime = mpz_quadratic_primality(v, false, 0, ctx, has_form > 0 ? &form : 0);
+    return is_prime ? QUADRATIC_VERDICT_PRIME : QUADRATIC_VERDICT_COMPOSITE;
+}
+
+static void *worker_thread(void *arg)
+{
+    job_t *jobs[MAX_BATCH];
+    uint8_t response[MAX_BATCH * 13];
+    quadratic_context_t *ctx = quadratic_context_create();
+    mpz_t v;
+    mpz_init(v);
+
+    while (1)
+    {
+        unsigned count = queue_pop(jobs, MAX_BATCH);
+        for (unsigned i = 0; i < count; i++)
+        {
+            jobs[i]->verdict = quadratic_request_run(jobs[i]->type, jobs[i]->payload, jobs[i]->len, v, ctx);
+        }
+
+        // coalesce responses to the same connection
+        unsigned i = 0;
+        while (i < count)
+        {
+            connection_t *conn = jobs[i]->conn;
+            unsigned len = 0;
+            unsigned j = i;
+            while (j < count && jobs[j]->conn == conn)
+            {
+                uint32_t l = 9;
+                memcpy(&response[len], &l, 4);
+                memcpy(&response[len + 4], &jobs[j]->id, 8);
+                response[len + 12] = jobs[j]->verdict;
+                len += 13;
+                j++;
+            }
+            pthread_mutex_lock(&conn->write_lock);
+            write_full(conn->s, response, len);
+            pthread_mutex_unlock(&conn->write_lock);
+            while (i < j)
+            {
+                free(jobs[i]->payload);
+                free(jobs[i]);
+                connection_release(conn);
+                i++;
+            }
+        }
+    }
+
+    mpz_clear(v);
+    quadratic_context_destroy(ctx);
+    return 0;
+}
+
+static void *reader_thread(void *arg)
+{
+    connection_t *conn = (connection_t *)arg;
+    while (1)
+    {
+        uint32_t len;
+        uint8_t header[9];
+        if (read_full(conn->s, &len, 4) < 0)
+        {
+            break;
+        }
+        if (len < 9 || len - 9 > MAX_REQUEST_LENGTH)
+        {
+            printf("Invalid request length %u on connection %d\n", (unsigned)len, conn->s);
+            fflush(stdout);
+            break;
+        }
+        if (read_full(conn->s, header, 9) < 0)
+        {
+            break;
+        }
+        job_t *job = (job_t *)malloc(sizeof(job_t));
+        uint8_t *payload = (uint8_t *)malloc(len - 9 + 1);
+        if (!job || !payload)
+        {
+            printf("Unable to allocate %u bytes\n", (unsigned)len);
+            exit(1);
+        }
+        memcpy(&job->id, header, 8);
+        job->type = header[8];
+        job->len = len - 9;
+        job->payload = payload;
+        job->conn = conn;
+        if (read_full(conn->s, payload, job->len) < 0)
+        {
+            free(payload);
+            free(job);
+            break;
+        }
+        queue_push(job);
+    }
+    // pending jobs still hold the connection
+    shutdown(conn->s, SHUT_RD);
+    connection_release(conn);
+    return 0;
+}
+
+int quadratic_serve(const char *path, unsigned thread_count, bool verbose)
+{
+    struct sockaddr_un addr;
+    pthread_t tid;
+
+    server_verbose = verbose;
+    signal(SIGPIPE, SIG_IGN);
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        printf("Socket path %s too long\n", path);
+        return -1;
+    }
+    int listen_sd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_sd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if (bind(listen_sd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        close(listen_sd);
+        return -1;
+    }
+    if (listen(listen_sd, 64) < 0)
+    {
+        perror("listen");
+        close(listen_sd);
+        return -1;
+    }
+
+    for (unsigned i = 0; i < thread_count; i++)
+    {
+        pthread_create(&tid, 0, worker_thread, 0);
+        pthread_detach(tid);
+    }
+    printf("Serving on %s with %u threads\n", path, thread_count);
+    fflush(stdout);
+
+    while (1)
+    {
+        int conn_sd = accept(listen_sd, 0, 0);
+        if (conn_sd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            perror("accept");
+            break;
+        }
+        connection_t *conn = (connection_t *)malloc(sizeof(connection_t));
+        if (!conn)
+        {
+            close(conn_sd);
+            continue;
+        }
+        conn->s = conn_sd;
+        conn->refcount = 1;
+        pthread_mutex_init(&conn->write_lock, 0);
+        if (verbose)
+        {
+            printf("New connection %d\n", conn_sd);
+            fflush(stdout);
+        }
+        if (pthread_create(&tid, 0, reader_thread, conn) != 0)
+        {
+            connection_release(conn);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    close(listen_sd);
+    unlink(path);
+    return -1;
+}
+
+// ------------------------------------------------------------------------------
+// Simple foolguard unit tests
+// ------------------------------------------------------------------------------
+
+static void *self_test_serve(void *arg)
+{
+    quadratic_serve((const char *)arg, 2, false);
+    return 0;
+}
+
+static void self_test_request(int s, uint64_t id, uint8_t type, const void *payload, uint32_t len)
+{
+    uint32_t l = 9 + len;
+    assert(write_full(s, &l, 4) == 0);
+    assert(write_full(s, &id, 8) == 0);
+    assert(write_full(s, &type, 1) == 0);
+    assert(write_full(s, payload, len) == 0);
+}
+
+void quadratic_server_self_test(void)
+{
+    printf("Server ...\n");
+    char dir[] = "/tmp/quadratic_server_XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return;
+    }
+    static char path[64];
+    snprintf(path, sizeof(path), "%s/sock", dir);
+    pthread_t tid;
+    pthread_create(&tid, 0, self_test_serve, path);
+    pthread_detach(tid);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    int s = -1;
+    for (unsigned retry = 0; retry < 100 && s < 0; retry++)
+    {
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            close(s);
+            s = -1;
+            usleep(10000);
+        }
+    }
+    assert(s >= 0);
+
+    // malformed and deeply nested expressions are invalid, the server survives them
+    static const struct
+    {
+        const char *expression;
+        uint8_t verdict;
+    } tests[] = {
+        {"2^127-1", QUADRATIC_VERDICT_PRIME},
+        {"2^67-1", QUADRATIC_VERDICT_COMPOSITE},
+        {"2^127-1)", QUADRATIC_VERDICT_INVALID},
+        {"2^^127", QUADRATIC_VERDICT_INVALID},
+        {"2^127-1 ; rm", QUADRATIC_VERDICT_INVALID},
+        {"12/(3-3)+1", QUADRATIC_VERDICT_INVALID},
+        {"3-5", QUADRATIC_VERDICT_INVALID},
+        {"", QUADRATIC_VERDICT_INVALID},
+        {"1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1)))))))))))))))))))))))",
+         QUADRATIC_VERDICT_INVALID},
+        {"2^89-1", QUADRATIC_VERDICT_PRIME},
+    };
+    unsigned count = sizeof(tests) / sizeof(tests[0]);
+    for (unsigned i = 0; i < count; i++)
+    {
+        self_test_request(s, i, QUADRATIC_REQUEST_EXPRESSION, tests[i].expression, strlen(tests[i].expression));
+    }
+    // nested brackets, beyond the depth of the parser stack
+    std::string deep = std::string(20000, '(') + "7" + std::string(20000, ')');
+    self_test_request(s, count, QUADRATIC_REQUEST_EXPRESSION, deep.data(), deep.size());
+    uint64_t limbs = 7;
+    self_test_request(s, count + 1, QUADRATIC_REQUEST_LIMBS, &limbs, 7); // not whole limbs
+    self_test_request(s, count + 2, QUADRATIC_REQUEST_LIMBS, &limbs, 8);
+
+    // responses in completion order
+    for (unsigned i = 0; i < count + 3; i++)
+    {
+        uint8_t response[13];
+        assert(read_full(s, response, 13) == 0);
+        uint32_t l;
+        uint64_t id;
+        memcpy(&l, response, 4);
+        memcpy(&id, response + 4, 8);
+        assert(l == 9 && id < count + 3);
+        uint8_t verdict = id < count       ? tests[id].verdict
+                          : id == count + 2 ? QUADRATIC_VERDICT_PRIME
+                                            : QUADRATIC_VERDICT_INVALID;
+        assert(response[12] == verdict);
+    }
+    close(s);
+    unlink(path);
+    rmdir(dir);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// long-lived daemon on a unix domain socket
+//
+// request  : uint32 length, uint64 id, uint8 type, payload   (length counts id + type + payload)
+//            type 0 : payload is an expression like 2^127-1
+//            type 1 : payload is a number, little-endian 64-bit limbs
+// response : uint32 length (9), uint64 id, uint8 verdict
+//            verdict 0 : composite for sure
+//            verdict 1 : might be prime
+//            verdict 2 : invalid request
+//
+// All integers are little-endian. Many requests can be pipelined on one
+// connection, responses come back in completion order, matched by id.
+// -----------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "quadratic_primality.h"
+
+#define QUADRATIC_REQUEST_EXPRESSION 0
+#define QUADRATIC_REQUEST_LIMBS 1
+
+#define QUADRATIC_VERDICT_COMPOSITE 0
+#define QUADRATIC_VERDICT_PRIME 1
+#define QUADRATIC_VERDICT_INVALID 2
+
+// verdict of one request, v and ctx are the scratch of the calling thread
+uint8_t quadratic_request_run(uint8_t type, const uint8_t *payload, uint32_t len, mpz_t v,
+                              struct quadratic_context_t *ctx);
+
+int quadratic_serve(const char *path, unsigned thread_count, bool verbose);
+void quadratic_server_self_test(void);
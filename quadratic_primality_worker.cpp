@@ -0,0 +1,288 @@
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// worker of the distributed server, one connection per thread
+// -----------------------------------------------------------------------
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <thread>
+#include <vector>
+
+#include "quadratic_primality.h"
+#include "quadratic_primality_server.h"
+#include "quadratic_primality_worker.h"
+
+#define WORKER_MAX_LENGTH (1u << 28) // same as TLV_MAX_LENGTH
+#define WORKER_MAX_BACK_OFF 60       // seconds
+
+static int worker_read_full(int s, void *buff, size_t len)
+{
+    uint8_t *p = (uint8_t *)buff;
+    size_t l = 0;
+    while (l < len)
+    {
+        ssize_t r = read(s, p + l, len - l);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r <= 0)
+        {
+            return -1;
+        }
+        l += r;
+    }
+    return 0;
+}
+
+static int worker_write_full(int s, const void *buff, size_t len)
+{
+    const uint8_t *p = (const uint8_t *)buff;
+    size_t l = 0;
+    while (l < len)
+    {
+        ssize_t r = write(s, p + l, len - l);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r <= 0)
+        {
+            return -1;
+        }
+        l += r;
+    }
+    return 0;
+}
+
+static int worker_tlv_write(int s, uint16_t cid, uint8_t type, const uint8_t *value, uint16_t len)
+{
+    uint8_t buff[5 + 16];
+    buff[0] = type;
+    buff[1] = cid;
+    buff[2] = cid >> 8;
+    buff[3] = len;
+    buff[4] = len >> 8;
+    memcpy(&buff[5], value, len);
+    return worker_write_full(s, buff, 5 + len);
+}
+
+// value is resized to the length of the tlv
+static int worker_tlv_read(int s, uint16_t *cid, uint8_t *type, std::vector<uint8_t> &value)
+{
+    uint8_t header[5];
+    if (worker_read_full(s, header, 5) < 0)
+    {
+        return -1;
+    }
+    *type = header[0];
+    *cid = header[1] + 256 * header[2];
+    uint32_t len = header[3] + 256 * header[4];
+    if (len == 0xffff)
+    {
+        uint8_t l[4];
+        if (worker_read_full(s, l, 4) < 0)
+        {
+            return -1;
+        }
+        len = l[0] + (l[1] << 8) + (l[2] << 16) + ((uint32_t)l[3] << 24);
+    }
+    if (len < 1 || len > WORKER_MAX_LENGTH)
+    {
+        return -1;
+    }
+    value.resize(len);
+    return worker_read_full(s, &value[0], len);
+}
+
+// numerical address, getaddrinfo() does not fit a static binary
+static int worker_connect(const char *host, unsigned short port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) <= 0)
+    {
+        printf("Worker Error : invalid address %s\n", host);
+        return -1;
+    }
+    int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s >= 0 && connect(s, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(s);
+        s = -1;
+    }
+    return s;
+}
+
+// 0 : no more jobs, -1 : connection lost
+static int worker_session(int s, mpz_t v, quadratic_context_t *ctx, bool verbose)
+{
+    std::vector<uint8_t> value;
+    uint8_t zero = 0;
+    uint16_t cid = 0;
+    uint8_t type;
+
+    if (worker_tlv_write(s, 0, QUADRATIC_TLV_NEW, &zero, 1) < 0 || worker_tlv_read(s, &cid, &type, value) < 0)
+    {
+        return -1;
+    }
+    if (type == QUADRATIC_TLV_STOP)
+    {
+        return 0;
+    }
+    if (worker_tlv_write(s, cid, QUADRATIC_TLV_READY, &zero, 1) < 0)
+    {
+        return -1;
+    }
+    while (1)
+    {
+        if (worker_tlv_read(s, &cid, &type, value) < 0)
+        {
+            return -1;
+        }
+        if (type == QUADRATIC_TLV_STOP)
+        {
+            return 0;
+        }
+        if (type != QUADRATIC_TLV_JOB || value.size() < 9)
+        {
+            printf("Worker Error : Unknown tlv %d\n", type);
+            return -1;
+        }
+        uint8_t verdict[9];
+        memcpy(verdict, &value[0], 8); // job id
+        verdict[8] = quadratic_request_run(value[8], value.data() + 9, value.size() - 9, v, ctx);
+        if (verbose)
+        {
+            printf("Worker cid %d %.*s %s\n", (int)cid, (int)value.size() - 9, (const char *)value.data() + 9,
+                   verdict[8] == QUADRATIC_VERDICT_PRIME       ? "might be prime"
+                   : verdict[8] == QUADRATIC_VERDICT_COMPOSITE ? "composite for sure"
+                                                               : "invalid");
+            fflush(stdout);
+        }
+        if (worker_tlv_write(s, cid, QUADRATIC_TLV_VERDICT, verdict, 9) < 0 ||
+            worker_tlv_write(s, cid, QUADRATIC_TLV_READY, &zero, 1) < 0)
+        {
+            return -1;
+        }
+    }
+}
+
+static void worker_thread(const char *host, unsigned short port, bool verbose)
+{
+    quadratic_context_t *ctx = quadratic_context_create();
+    mpz_t v;
+    mpz_init(v);
+    unsigned back_off = 0;
+    while (1)
+    {
+        int s = worker_connect(host, port);
+        int rc = -1;
+        if (s >= 0)
+        {
+            rc = worker_session(s, v, ctx, verbose);
+            close(s);
+        }
+        if (rc == 0)
+        {
+            break;
+        }
+        // a protocol/disconnection error occured, must retry
+        printf("Worker Error : connection to %s:%u lost, retry in %u seconds\n", host, port, back_off);
+        fflush(stdout);
+        sleep(back_off);
+        back_off = back_off * 3 / 2 + 1;
+        back_off = back_off > WORKER_MAX_BACK_OFF ? WORKER_MAX_BACK_OFF : back_off;
+    }
+    mpz_clear(v);
+    quadratic_context_destroy(ctx);
+}
+
+int quadratic_worker(const char *host, unsigned short port, unsigned thread_count, bool verbose)
+{
+    signal(SIGPIPE, SIG_IGN);
+    printf("Worker of %s:%u with %u threads\n", host, port, thread_count);
+    fflush(stdout);
+    std::vector<std::thread> threads;
+    for (unsigned i = 0; i < thread_count; i++)
+    {
+        threads.emplace_back(worker_thread, host, port, verbose);
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    printf("Worker done, no more jobs\n");
+    return 0;
+}
+
+// ------------------------------------------------------------------------------
+// Simple foolguard unit tests
+// ------------------------------------------------------------------------------
+
+void quadratic_worker_self_test(void)
+{
+    printf("Worker ...\n");
+    // a job file as lnrc -server -j reads it, one expression per line, with invalid lines
+    static const char *lines[] = {
+        "2^127-1",
+        "2^127-1)",
+        "1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1+(1)))))))))))))))))))))",
+        "2^67-1",
+        "2^61-1 2^89-1",
+    };
+    static const uint8_t verdicts[] = {QUADRATIC_VERDICT_PRIME, QUADRATIC_VERDICT_INVALID, QUADRATIC_VERDICT_INVALID,
+                                       QUADRATIC_VERDICT_COMPOSITE, QUADRATIC_VERDICT_INVALID};
+    unsigned count = sizeof(lines) / sizeof(lines[0]);
+
+    // the server side of the session, on a socket pair
+    int s[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, s) == 0);
+    int rc = -1;
+    std::thread worker([&]() {
+        quadratic_context_t *ctx = quadratic_context_create();
+        mpz_t v;
+        mpz_init(v);
+        rc = worker_session(s[1], v, ctx, false);
+        mpz_clear(v);
+        quadratic_context_destroy(ctx);
+    });
+
+    std::vector<uint8_t> value;
+    uint16_t cid;
+    uint8_t type;
+    uint8_t zero = 0;
+    assert(worker_tlv_read(s[0], &cid, &type, value) == 0 && type == QUADRATIC_TLV_NEW);
+    assert(worker_tlv_write(s[0], 7, QUADRATIC_TLV_NEW, &zero, 1) == 0);
+    for (unsigned i = 0; i < count; i++)
+    {
+        assert(worker_tlv_read(s[0], &cid, &type, value) == 0 && type == QUADRATIC_TLV_READY && cid == 7);
+        // TLV_JOB : uint64 id, uint8 request type, expression, with a long length
+        uint32_t len = 9 + strlen(lines[i]);
+        uint8_t header[9] = {QUADRATIC_TLV_JOB, 7, 0, 0xff, 0xff, (uint8_t)len, (uint8_t)(len >> 8), 0, 0};
+        uint8_t job[9] = {(uint8_t)i, 0, 0, 0, 0, 0, 0, 0, QUADRATIC_REQUEST_EXPRESSION};
+        assert(worker_write_full(s[0], header, 9) == 0 && worker_write_full(s[0], job, 9) == 0);
+        assert(worker_write_full(s[0], lines[i], strlen(lines[i])) == 0);
+        assert(worker_tlv_read(s[0], &cid, &type, value) == 0 && type == QUADRATIC_TLV_VERDICT);
+        assert(value.size() == 9 && value[0] == i && value[8] == verdicts[i]);
+    }
+    assert(worker_tlv_read(s[0], &cid, &type, value) == 0 && type == QUADRATIC_TLV_READY);
+    assert(worker_tlv_write(s[0], 7, QUADRATIC_TLV_STOP, &zero, 1) == 0);
+    worker.join();
+    assert(rc == 0);
+    close(s[0]);
+    close(s[1]);
+}
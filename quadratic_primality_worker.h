@@ -0,0 +1,35 @@
+#pragma once
+
+// -----------------------------------------------------------------------
+// Quadratic primality test
+//
+// worker of the distributed server of minimal_k_lt_1000000000000000
+//
+//    lnrc -server -j candidates.txt                  (on host 192.168.1.2)
+//    quadratic -t 8 --worker 192.168.1.2 15002       (on each host)
+//
+// Each thread has its own connection, to the server or to a proxy, with the
+// TLV framing of minimal_k_lt_1000000000000000/tlv.h :
+//
+//    header  : uint8 type, uint16 cid, uint16 length, 0xffff is followed by a uint32 length
+//    NEW, READY, STOP : 1 byte value
+//    JOB     : uint64 id, uint8 request type, payload, as in quadratic_primality_server.h
+//    VERDICT : uint64 id, uint8 verdict
+//
+// All integers are little-endian. The jobs of a lost connection are dispatched
+// again by the server, the thread connects again with an increasing back-off.
+// The worker returns when the server has no more jobs.
+// -----------------------------------------------------------------------
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define QUADRATIC_TLV_STOP 3
+#define QUADRATIC_TLV_READY 12
+#define QUADRATIC_TLV_NEW 13
+#define QUADRATIC_TLV_JOB 30
+#define QUADRATIC_TLV_VERDICT 31
+
+// host is a numerical IPv4 address
+int quadratic_worker(const char *host, unsigned short port, unsigned thread_count, bool verbose);
+void quadratic_worker_self_test(void);